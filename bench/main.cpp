@@ -0,0 +1,491 @@
+#include "BVHBuilder.hpp"
+#include "BVHMetrics.hpp"
+#include "BuildTrace.hpp"
+#include "SceneGenerator.hpp"
+#include "TraversalStats.hpp"
+#include "TwoLevelBVH.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+constexpr const char *kHelpStr = "Adypt BVH benchmark\n"
+                                 "\t-obj [WAVEFRONT OBJ FILENAME] (repeatable)\n"
+                                 "\t-gen [soup|skinny|grid|architecture|size_variance] [TRIANGLE COUNT] (repeatable)\n"
+                                 "\t-seed [SEED] (for the following -gen scenes, default 0)\n"
+                                 "\t-builder [sbvh|parallel|pss|shape] (repeatable, default all but shape)\n"
+                                 "\t-threads [THREAD COUNT] (default all hardware threads)\n"
+                                 "\t-numa (pin builder threads and their memory to NUMA nodes)\n"
+                                 "\t-duplication-budget [MAX REFERENCES PER TRIANGLE] (default unlimited)\n"
+                                 "\t-presplit [AABB TO TRIANGLE AREA RATIO] (default off)\n"
+                                 "\t-optimize [TIME BUDGET MS] [TARGET SAH REDUCTION] (default off)\n"
+                                 "\t-optimizer [rotation|treelet] (default rotation)\n"
+                                 "\t-budget [TIME BUDGET MS] (parallel builders finish with median splits past it)\n"
+                                 "\t-bins [MIN] [MAX] (per node split bins, default 8 256, 32 32 fixes the count)\n"
+                                 "\t-tuning [TUNING FILENAME] (task granularity, calibrated and written if missing)\n"
+                                 "\t-node-width [4|8] (children per wide node, repeatable, default 8)\n"
+                                 "\t-reps [REPETITIONS] (default 3)\n"
+                                 "\t-res [WIDTH] [HEIGHT] (primary rays traced per repetition, default 1280 720)\n"
+                                 "\t-instances (check two-level traversal of scaled instances against a flattened scene)\n"
+                                 "\t-refit (check a refit to a twisted copy of the scene against a rebuild)\n"
+                                 "\t-json [OUTPUT FILENAME] (default stdout)\n"
+                                 "\t-trace [CHROME TRACE JSON FILENAME] (loads, builds and collapses of every run)";
+
+constexpr const char *kStageNames[] = {"load", "build", "collapse", "upload_prep", "traversal"};
+enum Stage { kLoad = 0, kBuild, kCollapse, kUploadPrep, kTraversal, kStageCount };
+
+struct SceneSource {
+	std::string m_name;
+	std::function<std::shared_ptr<Scene>()> m_create;
+};
+
+struct Run {
+	std::string m_scene, m_builder;
+	uint32_t m_triangle_count{}, m_node_width{8};
+	std::vector<double> m_stage_ms[kStageCount];
+	uint64_t m_stage_peak_rss[kStageCount]{};
+	double m_binary_sah{}, m_wide_sah{}, m_mrays_per_sec{};
+	double m_full_quality_fraction{1.0}; // the lowest of the repetitions, below 1 if the build budget was exceeded
+	uint32_t m_wide_node_count{};
+};
+
+struct InstanceCheck {
+	std::string m_scene;
+	uint64_t m_hit_count{}, m_mismatch_count{};
+	double m_max_t_error{}; // relative to the reference distance
+
+	// rays grazing triangle edges may hit or miss differently in the two spaces
+	static constexpr double kMaxMismatchRatio = 1e-4;
+	bool IsPassed() const { return double(m_mismatch_count) <= kMaxMismatchRatio * double(m_hit_count); }
+};
+
+struct RefitCheck {
+	std::string m_scene;
+	double m_unmoved_sah_ratio{}; // of a refit before the twist, 1 unless the reference SAH is off
+	double m_refit_ms{}, m_sah_ratio{};
+	bool m_rebuild_due{};
+	uint64_t m_hit_count{}, m_mismatch_count{};
+
+	// the refitted and the rebuilt tree hold the same triangles, only hits on shared edges may differ
+	bool IsPassed() const {
+		return std::abs(m_unmoved_sah_ratio - 1.0) < 1e-6 &&
+		       double(m_mismatch_count) <= InstanceCheck::kMaxMismatchRatio * double(m_hit_count);
+	}
+};
+
+static uint64_t get_peak_rss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	return uint64_t(usage.ru_maxrss) * 1024u;
+#endif
+#endif
+}
+
+template <class F> static double time_ms(F &&func) {
+	auto begin = std::chrono::steady_clock::now();
+	func();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// collapses the binary BVH to WIDTH-wide nodes, then prepares the upload and traces primary rays on the CPU
+template <uint32_t WIDTH, class BinaryBVHPtr>
+static void run_wide(const BVHConfig &config, const BinaryBVHPtr &binary_bvh, uint32_t width, uint32_t height,
+                     Run *p_run) {
+	std::shared_ptr<BasicWideBVH<WIDTH>> wide_bvh;
+	p_run->m_stage_ms[kCollapse].push_back(time_ms([&]() { wide_bvh = BasicWideBVH<WIDTH>::Build(binary_bvh); }));
+	p_run->m_stage_peak_rss[kCollapse] = get_peak_rss();
+
+	// the CPU work AcceleratedScene does before its buffer uploads
+	std::vector<glm::vec4> tri_matrices;
+	p_run->m_stage_ms[kUploadPrep].push_back(time_ms([&]() { tri_matrices = wide_bvh->GenerateTriMatrices(); }));
+	p_run->m_stage_peak_rss[kUploadPrep] = get_peak_rss();
+
+	// primary rays from outside the normalized scene looking down +z, with the viewer's default field of view
+	float tg = glm::tan(glm::pi<float>() / 6.0f);
+	glm::vec3 look{0.0f, 0.0f, 1.0f}, side = glm::vec3{1.0f, 0.0f, 0.0f} * tg * (float(width) / float(height));
+	glm::vec3 up = glm::normalize(glm::cross(look, side)) * tg;
+	// only the rays are timed, the traversal takes the matrices timed above and the counters are allocated before
+	BasicWideBVHTraversal<WIDTH> traversal{wide_bvh, std::move(tri_matrices)};
+	TraversalStats stats{width, height};
+	double traversal_ms = time_ms(
+	    [&]() { stats.Trace(traversal, {0.0f, 0.0f, -2.5f}, look, side, up, config.GetThreadCount()); });
+	p_run->m_stage_ms[kTraversal].push_back(traversal_ms);
+	p_run->m_stage_peak_rss[kTraversal] = get_peak_rss();
+
+	p_run->m_wide_sah = BVHMetrics::Compute(*wide_bvh, config, 0).m_sah;
+	p_run->m_wide_node_count = wide_bvh->GetNodes().size();
+}
+
+// builds once, then collapses to the node width of every run in [p_runs, p_runs + run_count)
+static void run_builder(const BVHConfig &config, const std::shared_ptr<Scene> &scene, uint32_t width, uint32_t height,
+                        Run *p_runs, uint32_t run_count) {
+	auto build_begin = std::chrono::steady_clock::now();
+	BuildBinaryBVH(config, scene, [&](const auto &binary_bvh) {
+		double build_ms =
+		    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_begin).count();
+		uint64_t build_peak_rss = get_peak_rss();
+		double binary_sah = BVHMetrics::Compute(*binary_bvh, config, 0).m_sah;
+		for (Run *p_run = p_runs; p_run != p_runs + run_count; ++p_run) {
+			p_run->m_stage_ms[kBuild].push_back(build_ms);
+			p_run->m_stage_peak_rss[kBuild] = build_peak_rss;
+			p_run->m_full_quality_fraction =
+			    std::min(p_run->m_full_quality_fraction, binary_bvh->GetBuildStats().GetFullQualityFraction());
+			p_run->m_binary_sah = binary_sah;
+			if (p_run->m_node_width == 4)
+				run_wide<4>(config, binary_bvh, width, height, p_run);
+			else
+				run_wide<8>(config, binary_bvh, width, height, p_run);
+		}
+	});
+}
+
+// calls func(origin, dir) for the primary rays of the timed traversal, in pixel order
+template <class F> static void for_each_primary_ray(uint32_t width, uint32_t height, F &&func) {
+	float tg = glm::tan(glm::pi<float>() / 6.0f);
+	glm::vec3 origin{0.0f, 0.0f, -2.5f}, look{0.0f, 0.0f, 1.0f};
+	glm::vec3 side = glm::vec3{1.0f, 0.0f, 0.0f} * tg * (float(width) / float(height));
+	glm::vec3 up = glm::normalize(glm::cross(look, side)) * tg;
+	for (uint32_t y = 0; y < height; ++y)
+		for (uint32_t x = 0; x < width; ++x) {
+			glm::vec2 coord = (glm::vec2{x, y} + 0.5f) * glm::vec2{2.0f / float(width), 2.0f / float(height)} - 1.0f;
+			func(origin, glm::normalize(look - side * coord.x - up * coord.y));
+		}
+}
+
+// traces the primary rays through a TwoLevelBVH of three scaled and rotated instances of the scene in front of one
+// another, and through a WideBVH of their triangles flattened to world space
+static InstanceCheck check_instances(const BVHConfig &config, const std::shared_ptr<Scene> &scene, uint32_t width,
+                                     uint32_t height) {
+	const glm::mat4 transforms[] = {
+	    glm::scale(glm::translate(glm::mat4{1.0f}, {0.4f, 0.2f, 1.0f}), glm::vec3{0.25f}),
+	    glm::rotate(glm::translate(glm::mat4{1.0f}, {0.0f, 0.0f, 3.0f}), 0.5f, {0.0f, 1.0f, 0.0f}),
+	    glm::scale(glm::translate(glm::mat4{1.0f}, {0.0f, 0.0f, 10.0f}), glm::vec3{4.0f})};
+
+	TwoLevelBVH two_level{config};
+	uint32_t mesh_idx = two_level.AddMesh(scene);
+	std::vector<Triangle> world_triangles;
+	AABB world_aabb;
+	for (const glm::mat4 &transform : transforms) {
+		two_level.AddInstance(mesh_idx, transform);
+		for (Triangle tri : scene->GetTriangles()) {
+			for (glm::vec3 &position : tri.positions) {
+				position = glm::vec3{transform * glm::vec4{position, 1.0f}};
+				world_aabb.Expand(position);
+			}
+			world_triangles.push_back(tri);
+		}
+	}
+	two_level.BuildTopLevel();
+	// the flattened scene is normalized again, by a uniform scale about the center of the world bound
+	glm::vec3 extent3 = world_aabb.GetExtent(), center = world_aabb.GetCenter();
+	float extent = glm::max(extent3.x, glm::max(extent3.y, extent3.z)) * 0.5f;
+	WideBVHTraversal flat{BuildWideBVH(config, Scene::CreateFromTriangles(std::move(world_triangles)))};
+
+	InstanceCheck ret;
+	for_each_primary_ray(width, height, [&](const glm::vec3 &origin, const glm::vec3 &dir) {
+		TwoLevelBVH::Hit hit;
+		WideBVHTraversal::Hit flat_hit;
+		bool is_hit = two_level.Intersect({origin, 1e-6f, dir}, &hit);
+		bool is_flat_hit = flat.Intersect({(origin - center) / extent, 1e-6f / extent, dir}, &flat_hit);
+		ret.m_hit_count += is_hit;
+		if (is_hit != is_flat_hit) {
+			++ret.m_mismatch_count;
+			return;
+		}
+		if (!is_hit)
+			return;
+		double flat_t = double(flat_hit.t) * extent, t_error = std::abs(double(hit.hit.t) - flat_t) / flat_t;
+		ret.m_max_t_error = std::max(ret.m_max_t_error, t_error);
+		ret.m_mismatch_count += t_error > 1e-3;
+	});
+	return ret;
+}
+
+// refits a WideBVH of a copy of the scene first unmoved, then twisted about the y axis, and traces the primary rays
+// through it and through a tree rebuilt for the twisted triangles
+static RefitCheck check_refit(const BVHConfig &config, const std::shared_ptr<Scene> &scene, uint32_t width,
+                              uint32_t height) {
+	constexpr float kTwist = 0.6f; // radians per unit of y, the normalized scene spans y in at most [-1, 1]
+
+	RefitCheck ret;
+	auto deformed_scene = std::make_shared<Scene>(*scene);
+	WideBVHTraversal refitted{BuildWideBVH(config, deformed_scene)};
+	ret.m_unmoved_sah_ratio = refitted.Refit();
+
+	std::vector<Triangle> triangles = scene->GetTriangles();
+	for (Triangle &tri : triangles)
+		for (glm::vec3 &position : tri.positions) {
+			float c = glm::cos(kTwist * position.y), s = glm::sin(kTwist * position.y);
+			position = {c * position.x + s * position.z, position.y, c * position.z - s * position.x};
+		}
+	deformed_scene->UpdateTriangles(triangles);
+	ret.m_refit_ms = time_ms([&]() { ret.m_sah_ratio = refitted.Refit(); });
+	ret.m_rebuild_due = refitted.GetBVHPtr()->IsRebuildDue();
+	WideBVHTraversal rebuilt{BuildWideBVH(config, deformed_scene)};
+
+	for_each_primary_ray(width, height, [&](const glm::vec3 &origin, const glm::vec3 &dir) {
+		WideBVHTraversal::Hit hit, rebuilt_hit;
+		bool is_hit = refitted.Intersect({origin, 1e-6f, dir}, &hit);
+		bool is_rebuilt_hit = rebuilt.Intersect({origin, 1e-6f, dir}, &rebuilt_hit);
+		ret.m_hit_count += is_hit;
+		ret.m_mismatch_count +=
+		    is_hit != is_rebuilt_hit || (is_hit && std::abs(hit.t - rebuilt_hit.t) > 1e-4f * rebuilt_hit.t);
+	});
+	return ret;
+}
+
+static std::string stage_json(const std::vector<double> &samples, uint64_t peak_rss) {
+	std::vector<double> sorted = samples;
+	std::sort(sorted.begin(), sorted.end());
+	double mean = 0.0;
+	for (double s : sorted)
+		mean += s;
+	mean /= double(sorted.size());
+	return fmt::format(R"({{"ms":[{}],"min_ms":{},"median_ms":{},"mean_ms":{},"peak_rss_bytes":{}}})",
+	                   fmt::join(samples, ","), sorted.front(), sorted[sorted.size() / 2], mean, peak_rss);
+}
+
+static std::string run_json(const Run &run, uint32_t width, uint32_t height) {
+	std::string stages;
+	for (uint32_t s = 0; s < kStageCount; ++s)
+		stages += fmt::format(R"({}"{}":{})", s ? "," : "", kStageNames[s],
+		                      stage_json(run.m_stage_ms[s], run.m_stage_peak_rss[s]));
+	return fmt::format(R"({{"scene":"{}","triangles":{},"builder":"{}","node_width":{},"stages":{{{}}},)"
+	                   R"("binary_sah":{},"wide_sah":{},"wide_nodes":{},"full_quality_fraction":{},"rays":{},)"
+	                   R"("mrays_per_sec":{}}})",
+	                   run.m_scene, run.m_triangle_count, run.m_builder, run.m_node_width, stages, run.m_binary_sah,
+	                   run.m_wide_sah, run.m_wide_node_count, run.m_full_quality_fraction, uint64_t(width) * height,
+	                   run.m_mrays_per_sec);
+}
+
+int main(int argc, char **argv) {
+	// keep stdout for the JSON report
+	spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
+	spdlog::set_pattern("[%H:%M:%S.%e] [%^%l%$] [thread %t] %v");
+
+	--argc;
+	++argv;
+	std::vector<SceneSource> scenes;
+	std::vector<BVHConfig::Builder> builders;
+	std::vector<uint32_t> node_widths;
+	BVHConfig config = {};
+	uint32_t reps = 3, width = 1280, height = 720;
+	uint64_t seed = 0;
+	bool instances = false, refit = false;
+	const char *json_filename = nullptr, *trace_filename = nullptr, *tuning_filename = nullptr;
+	for (int i = 0; i < argc; ++i) {
+		if (i + 1 < argc && strcmp(argv[i], "-obj") == 0) {
+			const char *filename = argv[++i];
+			scenes.push_back({filename, [filename]() { return Scene::CreateFromFile(filename); }});
+		} else if (i + 2 < argc && strcmp(argv[i], "-gen") == 0) {
+			SceneGenerator::Kind kind;
+			if (!SceneGenerator::ParseKind(argv[++i], &kind)) {
+				spdlog::error("Unknown scene kind {}", argv[i]);
+				return EXIT_FAILURE;
+			}
+			auto count = (uint32_t)std::stoul(argv[++i]);
+			scenes.push_back({fmt::format("{}_{}_seed{}", SceneGenerator::GetKindName(kind), count, seed),
+			                  [kind, count, seed]() { return SceneGenerator::Generate(kind, count, seed); }});
+		} else if (i + 1 < argc && strcmp(argv[i], "-seed") == 0)
+			seed = std::stoull(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-builder") == 0) {
+			if (!BVHConfig::ParseBuilder(argv[++i], &config.m_builder)) {
+				spdlog::error("Unknown builder {}", argv[i]);
+				return EXIT_FAILURE;
+			}
+			builders.push_back(config.m_builder);
+		} else if (i + 1 < argc && strcmp(argv[i], "-threads") == 0)
+			config.m_thread_count = std::stoul(argv[++i]);
+		else if (strcmp(argv[i], "-numa") == 0)
+			config.m_numa = true;
+		else if (i + 1 < argc && strcmp(argv[i], "-duplication-budget") == 0)
+			config.m_duplication_budget = std::stof(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-presplit") == 0)
+			config.m_presplit_threshold = std::stof(argv[++i]);
+		else if (i + 2 < argc && strcmp(argv[i], "-optimize") == 0) {
+			config.m_optimize_ms = std::stoul(argv[++i]);
+			config.m_optimize_target = std::stof(argv[++i]);
+		} else if (i + 1 < argc && strcmp(argv[i], "-optimizer") == 0) {
+			if (!BVHConfig::ParseOptimizer(argv[++i], &config.m_optimizer)) {
+				spdlog::error("Unknown optimizer {}", argv[i]);
+				return EXIT_FAILURE;
+			}
+		} else if (i + 1 < argc && strcmp(argv[i], "-budget") == 0)
+			config.m_build_ms = std::stoul(argv[++i]);
+		else if (i + 2 < argc && strcmp(argv[i], "-bins") == 0) {
+			config.m_min_bins = std::stoul(argv[++i]);
+			config.m_max_bins = std::stoul(argv[++i]);
+		} else if (i + 1 < argc && strcmp(argv[i], "-tuning") == 0)
+			tuning_filename = argv[++i];
+		else if (i + 1 < argc && strcmp(argv[i], "-node-width") == 0) {
+			node_widths.push_back(std::stoul(argv[++i]));
+			if (node_widths.back() != 4 && node_widths.back() != 8) {
+				spdlog::error("Unsupported node width {}", argv[i]);
+				return EXIT_FAILURE;
+			}
+		} else if (i + 1 < argc && strcmp(argv[i], "-reps") == 0)
+			reps = std::max(1ul, std::stoul(argv[++i]));
+		else if (i + 2 < argc && strcmp(argv[i], "-res") == 0) {
+			width = std::max(1ul, std::stoul(argv[++i]));
+			height = std::max(1ul, std::stoul(argv[++i]));
+		} else if (strcmp(argv[i], "-instances") == 0)
+			instances = true;
+		else if (strcmp(argv[i], "-refit") == 0)
+			refit = true;
+		else if (i + 1 < argc && strcmp(argv[i], "-json") == 0)
+			json_filename = argv[++i];
+		else if (i + 1 < argc && strcmp(argv[i], "-trace") == 0)
+			trace_filename = argv[++i];
+		else {
+			puts(kHelpStr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (scenes.empty()) {
+		puts(kHelpStr);
+		return EXIT_FAILURE;
+	}
+	if (builders.empty())
+		builders = {BVHConfig::kSBVH, BVHConfig::kParallelSBVH, BVHConfig::kPSSBVH};
+	if (node_widths.empty())
+		node_widths = {8};
+	// calibrating traces a build of its own, so before tracing starts
+	if (tuning_filename)
+		config.m_tuning = BuildTuning::LoadOrCalibrate(tuning_filename, config);
+	if (trace_filename)
+		BuildTrace::Enable();
+
+	std::vector<Run> runs;
+	std::vector<InstanceCheck> instance_checks;
+	std::vector<RefitCheck> refit_checks;
+	for (const auto &source : scenes) {
+		// node widths vary fastest, they share the build of their builder
+		std::vector<Run> scene_runs(builders.size() * node_widths.size());
+		std::vector<double> load_ms;
+		for (uint32_t rep = 0; rep < reps; ++rep) {
+			std::shared_ptr<Scene> scene;
+			load_ms.push_back(time_ms([&]() { scene = source.m_create(); }));
+			if (!scene) {
+				spdlog::error("Failed to create scene {}", source.m_name);
+				return EXIT_FAILURE;
+			}
+			uint64_t load_peak_rss = get_peak_rss();
+
+			for (uint32_t b = 0; b < builders.size(); ++b) {
+				Run *p_runs = scene_runs.data() + b * node_widths.size();
+				for (uint32_t w = 0; w < node_widths.size(); ++w) {
+					Run &run = p_runs[w];
+					run.m_scene = source.m_name;
+					run.m_builder = BVHConfig::GetBuilderName(builders[b]);
+					run.m_node_width = node_widths[w];
+					run.m_triangle_count = scene->GetTriangles().size();
+					run.m_stage_ms[kLoad] = load_ms;
+					run.m_stage_peak_rss[kLoad] = load_peak_rss;
+				}
+				config.m_builder = builders[b];
+				run_builder(config, scene, width, height, p_runs, node_widths.size());
+			}
+			if (instances && rep == 0) {
+				config.m_builder = builders.front();
+				InstanceCheck check = check_instances(config, scene, width, height);
+				check.m_scene = source.m_name;
+				spdlog::log(check.IsPassed() ? spdlog::level::info : spdlog::level::err,
+				            "{}: {} of {} instanced hits differ from the flattened scene, max t error {:.2e}",
+				            source.m_name, check.m_mismatch_count, check.m_hit_count, check.m_max_t_error);
+				instance_checks.push_back(std::move(check));
+			}
+			if (refit && rep == 0) {
+				config.m_builder = builders.front();
+				RefitCheck check = check_refit(config, scene, width, height);
+				check.m_scene = source.m_name;
+				spdlog::log(check.IsPassed() ? spdlog::level::info : spdlog::level::err,
+				            "{}: unmoved refit SAH ratio {:.4f}, twisted refit {:.2f} ms with SAH ratio {:.3f}{}, {} of "
+				            "{} hits differ from a rebuild",
+				            source.m_name, check.m_unmoved_sah_ratio, check.m_refit_ms, check.m_sah_ratio,
+				            check.m_rebuild_due ? " (rebuild due)" : "", check.m_mismatch_count, check.m_hit_count);
+				refit_checks.push_back(std::move(check));
+			}
+		}
+		for (Run &run : scene_runs) {
+			std::vector<double> sorted = run.m_stage_ms[kTraversal];
+			std::sort(sorted.begin(), sorted.end());
+			run.m_mrays_per_sec = double(width) * height / (sorted[sorted.size() / 2] * 1000.0);
+			spdlog::info("{} / {} / {}-wide: build {:.1f} ms, collapse {:.1f} ms, {:.2f} Mrays/s, SAH {:.3f}",
+			             run.m_scene, run.m_builder, run.m_node_width, run.m_stage_ms[kBuild].back(),
+			             run.m_stage_ms[kCollapse].back(), run.m_mrays_per_sec, run.m_wide_sah);
+			runs.push_back(std::move(run));
+		}
+	}
+
+	if (trace_filename) {
+		BuildTrace::Disable();
+		if (!BuildTrace::WriteJSON(trace_filename))
+			return EXIT_FAILURE;
+	}
+
+	std::string json =
+	    fmt::format(R"({{"reps":{},"threads":{},"numa":{},"duplication_budget":{},"presplit_threshold":{},)"
+	                R"("optimize_ms":{},"optimize_target":{},"optimizer":"{}","min_bins":{},"max_bins":{},)"
+	                R"("local_run_work_ns":{},"parallel_for_block_size":{},"build_budget_ms":{},"runs":[)",
+	                reps, config.GetThreadCount(), config.m_numa, config.m_duplication_budget,
+	                config.m_presplit_threshold, config.m_optimize_ms, config.m_optimize_target,
+	                BVHConfig::GetOptimizerName(config.m_optimizer), config.m_min_bins, config.m_max_bins,
+	                config.m_tuning.m_local_run_work_ns, config.m_tuning.m_parallel_for_block_size, config.m_build_ms);
+	for (uint32_t i = 0; i < runs.size(); ++i)
+		json += (i ? "," : "") + run_json(runs[i], width, height);
+	json += "],\"instance_checks\":[";
+	for (uint32_t i = 0; i < instance_checks.size(); ++i)
+		json += fmt::format(R"({}{{"scene":"{}","hits":{},"mismatches":{},"max_t_error":{}}})", i ? "," : "",
+		                    instance_checks[i].m_scene, instance_checks[i].m_hit_count,
+		                    instance_checks[i].m_mismatch_count, instance_checks[i].m_max_t_error);
+	json += "],\"refit_checks\":[";
+	for (uint32_t i = 0; i < refit_checks.size(); ++i)
+		json += fmt::format(R"({}{{"scene":"{}","unmoved_sah_ratio":{},"refit_ms":{},"sah_ratio":{},)"
+		                    R"("rebuild_due":{},"hits":{},"mismatches":{}}})",
+		                    i ? "," : "", refit_checks[i].m_scene, refit_checks[i].m_unmoved_sah_ratio,
+		                    refit_checks[i].m_refit_ms, refit_checks[i].m_sah_ratio, refit_checks[i].m_rebuild_due,
+		                    refit_checks[i].m_hit_count, refit_checks[i].m_mismatch_count);
+	json += "]}\n";
+
+	if (json_filename) {
+		FILE *file = fopen(json_filename, "w");
+		if (!file) {
+			spdlog::error("Failed to open {}", json_filename);
+			return EXIT_FAILURE;
+		}
+		fputs(json.c_str(), file);
+		fclose(file);
+		spdlog::info("Benchmark results written to {}", json_filename);
+	} else
+		fputs(json.c_str(), stdout);
+
+	for (const InstanceCheck &check : instance_checks)
+		if (!check.IsPassed())
+			return EXIT_FAILURE;
+	for (const RefitCheck &check : refit_checks)
+		if (!check.IsPassed())
+			return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -4,7 +4,9 @@
 
 #extension GL_EXT_nonuniform_qualifier : enable
 
+#ifndef kTraversalStackSize
 #define kTraversalStackSize 23*10
+#endif
 
 #include "common.h"
 #include "compress.glsl"
@@ -20,25 +20,6 @@ std::shared_ptr<AcceleratedScene> AcceleratedScene::Create(const std::shared_ptr
 	return ret;
 }
 
-std::vector<glm::vec4> AcceleratedScene::generate_bvh_tri_matrices(const std::shared_ptr<WideBVH> &widebvh) {
-	std::vector<glm::vec4> matrices;
-	matrices.reserve(widebvh->GetTriIndices().size() * 3u);
-	for (uint32_t t : widebvh->GetTriIndices()) {
-		const Triangle &tri = widebvh->GetScenePtr()->GetTriangles()[t];
-		const glm::vec3 &v0 = tri.positions[0], &v1 = tri.positions[1], &v2 = tri.positions[2];
-		glm::vec4 c0{v0 - v2, 0.0f};
-		glm::vec4 c1{v1 - v2, 0.0f};
-		glm::vec4 c2{glm::cross(v0 - v2, v1 - v2), 0.0f};
-		glm::vec4 c3{v2, 1.0f};
-		glm::mat4 mtx{c0.x, c1.x, c2.x, c3.x, c0.y, c1.y, c2.y, c3.y, c0.z, c1.z, c2.z, c3.z, c0.w, c1.w, c2.w, c3.w};
-		mtx = glm::inverse(mtx);
-		matrices.emplace_back(mtx[2][0], mtx[2][1], mtx[2][2], -mtx[2][3]);
-		matrices.emplace_back(mtx[0][0], mtx[0][1], mtx[0][2], mtx[0][3]);
-		matrices.emplace_back(mtx[1][0], mtx[1][1], mtx[1][2], mtx[1][3]);
-	}
-	return matrices;
-}
-
 std::vector<Material>
 AcceleratedScene::generate_tri_materials(const std::shared_ptr<Scene> &scene,
                                          std::unordered_map<std::string, uint32_t> *texture_name_map) {
@@ -269,7 +250,7 @@ void AcceleratedScene::create_bvh_buffers(const std::shared_ptr<myvk::Queue> &gr
 	}
 
 	{ // create bvh_tri_matrices_staging_buffer
-		std::vector<glm::vec4> tri_matrices = generate_bvh_tri_matrices(widebvh);
+		std::vector<glm::vec4> tri_matrices = widebvh->GenerateTriMatrices();
 		bvh_tri_matrices_staging_buffer = myvk::Buffer::CreateStaging(device, tri_matrices.begin(), tri_matrices.end());
 	}
 
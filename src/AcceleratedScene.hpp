@@ -29,7 +29,6 @@ private:
 	std::shared_ptr<myvk::DescriptorSetLayout> m_descriptor_set_layout;
 	std::shared_ptr<myvk::DescriptorSet> m_descriptor_set;
 
-	static std::vector<glm::vec4> generate_bvh_tri_matrices(const std::shared_ptr<WideBVH> &widebvh);
 	static std::vector<Material> generate_tri_materials(const std::shared_ptr<Scene> &scene,
 	                                                    std::unordered_map<std::string, uint32_t> *texture_name_map);
 
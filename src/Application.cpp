@@ -1,9 +1,10 @@
 #include "Application.hpp"
 
+#include "BVHBuilder.hpp"
+#include "BVHMetrics.hpp"
 #include "Config.hpp"
-#include "PSSBVHBuilder.hpp"
-#include "ParallelSBVHBuilder.hpp"
-#include "SBVHBuilder.hpp"
+#include "TraversalStackAnalyzer.hpp"
+#include "TraversalStats.hpp"
 #include <spdlog/spdlog.h>
 
 #include <imgui/imgui.h>
@@ -12,7 +13,7 @@
 
 #include "UIHelper.hpp"
 
-#include <time.h>
+#include <chrono>
 
 #ifndef NDEBUG
 
@@ -262,21 +263,54 @@ Application::~Application() {
 	glfwTerminate();
 }
 
-void Application::Load(const char *filename) {
-	BVHConfig bvh_config = {};
+void Application::Load(const char *filename, const BVHConfig &bvh_config, const char *cache_filename) {
 	std::shared_ptr<Scene> scene = Scene::CreateFromFile(filename);
-	
-	clock_t t1, t2;
-	
-	t1 = clock();
-	
-	auto binary_bvh = AtomicBinaryBVH::Build<ParallelSBVHBuilder>(bvh_config, scene);
-	std::shared_ptr<WideBVH> widebvh = WideBVH::Build(binary_bvh);
-	
-	t2 = clock();
-	
-	printf("\n*** BVH built in %.1fs\n", float(t2-t1)/float(CLOCKS_PER_SEC));
-	
+
+	std::shared_ptr<WideBVH> widebvh = cache_filename ? WideBVH::LoadFromFile(cache_filename, bvh_config, scene) : nullptr;
+	if (!widebvh) {
+		// wall time, clock() sums the CPU time of all builder threads
+		auto build_begin = std::chrono::steady_clock::now();
+
+		widebvh = BuildBinaryBVH(bvh_config, scene, [&](const auto &binary_bvh) {
+			std::shared_ptr<WideBVH> ret = WideBVH::Build(binary_bvh);
+
+			printf("\n*** BVH built with %s in %.1fs\n", BVHConfig::GetBuilderName(bvh_config.m_builder),
+			       std::chrono::duration<float>(std::chrono::steady_clock::now() - build_begin).count());
+
+			// only for fresh builds, a cached tree starts the viewer without them
+			spdlog::info("BVH metrics: {}",
+			             BVHMetrics::Compute(*binary_bvh, bvh_config, BVHMetrics::kReportEPOSamples).ToJSON());
+			spdlog::info("BVH metrics: {}",
+			             BVHMetrics::Compute(*ret, bvh_config, BVHMetrics::kReportEPOSamples).ToJSON());
+			return ret;
+		});
+		if (cache_filename)
+			widebvh->SaveToFile(cache_filename);
+	}
+
+	TraversalStackAnalyzer::Report stack_report = TraversalStackAnalyzer::Analyze(*widebvh);
+	stack_report.Log();
+
+#ifdef ADYPT_TRAVERSAL_STATS
+	{
+		// instrumented CPU traversal of the initial view, once with the full stack and once with a short stack
+		WideBVHTraversal traversal{widebvh};
+		glm::vec3 look, side, up;
+		m_camera->GetRayBasis(&look, &side, &up);
+		auto stats = TraversalStats::TracePrimary(traversal, m_camera->m_position, look, side, up, kDefaultWidth,
+		                                          kDefaultHeight);
+		stats->Log();
+		stats->WriteHeatmaps("traversal");
+
+		uint32_t short_stack_size = std::max(1u, stack_report.GetDepthQuantile(0.99));
+		spdlog::info("Short stack of {} entries:", short_stack_size);
+		auto short_stack_stats = TraversalStats::TracePrimary(traversal, m_camera->m_position, look, side, up,
+		                                                      kDefaultWidth, kDefaultHeight, short_stack_size);
+		short_stack_stats->Log();
+		short_stack_stats->WriteHeatmaps("traversal_short_stack");
+	}
+#endif
+
 	m_accelerated_scene = AcceleratedScene::Create(m_loader_queue, widebvh);
 	
 	//free memory used for triangles position array
@@ -58,7 +58,8 @@ private:
 public:
 	Application();
 	~Application();
-	void Load(const char *filename);
+	// cache_filename (optional) is a WideBVH cache, loaded when valid for the scene and config and written otherwise
+	void Load(const char *filename, const BVHConfig &bvh_config = {}, const char *cache_filename = nullptr);
 	void Run();
 };
 
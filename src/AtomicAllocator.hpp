@@ -41,10 +41,11 @@ public:
 	const T &operator[](uint32_t id) const { return m_chunks[id >> 16u]->chunk[id & 0xffffu]; }
 };
 
+// takes its first chunk on the first Alloc(), so the thread using it touches the chunk first
 template <class T> class LocalAllocator {
 private:
 	AtomicAllocator<T> &m_allocator_ref;
-	uint32_t m_chunk, m_counter{};
+	uint32_t m_chunk{}, m_counter{0x10000u};
 
 public:
 	inline LocalAllocator(const LocalAllocator &r) = delete;
@@ -52,8 +53,7 @@ public:
 	inline LocalAllocator(LocalAllocator &&r) noexcept = default;
 	inline LocalAllocator &operator=(LocalAllocator &&r) noexcept = default;
 
-	inline explicit LocalAllocator(AtomicAllocator<T> &allocator)
-	    : m_allocator_ref{allocator}, m_chunk{allocator.AllocChunk()} {}
+	inline explicit LocalAllocator(AtomicAllocator<T> &allocator) : m_allocator_ref{allocator} {}
 	inline uint32_t Alloc() {
 		if (m_counter <= 0xffffu)
 			return m_chunk | (m_counter++);
@@ -62,6 +62,16 @@ public:
 			return (m_chunk = m_allocator_ref.AllocChunk());
 		}
 	}
+	// count (at most a chunk) consecutive elements, returns the first
+	inline uint32_t Alloc(uint32_t count) {
+		if (m_counter + count > 0x10000u) {
+			m_chunk = m_allocator_ref.AllocChunk();
+			m_counter = 0;
+		}
+		uint32_t ret = m_chunk | m_counter;
+		m_counter += count;
+		return ret;
+	}
 };
 
 template <class T> class AtomicBlockAllocator {
@@ -88,6 +98,7 @@ public:
 		m_chunks[id] = new T[count];
 		return m_chunks[id];
 	}
+	inline uint32_t GetChunkCount() const { return std::min(m_head.load(), 1u << 16u); }
 };
 
 template <class T> class LocalBlockAllocator {
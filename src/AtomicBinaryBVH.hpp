@@ -8,19 +8,25 @@ class AtomicBinaryBVH : public BinaryBVHBase<AtomicBinaryBVH> {
 public:
 	struct Node {
 		AABB aabb;
-		uint32_t left{};
+		uint32_t left{}; // 0 for leaves
 		union {
 			uint32_t right{};
-			uint32_t tri_idx;
+			struct {
+				uint32_t tri_begin : 30; // first of the tri_count entries of the triangle index pool
+				uint32_t tri_count : 2;
+			};
 		};
 	};
 	static_assert(sizeof(Node) == 32);
+	static_assert(BVHConfig::kMaxLeafTriangles < 4);
 
 	using Iterator = uint32_t;
 
 private:
 	AtomicAllocator<Node> m_node_pool;
+	AtomicAllocator<uint32_t> m_tri_index_pool; // leaf triangles, 2^14 chunks at most to fit Node::tri_begin
 	uint32_t m_leaf_cnt{};
+	BuildStats m_build_stats;
 
 public:
 	inline bool empty() const { return m_leaf_cnt == 0; }
@@ -28,13 +34,27 @@ public:
 	inline uint32_t get_index(uint32_t x) const { return x; }
 	inline uint32_t get_left(uint32_t x) const { return m_node_pool[x].left; }
 	inline uint32_t get_right(uint32_t x) const { return m_node_pool[x].right; }
-	inline uint32_t get_triangle_idx(uint32_t x) const { return m_node_pool[x].tri_idx; }
+	inline uint32_t get_triangle_count(uint32_t x) const { return m_node_pool[x].tri_count; }
+	inline uint32_t get_triangle_idx(uint32_t x, uint32_t i) const {
+		return m_tri_index_pool[m_node_pool[x].tri_begin + i];
+	}
 	inline const AABB &get_aabb(uint32_t x) const { return m_node_pool[x].aabb; }
 
 	inline uint32_t get_root() const { return 0; }
 
+	// the triangle indices go to entries from the building thread's allocator
+	inline void set_leaf(uint32_t x, LocalAllocator<uint32_t> *p_tri_index_allocator, const uint32_t *tris,
+	                     uint32_t tri_count) {
+		auto &node = m_node_pool[x];
+		node.tri_begin = p_tri_index_allocator->Alloc(tri_count);
+		node.tri_count = tri_count;
+		for (uint32_t i = 0; i < tri_count; ++i)
+			m_tri_index_pool[node.tri_begin + i] = tris[i];
+	}
+
 	inline uint32_t get_node_range() const { return m_node_pool.GetRange(); }
 	inline uint32_t get_leaf_count() const { return m_leaf_cnt; }
+	inline const BuildStats &get_build_stats() const { return m_build_stats; }
 
 public:
 	inline AtomicBinaryBVH(const BVHConfig &config, const std::shared_ptr<Scene> &scene)
@@ -43,6 +63,7 @@ public:
 
 	friend class ParallelSBVHBuilder;
 	friend class PSSBVHBuilder;
+	friend class BVHOptimizer;
 };
 
 #endif
@@ -0,0 +1,5 @@
+#include "BVHBuilder.hpp"
+
+std::shared_ptr<WideBVH> BuildWideBVH(const BVHConfig &config, const std::shared_ptr<Scene> &scene) {
+	return BuildBinaryBVH(config, scene, [](const auto &binary_bvh) { return WideBVH::Build(binary_bvh); });
+}
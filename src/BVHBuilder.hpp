@@ -0,0 +1,34 @@
+#ifndef ADYPT_BVHBUILDER_HPP
+#define ADYPT_BVHBUILDER_HPP
+
+#include "BVHOptimizer.hpp"
+#include "PSSBVHBuilder.hpp"
+#include "ParallelSBVHBuilder.hpp"
+#include "SBVHBuilder.hpp"
+#include "WideBVH.hpp"
+
+// runs BVHOptimizer on the tree if config.m_optimize_ms is set, the flat tree of SBVHBuilder is never optimized
+inline std::shared_ptr<BinaryBVHBase<AtomicBinaryBVH>>
+OptimizeBinaryBVH(std::shared_ptr<BinaryBVHBase<AtomicBinaryBVH>> &&bvh) {
+	if (bvh->GetConfig().m_optimize_ms)
+		BVHOptimizer{static_cast<AtomicBinaryBVH *>(bvh.get())}.Run();
+	return std::move(bvh);
+}
+
+// Builds the binary BVH with config.m_builder and passes it to func as a std::shared_ptr<BinaryBVHBase<T>> of the
+// builder's BVH type, func must return the same type for every T.
+template <class F> inline auto BuildBinaryBVH(const BVHConfig &config, const std::shared_ptr<Scene> &scene, F &&func) {
+	switch (config.m_builder) {
+	case BVHConfig::kSBVH:
+		return func(FlatBinaryBVH::Build<SBVHBuilder>(config, scene));
+	case BVHConfig::kPSSBVH:
+		return func(OptimizeBinaryBVH(AtomicBinaryBVH::Build<PSSBVHBuilder>(config, scene)));
+	default:
+		return func(OptimizeBinaryBVH(AtomicBinaryBVH::Build<ParallelSBVHBuilder>(config, scene)));
+	}
+}
+
+// the binary BVH of config.m_builder, collapsed to a WideBVH
+std::shared_ptr<WideBVH> BuildWideBVH(const BVHConfig &config, const std::shared_ptr<Scene> &scene);
+
+#endif
@@ -1,12 +1,22 @@
 #include "BVHConfig.hpp"
 
 #include "Math.hpp"
+#include <cstring>
 
-std::array<uint8_t, 12> BVHConfig::ToBytes() const {
-	std::array<uint8_t, 12> ret = {};
+std::array<uint8_t, 48> BVHConfig::ToBytes() const {
+	std::array<uint8_t, 48> ret = {};
 	Uint32ToByte4(m_max_spatial_depth, ret.data());
 	FloatToByte4(m_triangle_sah, ret.data() + 4);
 	FloatToByte4(m_node_sah, ret.data() + 8);
+	Uint32ToByte4(m_builder, ret.data() + 12);
+	FloatToByte4(m_duplication_budget, ret.data() + 16);
+	FloatToByte4(m_presplit_threshold, ret.data() + 20);
+	Uint32ToByte4(m_optimize_ms, ret.data() + 24);
+	FloatToByte4(m_optimize_target, ret.data() + 28);
+	Uint32ToByte4(m_optimizer, ret.data() + 32);
+	Uint32ToByte4(m_min_bins, ret.data() + 36);
+	Uint32ToByte4(m_max_bins, ret.data() + 40);
+	Uint32ToByte4(m_thread_count, ret.data() + 44); // kept last, the cache ignores it
 	return ret;
 }
 
@@ -14,4 +24,41 @@ void BVHConfig::FromBytes(uint8_t *ptr) {
 	m_max_spatial_depth = Byte4ToUint32(ptr);
 	m_triangle_sah = Byte4ToFloat(ptr + 4);
 	m_node_sah = Byte4ToFloat(ptr + 8);
+	m_builder = (Builder)std::min(Byte4ToUint32(ptr + 12), (uint32_t)kBuilderCount - 1u);
+	m_duplication_budget = Byte4ToFloat(ptr + 16);
+	m_presplit_threshold = Byte4ToFloat(ptr + 20);
+	m_optimize_ms = Byte4ToUint32(ptr + 24);
+	m_optimize_target = Byte4ToFloat(ptr + 28);
+	m_optimizer = (Optimizer)std::min(Byte4ToUint32(ptr + 32), (uint32_t)kOptimizerCount - 1u);
+	m_min_bins = Byte4ToUint32(ptr + 36);
+	m_max_bins = Byte4ToUint32(ptr + 40);
+	m_thread_count = Byte4ToUint32(ptr + 44);
+}
+
+const char *BVHConfig::GetBuilderName(Builder builder) {
+	constexpr const char *kNames[kBuilderCount] = {"sbvh", "parallel", "pss", "shape"};
+	return kNames[builder];
+}
+
+bool BVHConfig::ParseBuilder(const char *name, Builder *p_builder) {
+	for (uint32_t b = 0; b < kBuilderCount; ++b)
+		if (strcmp(name, GetBuilderName((Builder)b)) == 0) {
+			*p_builder = (Builder)b;
+			return true;
+		}
+	return false;
+}
+
+const char *BVHConfig::GetOptimizerName(Optimizer optimizer) {
+	constexpr const char *kNames[kOptimizerCount] = {"rotation", "treelet"};
+	return kNames[optimizer];
+}
+
+bool BVHConfig::ParseOptimizer(const char *name, Optimizer *p_optimizer) {
+	for (uint32_t o = 0; o < kOptimizerCount; ++o)
+		if (strcmp(name, GetOptimizerName((Optimizer)o)) == 0) {
+			*p_optimizer = (Optimizer)o;
+			return true;
+		}
+	return false;
 }
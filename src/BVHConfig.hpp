@@ -1,17 +1,112 @@
 #ifndef BVHCONFIG_HPP
 #define BVHCONFIG_HPP
 
+#include "BuildTuning.hpp"
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cinttypes>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 struct BVHConfig {
+	// kShapeSBVH is kParallelSBVH building every OBJ shape on its own under a SAH tree over the shapes
+	enum Builder : uint32_t { kSBVH = 0, kParallelSBVH, kPSSBVH, kShapeSBVH, kBuilderCount };
+	enum Optimizer : uint32_t { kRotationOptimizer = 0, kTreeletOptimizer, kOptimizerCount };
+
+	Builder m_builder = kParallelSBVH;
 	uint32_t m_max_spatial_depth = 48;
 	float m_triangle_sah = 0.3f, m_node_sah = 1.0f;
+	float m_duplication_budget = 0.0f; // max references per triangle after spatial splits, 0 for no limit
+	float m_presplit_threshold = 0.0f; // clip triangles with AABB half area above this times their area, 0 disables
+	uint32_t m_optimize_ms = 0;        // time budget of BVHOptimizer after the parallel builders, 0 skips it
+	float m_optimize_target = 0.1f;    // BVHOptimizer stops once the SAH is this fraction lower
+	Optimizer m_optimizer = kRotationOptimizer;
+	uint32_t m_min_bins = 8, m_max_bins = 256; // bin range of the parallel builders' split searches, see GetBinCount()
+	uint32_t m_thread_count = 0;       // builder thread budget, 0 uses every hardware thread (output is the same)
+	bool m_numa = false;               // pin builder threads and their memory to NUMA nodes (same output, not cached)
+	BuildTuning m_tuning;              // task granularity of the parallel builders (same output, not cached)
+	// time budget of the parallel builders, 0 for none. Past it, or once *m_p_cancel is set, the nodes left get cheap
+	// median splits, so the tree is valid but only partly of full quality (see BuildStats::GetFullQualityFraction())
+	uint32_t m_build_ms = 0;
+	const std::atomic_bool *m_p_cancel = nullptr; // read during the build only, not cached
+	// whether m_builder honors m_build_ms and m_p_cancel, the sequential SBVH builder ignores them
+	inline bool HasBuildBudget() const { return m_builder != kSBVH; }
 	inline float GetTriangleCost() const { return m_triangle_sah; }
 	inline float GetNodeCost() const { return m_node_sah; }
 	inline float GetTriangleCost(uint32_t count) const { return m_triangle_sah * count; }
-	std::array<uint8_t, 12> ToBytes() const;
+	// triangles of one binary leaf at most, which is what a WideBVH leaf holds
+	static constexpr uint32_t kMaxLeafTriangles = 3;
+	// whether count references under a node of half area area cost less as a leaf than split with split_sah, the
+	// builders' sum of reference count times child half area. About seven binary nodes collapse into one WideBVH node,
+	// so a split is charged a seventh of the node cost, the full cost would stop nearly every node of 3 references.
+	inline bool IsLeafCheaper(uint32_t count, float area, float split_sah) const {
+		return count <= kMaxLeafTriangles &&
+		       GetTriangleCost(count) * area <= GetNodeCost() / 7.0f * area + GetTriangleCost() * split_sah;
+	}
+	// bins per axis of the object and spatial split searches of a node with ref_count references, the power of two
+	// nearest below the square root of the count within [m_min_bins, m_max_bins] (rounded down to powers of two): a
+	// few hundred at the top, where a better split pays off over many references, and few deep in the tree, where
+	// binning is most of the work. Equal bounds fix the count.
+	static constexpr uint32_t kMinBins = 8, kMaxBins = 256;
+	inline uint32_t GetBinCount(uint32_t ref_count) const {
+		auto floor_pow2 = [](uint32_t x) {
+			uint32_t p = 1;
+			while (p <= x / 2)
+				p *= 2;
+			return p;
+		};
+		uint32_t lo = floor_pow2(std::clamp(m_min_bins, kMinBins, kMaxBins)),
+		         hi = floor_pow2(std::clamp(m_max_bins, lo, kMaxBins)), bins = lo;
+		while (bins < hi && 4ull * bins * bins <= ref_count)
+			bins *= 2;
+		return bins;
+	}
+	// calls func with bin_count from GetBinCount() as a std::integral_constant. The binning loops need it at compile
+	// time: under -Ofast the sequential and the parallel binning only round alike with a constant count, and the tree
+	// must not depend on the thread count.
+	template <typename Func, uint32_t BIN_COUNT = kMinBins>
+	inline static void VisitBinCount(uint32_t bin_count, Func &&func) {
+		if constexpr (BIN_COUNT < kMaxBins)
+			if (bin_count > BIN_COUNT)
+				return VisitBinCount<Func, BIN_COUNT * 2>(bin_count, std::forward<Func>(func));
+		func(std::integral_constant<uint32_t, BIN_COUNT>{});
+	}
+	inline uint32_t GetThreadCount() const {
+		return m_thread_count ? m_thread_count : std::max(1u, std::thread::hardware_concurrency());
+	}
+	// references spatial splits may add to the whole tree starting from reference_count (more than triangle_count
+	// after pre-splitting), kUnlimitedDuplicates without a budget
+	static constexpr uint32_t kUnlimitedDuplicates = UINT32_MAX;
+	inline uint32_t GetDuplicateBudget(uint32_t triangle_count, uint32_t reference_count) const {
+		if (m_duplication_budget <= 0.0f)
+			return kUnlimitedDuplicates;
+		return (uint32_t)std::max(0.0, double(m_duplication_budget) * triangle_count - reference_count);
+	}
+	// hands what is left of a node's budget after its split added duplicate_count references to the children, in
+	// proportion to their reference counts. This bounds the total without a shared counter, so the tree does not
+	// depend on the order the nodes are built in.
+	inline static std::tuple<uint32_t, uint32_t> ShareDuplicateBudget(uint32_t budget, uint32_t duplicate_count,
+	                                                                  uint32_t left_ref_count,
+	                                                                  uint32_t right_ref_count) {
+		if (budget == kUnlimitedDuplicates)
+			return {kUnlimitedDuplicates, kUnlimitedDuplicates};
+		budget -= std::min(budget, duplicate_count);
+		auto left_budget = uint32_t(uint64_t(budget) * left_ref_count / (left_ref_count + right_ref_count));
+		return {left_budget, budget - left_budget};
+	}
+
+	std::array<uint8_t, 48> ToBytes() const;
 	void FromBytes(uint8_t *ptr);
+
+	static const char *GetBuilderName(Builder builder);
+	// returns false for an unknown name
+	static bool ParseBuilder(const char *name, Builder *p_builder);
+	static const char *GetOptimizerName(Optimizer optimizer);
+	// returns false for an unknown name
+	static bool ParseOptimizer(const char *name, Optimizer *p_optimizer);
 };
 
 #endif
@@ -0,0 +1,240 @@
+#include "BVHMetrics.hpp"
+
+#include <algorithm>
+#include <future>
+#include <spdlog/spdlog.h>
+#include <thread>
+
+namespace bvh_metrics_detail {
+
+template <class Node> static AABB get_child_aabb(const Node &node, uint32_t slot) {
+	glm::vec3 p{node.m_px, node.m_py, node.m_pz};
+	glm::vec3 cell{glm::uintBitsToFloat((uint32_t)node.m_ex << 23u), glm::uintBitsToFloat((uint32_t)node.m_ey << 23u),
+	               glm::uintBitsToFloat((uint32_t)node.m_ez << 23u)};
+	return {p + glm::vec3{node.m_qlox[slot], node.m_qloy[slot], node.m_qloz[slot]} * cell,
+	        p + glm::vec3{node.m_qhix[slot], node.m_qhiy[slot], node.m_qhiz[slot]} * cell};
+}
+
+template <uint32_t WIDTH>
+uint32_t Tree::AppendWide(const BasicWideBVH<WIDTH> &bvh, uint32_t wide_node_idx, const AABB &aabb) {
+	const auto &wnode = bvh.GetNodes()[wide_node_idx];
+	const Scene &scene = *bvh.GetScenePtr();
+
+	auto idx = (uint32_t)m_nodes.size();
+	m_nodes.emplace_back();
+	m_nodes[idx].aabb = aabb;
+	m_nodes[idx].tri_begin = m_tris.size();
+	++m_node_cost_count;
+
+	uint32_t children[WIDTH], child_count = 0;
+	for (uint32_t slot = 0; slot < WIDTH; ++slot) {
+		uint32_t meta = wnode.m_meta[slot];
+		if (!meta)
+			continue;
+		AABB child_aabb = get_child_aabb(wnode, slot), tight_aabb;
+		if ((meta & (meta << 1u)) & 0x10u) {
+			uint32_t child_wide_idx = wnode.m_child_idx_base + (meta & 0x1fu) - 24u;
+			children[child_count++] = AppendWide(bvh, child_wide_idx, child_aabb);
+			const auto &cnode = bvh.GetNodes()[child_wide_idx];
+			for (uint32_t s = 0; s < WIDTH; ++s)
+				if (cnode.m_meta[s])
+					tight_aabb.Expand(get_child_aabb(cnode, s));
+		} else {
+			children[child_count++] = m_nodes.size();
+			m_nodes.emplace_back();
+			Node &leaf = m_nodes.back();
+			leaf.aabb = child_aabb;
+			leaf.tri_begin = m_tris.size();
+			leaf.tri_count = glm::bitCount(meta >> 5u);
+			for (uint32_t i = 0; i < leaf.tri_count; ++i) {
+				uint32_t tri_idx = bvh.GetTriIndices()[wnode.m_tri_idx_base + (meta & 0x1fu) + i];
+				m_tris.push_back(tri_idx);
+				tight_aabb.Expand(scene.GetTriangles()[tri_idx].GetAABB());
+			}
+		}
+		tight_aabb.IntersectAABB(child_aabb);
+		m_quantized_area += child_aabb.GetHalfArea();
+		m_tight_area += tight_aabb.Valid() ? tight_aabb.GetHalfArea() : 0.0f;
+	}
+
+	m_nodes[idx].child_begin = m_children.size();
+	m_nodes[idx].child_count = child_count;
+	m_children.insert(m_children.end(), children, children + child_count);
+	m_nodes[idx].tri_count = m_tris.size() - m_nodes[idx].tri_begin;
+	return idx;
+}
+
+// area of the part of the triangle inside the box (Sutherland-Hodgman against the 6 slabs)
+static float clipped_triangle_area(const Triangle &tri, const AABB &aabb) {
+	glm::vec3 poly[2][9];
+	uint32_t count = 3, cur = 0;
+	std::copy(tri.positions, tri.positions + 3, poly[0]);
+	for (uint32_t plane = 0; plane < 6 && count; ++plane) {
+		uint32_t dim = plane >> 1u;
+		bool is_max = plane & 1u;
+		float bound = is_max ? aabb.max[dim] : aabb.min[dim];
+		auto inside = [&](const glm::vec3 &v) { return is_max ? v[dim] <= bound : v[dim] >= bound; };
+
+		uint32_t out_count = 0;
+		const glm::vec3 *in = poly[cur];
+		glm::vec3 *out = poly[cur ^ 1u];
+		for (uint32_t i = 0; i < count; ++i) {
+			const glm::vec3 &a = in[i], &b = in[(i + 1) % count];
+			bool a_in = inside(a), b_in = inside(b);
+			if (a_in)
+				out[out_count++] = a;
+			if (a_in != b_in)
+				out[out_count++] = glm::mix(a, b, (bound - a[dim]) / (b[dim] - a[dim]));
+		}
+		count = out_count;
+		cur ^= 1u;
+	}
+	glm::vec3 cross{0.0f};
+	for (uint32_t i = 1; i + 1 < count; ++i)
+		cross += glm::cross(poly[cur][i] - poly[cur][0], poly[cur][i + 1] - poly[cur][0]);
+	return glm::length(cross) * 0.5f;
+}
+
+static bool aabb_overlap(const AABB &l, const AABB &r) {
+	return l.min.x <= r.max.x && l.min.y <= r.max.y && l.min.z <= r.max.z && r.min.x <= l.max.x &&
+	       r.min.y <= l.max.y && r.min.z <= l.max.z;
+}
+
+} // namespace bvh_metrics_detail
+
+template <uint32_t WIDTH>
+BVHMetrics BVHMetrics::Compute(const BasicWideBVH<WIDTH> &bvh, const BVHConfig &cost_config, uint32_t epo_samples) {
+	bvh_metrics_detail::Tree tree;
+	if (!bvh.GetNodes().empty()) {
+		AABB root_aabb;
+		const auto &root = bvh.GetNodes()[0];
+		for (uint32_t s = 0; s < WIDTH; ++s)
+			if (root.m_meta[s])
+				root_aabb.Expand(bvh_metrics_detail::get_child_aabb(root, s));
+		tree.AppendWide(bvh, 0, root_aabb);
+	}
+	BVHMetrics ret = compute(tree, "wide", *bvh.GetScenePtr(), cost_config, epo_samples);
+	ret.m_quantization_slack = tree.m_tight_area > 0.0f ? tree.m_quantized_area / tree.m_tight_area - 1.0 : 0.0;
+	return ret;
+}
+
+template BVHMetrics BVHMetrics::Compute(const BasicWideBVH<4> &, const BVHConfig &, uint32_t);
+template BVHMetrics BVHMetrics::Compute(const BasicWideBVH<8> &, const BVHConfig &, uint32_t);
+
+BVHMetrics BVHMetrics::compute(const bvh_metrics_detail::Tree &tree, const char *type, const Scene &scene,
+                               const BVHConfig &cost_config, uint32_t epo_samples) {
+	using bvh_metrics_detail::Node;
+
+	BVHMetrics ret;
+	ret.m_type = type;
+	ret.m_triangle_count = scene.GetTriangles().size();
+	ret.m_reference_count = tree.m_tris.size();
+	ret.m_duplication_ratio = ret.m_triangle_count ? double(ret.m_reference_count) / ret.m_triangle_count : 0.0;
+	if (tree.m_nodes.empty())
+		return ret;
+
+	const std::vector<Node> &nodes = tree.m_nodes;
+	auto get_cost = [&cost_config](const Node &node) {
+		return node.child_count ? cost_config.GetNodeCost() : cost_config.GetTriangleCost(node.tri_count);
+	};
+
+	// SAH, leaf and depth statistics
+	double root_area = nodes[0].aabb.GetHalfArea(), sah = 0.0, depth_sum = 0.0;
+	ret.m_min_leaf_depth = UINT32_MAX;
+	std::vector<std::pair<uint32_t, uint32_t>> stack{{0, 0}};
+	while (!stack.empty()) {
+		auto [idx, depth] = stack.back();
+		stack.pop_back();
+		const Node &node = nodes[idx];
+		sah += get_cost(node) * node.aabb.GetHalfArea();
+		if (node.child_count) {
+			++ret.m_internal_count;
+			for (uint32_t c = 0; c < node.child_count; ++c)
+				stack.emplace_back(tree.m_children[node.child_begin + c], depth + 1);
+			continue;
+		}
+		++ret.m_leaf_count;
+		ret.m_min_leaf_depth = std::min(ret.m_min_leaf_depth, depth);
+		ret.m_max_leaf_depth = std::max(ret.m_max_leaf_depth, depth);
+		depth_sum += depth;
+		if (ret.m_leaf_size_histogram.size() <= node.tri_count)
+			ret.m_leaf_size_histogram.resize(node.tri_count + 1);
+		++ret.m_leaf_size_histogram[node.tri_count];
+		if (ret.m_leaf_depth_histogram.size() <= depth)
+			ret.m_leaf_depth_histogram.resize(depth + 1);
+		++ret.m_leaf_depth_histogram[depth];
+	}
+	ret.m_sah = root_area > 0.0 ? sah / root_area : 0.0;
+	ret.m_mean_leaf_depth = depth_sum / ret.m_leaf_count;
+
+	if (!epo_samples || !ret.m_triangle_count)
+		return ret;
+
+	// EPO: for every node, the surface of triangles inside its box but not referenced by its subtree
+	// positions of each triangle's references in m_tris, as CSR
+	std::vector<uint32_t> ref_offsets(ret.m_triangle_count + 1, 0), ref_positions(tree.m_tris.size());
+	for (uint32_t t : tree.m_tris)
+		++ref_offsets[t + 1];
+	for (uint32_t i = 0; i < ret.m_triangle_count; ++i)
+		ref_offsets[i + 1] += ref_offsets[i];
+	{
+		std::vector<uint32_t> fill(ref_offsets.begin(), ref_offsets.end() - 1);
+		for (uint32_t p = 0; p < tree.m_tris.size(); ++p)
+			ref_positions[fill[tree.m_tris[p]]++] = p;
+	}
+
+	uint32_t stride = std::max(1u, ret.m_triangle_count / std::min(epo_samples, ret.m_triangle_count));
+	ret.m_epo_samples = (ret.m_triangle_count + stride - 1) / stride;
+
+	uint32_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::future<std::pair<double, double>>> futures;
+	for (uint32_t th = 0; th < thread_count; ++th)
+		futures.push_back(std::async(std::launch::async, [&, th]() -> std::pair<double, double> {
+			double epo = 0.0, area = 0.0;
+			std::vector<uint32_t> node_stack;
+			for (uint32_t t = th * stride; t < ret.m_triangle_count; t += stride * thread_count) {
+				const Triangle &tri = scene.GetTriangles()[t];
+				const AABB tri_aabb = tri.GetAABB();
+				area += glm::length(glm::cross(tri.positions[1] - tri.positions[0],
+				                               tri.positions[2] - tri.positions[0])) *
+				        0.5f;
+				const uint32_t *refs_begin = ref_positions.data() + ref_offsets[t],
+				               *refs_end = ref_positions.data() + ref_offsets[t + 1];
+
+				node_stack.push_back(0);
+				while (!node_stack.empty()) {
+					const Node &node = nodes[node_stack.back()];
+					node_stack.pop_back();
+					if (!bvh_metrics_detail::aabb_overlap(node.aabb, tri_aabb))
+						continue;
+					const uint32_t *it = std::lower_bound(refs_begin, refs_end, node.tri_begin);
+					if (it == refs_end || *it >= node.tri_begin + node.tri_count) {
+						float clipped = bvh_metrics_detail::clipped_triangle_area(tri, node.aabb);
+						if (clipped <= 0.0f)
+							continue;
+						epo += get_cost(node) * clipped;
+					}
+					for (uint32_t c = 0; c < node.child_count; ++c)
+						node_stack.push_back(tree.m_children[node.child_begin + c]);
+				}
+			}
+			return {epo, area};
+		}));
+	double epo = 0.0, area = 0.0;
+	for (auto &f : futures) {
+		auto [e, a] = f.get();
+		epo += e, area += a;
+	}
+	ret.m_epo = area > 0.0 ? epo / area : 0.0;
+	return ret;
+}
+
+std::string BVHMetrics::ToJSON() const {
+	return fmt::format(
+	    R"({{"type":"{}","sah":{},"epo":{},"epo_samples":{},"internal_nodes":{},"leaves":{},"triangles":{},)"
+	    R"("references":{},"duplication_ratio":{},"leaf_depth":{{"min":{},"max":{},"mean":{}}},)"
+	    R"("leaf_size_histogram":[{}],"leaf_depth_histogram":[{}],"quantization_slack":{}}})",
+	    m_type, m_sah, m_epo, m_epo_samples, m_internal_count, m_leaf_count, m_triangle_count, m_reference_count,
+	    m_duplication_ratio, m_min_leaf_depth, m_max_leaf_depth, m_mean_leaf_depth,
+	    fmt::join(m_leaf_size_histogram, ","), fmt::join(m_leaf_depth_histogram, ","), m_quantization_slack);
+}
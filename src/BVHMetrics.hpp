@@ -0,0 +1,93 @@
+#ifndef ADYPT_BVHMETRICS_HPP
+#define ADYPT_BVHMETRICS_HPP
+
+#include "BinaryBVHBase.hpp"
+#include "WideBVH.hpp"
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+namespace bvh_metrics_detail {
+// the common tree both binary and wide BVHs are flattened to, nodes are in pre-order so the triangle references of
+// every subtree form the range [tri_begin, tri_begin + tri_count) of m_tris
+struct Node {
+	AABB aabb;
+	uint32_t child_begin{}, child_count{}; // range in Tree::m_children, empty for leaves
+	uint32_t tri_begin{}, tri_count{};
+};
+struct Tree {
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_children;
+	std::vector<uint32_t> m_tris;
+	uint32_t m_node_cost_count{}; // nodes that are charged GetNodeCost()
+	float m_quantized_area{}, m_tight_area{};
+
+	template <class BVHType> uint32_t AppendBinary(typename BinaryBVHBase<BVHType>::Iterator node) {
+		auto idx = (uint32_t)m_nodes.size();
+		m_nodes.emplace_back();
+		m_nodes[idx].aabb = node.GetAABB();
+		m_nodes[idx].tri_begin = m_tris.size();
+		if (node.IsLeaf()) {
+			for (uint32_t i = 0; i < node.GetTriangleCount(); ++i)
+				m_tris.push_back(node.GetTriangleIdx(i));
+		} else {
+			++m_node_cost_count;
+			uint32_t left = AppendBinary<BVHType>(node.GetLeft()), right = AppendBinary<BVHType>(node.GetRight());
+			m_nodes[idx].child_begin = m_children.size();
+			m_nodes[idx].child_count = 2;
+			m_children.push_back(left);
+			m_children.push_back(right);
+		}
+		m_nodes[idx].tri_count = m_tris.size() - m_nodes[idx].tri_begin;
+		return idx;
+	}
+	template <uint32_t WIDTH>
+	uint32_t AppendWide(const BasicWideBVH<WIDTH> &bvh, uint32_t wide_node_idx, const AABB &aabb);
+};
+} // namespace bvh_metrics_detail
+
+// Quality metrics of a built tree. SAH and EPO are normalized by the root area (EPO by the total triangle area),
+// internal nodes are charged GetNodeCost() and leaves GetTriangleCost(count) of the given config.
+struct BVHMetrics {
+	std::string m_type;
+	double m_sah{}, m_epo{};
+	uint32_t m_epo_samples{};
+	uint32_t m_internal_count{}, m_leaf_count{}, m_triangle_count{};
+	uint64_t m_reference_count{};
+	double m_duplication_ratio{}; // leaf references per scene triangle
+	uint32_t m_min_leaf_depth{}, m_max_leaf_depth{};
+	double m_mean_leaf_depth{};
+	std::vector<uint64_t> m_leaf_size_histogram, m_leaf_depth_histogram;
+	double m_quantization_slack{}; // wide only, summed quantized child box area over tight area, minus 1
+
+	// EPO samples of the viewer and batch reports, a subset of the triangles keeps them fast on large scenes
+	static constexpr uint32_t kReportEPOSamples = 65536;
+
+	// epo_samples triangles (evenly strided) are clipped against the tree for EPO, 0 skips it
+	template <class BVHType>
+	static BVHMetrics Compute(const BinaryBVHBase<BVHType> &bvh, const BVHConfig &cost_config,
+	                          uint32_t epo_samples = UINT32_MAX) {
+		bvh_metrics_detail::Tree tree;
+		if (!bvh.Empty())
+			tree.AppendBinary<BVHType>(bvh.GetRoot());
+		return compute(tree, "binary", *bvh.GetScenePtr(), cost_config, epo_samples);
+	}
+	template <class BVHType> static BVHMetrics Compute(const BinaryBVHBase<BVHType> &bvh) {
+		return Compute(bvh, bvh.GetConfig());
+	}
+	// instantiated for widths 4 and 8 in BVHMetrics.cpp
+	template <uint32_t WIDTH>
+	static BVHMetrics Compute(const BasicWideBVH<WIDTH> &bvh, const BVHConfig &cost_config,
+	                          uint32_t epo_samples = UINT32_MAX);
+	template <uint32_t WIDTH> static BVHMetrics Compute(const BasicWideBVH<WIDTH> &bvh) {
+		return Compute(bvh, bvh.GetConfig());
+	}
+
+	std::string ToJSON() const;
+
+private:
+	static BVHMetrics compute(const bvh_metrics_detail::Tree &tree, const char *type, const Scene &scene,
+	                          const BVHConfig &cost_config, uint32_t epo_samples);
+};
+
+#endif
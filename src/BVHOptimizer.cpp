@@ -0,0 +1,390 @@
+#include "BVHOptimizer.hpp"
+
+#include "BuildTrace.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cfloat>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <tuple>
+
+void BVHOptimizer::collect_nodes() {
+	m_parents.assign(m_bvh.get_node_range(), 0);
+	m_settled.assign(m_bvh.get_node_range(), false);
+	m_ranks.assign(m_bvh.get_node_range(), 0);
+	m_leaf_counts.assign(m_bvh.get_node_range(), 1);
+	m_costs.assign(m_bvh.get_node_range(), 0.0f);
+	m_internal_nodes.clear();
+	m_leaves.clear();
+	m_leaf_area = 0.0;
+
+	const uint32_t root_idx = m_bvh.get_root();
+	m_parents[root_idx] = root_idx;
+	std::vector<uint32_t> stack{root_idx};
+	for (uint32_t rank = 0; !stack.empty(); ++rank) {
+		uint32_t node_idx = stack.back();
+		stack.pop_back();
+		m_ranks[node_idx] = rank;
+		if (is_leaf(node_idx)) {
+			uint32_t tri_count = m_bvh.get_triangle_count(node_idx);
+			m_leaf_area += tri_count * get_area(node_idx);
+			m_leaves.push_back(node_idx);
+			m_costs[node_idx] = m_config.GetTriangleCost(tri_count) * get_area(node_idx);
+			continue;
+		}
+		m_internal_nodes.push_back(node_idx);
+		const auto &node = access_node(node_idx);
+		m_parents[node.left] = m_parents[node.right] = node_idx;
+		stack.push_back(node.right);
+		stack.push_back(node.left);
+	}
+	// pre-order, so reversed every node comes after its children
+	for (auto it = m_internal_nodes.rbegin(); it != m_internal_nodes.rend(); ++it) {
+		const auto &node = access_node(*it);
+		m_leaf_counts[*it] = m_leaf_counts[node.left] + m_leaf_counts[node.right];
+	}
+}
+
+double BVHOptimizer::get_sah() const {
+	double internal_area = 0.0;
+	for (uint32_t node_idx : m_internal_nodes)
+		internal_area += get_area(node_idx);
+	float root_area = get_area(m_bvh.get_root());
+	return root_area > 0.0f
+	           ? (m_config.GetNodeCost() * internal_area + m_config.GetTriangleCost() * m_leaf_area) / root_area
+	           : 0.0;
+}
+
+void BVHOptimizer::rotate_node(uint32_t node_idx) {
+	auto &node = access_node(node_idx);
+	// swapping a child with a grandchild under the other child only changes the area of that other child
+	float best_gain = 0.0f;
+	uint32_t *p_best_child = nullptr, *p_best_grandchild = nullptr;
+	auto try_rotations = [this, &best_gain, &p_best_child, &p_best_grandchild](uint32_t *p_child, uint32_t other_idx) {
+		if (is_leaf(other_idx))
+			return;
+		auto &other = access_node(other_idx);
+		const AABB &child_aabb = m_bvh.get_aabb(*p_child);
+		float other_area = other.aabb.GetHalfArea();
+		float left_gain = other_area - AABB{child_aabb, m_bvh.get_aabb(other.right)}.GetHalfArea();
+		float right_gain = other_area - AABB{child_aabb, m_bvh.get_aabb(other.left)}.GetHalfArea();
+		if (left_gain > best_gain) {
+			best_gain = left_gain;
+			p_best_child = p_child;
+			p_best_grandchild = &other.left;
+		}
+		if (right_gain > best_gain) {
+			best_gain = right_gain;
+			p_best_child = p_child;
+			p_best_grandchild = &other.right;
+		}
+	};
+	const uint32_t left_idx = node.left, right_idx = node.right;
+	try_rotations(&node.left, right_idx);
+	try_rotations(&node.right, left_idx);
+
+	if (p_best_child) {
+		uint32_t other_idx = p_best_child == &node.left ? right_idx : left_idx;
+		std::swap(*p_best_child, *p_best_grandchild);
+		m_parents[*p_best_child] = node_idx;
+		m_parents[*p_best_grandchild] = other_idx;
+		refit_node(other_idx);
+	}
+	refit_node(node_idx);
+}
+
+void BVHOptimizer::rotate_subtree(uint32_t root_idx, uint32_t max_depth) {
+	// pre-order, so reversed every node comes after its children
+	std::vector<uint32_t> order;
+	std::vector<std::pair<uint32_t, uint32_t>> stack{{root_idx, 0}};
+	while (!stack.empty()) {
+		auto [node_idx, depth] = stack.back();
+		stack.pop_back();
+		if (is_leaf(node_idx) || (max_depth && depth == max_depth))
+			continue;
+		order.push_back(node_idx);
+		const auto &node = access_node(node_idx);
+		stack.emplace_back(node.right, depth + 1);
+		stack.emplace_back(node.left, depth + 1);
+	}
+	for (auto it = order.rbegin(); it != order.rend(); ++it)
+		rotate_node(*it);
+}
+
+void BVHOptimizer::rotate() {
+	BuildTrace::Scope trace{"rotate", (uint32_t)m_internal_nodes.size()};
+	// the subtrees are the same for any thread count, so is the result
+	std::vector<uint32_t> subtree_roots;
+	std::vector<std::pair<uint32_t, uint32_t>> stack{{m_bvh.get_root(), 0}};
+	while (!stack.empty()) {
+		auto [node_idx, depth] = stack.back();
+		stack.pop_back();
+		if (is_leaf(node_idx))
+			continue;
+		if (depth == kRotationSubtreeDepth) {
+			subtree_roots.push_back(node_idx);
+			continue;
+		}
+		const auto &node = access_node(node_idx);
+		stack.emplace_back(node.right, depth + 1);
+		stack.emplace_back(node.left, depth + 1);
+	}
+
+	std::atomic_uint32_t counter{0};
+	auto rotate_func = [this, &counter, &subtree_roots]() {
+		for (uint32_t i = counter++; i < subtree_roots.size(); i = counter++)
+			rotate_subtree(subtree_roots[i], 0);
+	};
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < std::min(kThreadCount, (uint32_t)subtree_roots.size()); ++i)
+		threads.emplace_back(rotate_func);
+	rotate_func();
+	for (auto &thread : threads)
+		thread.join();
+
+	rotate_subtree(m_bvh.get_root(), kRotationSubtreeDepth);
+}
+
+uint32_t BVHOptimizer::find_insertion(uint32_t node_idx, uint32_t sibling_idx) const {
+	const AABB &aabb = m_bvh.get_aabb(node_idx);
+	const float area = aabb.GetHalfArea();
+	const uint32_t root_idx = m_bvh.get_root();
+
+	// the cost of an insertion is the area of the new node plus the growth of the target's ancestors
+	uint32_t best_idx = sibling_idx;
+	float best_cost = AABB{aabb, m_bvh.get_aabb(sibling_idx)}.GetHalfArea();
+	for (uint32_t idx = sibling_idx; idx != root_idx;) {
+		idx = m_parents[idx];
+		const AABB &ancestor_aabb = m_bvh.get_aabb(idx);
+		best_cost += AABB{aabb, ancestor_aabb}.GetHalfArea() - ancestor_aabb.GetHalfArea();
+	}
+
+	// branch and bound over the induced cost, ties go to the lower rank so the search is deterministic
+	using Entry = std::tuple<float, uint32_t, uint32_t>; // induced cost, rank, node
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<>> queue;
+	queue.emplace(0.0f, m_ranks[root_idx], root_idx);
+	while (!queue.empty()) {
+		auto [induced_cost, rank, target_idx] = queue.top();
+		queue.pop();
+		if (induced_cost + area >= best_cost)
+			break;
+		const AABB &target_aabb = m_bvh.get_aabb(target_idx);
+		float direct_cost = AABB{aabb, target_aabb}.GetHalfArea();
+		// a sibling of the root would need a new root
+		if (target_idx != root_idx && induced_cost + direct_cost < best_cost) {
+			best_cost = induced_cost + direct_cost;
+			best_idx = target_idx;
+		}
+		float child_induced_cost = induced_cost + direct_cost - target_aabb.GetHalfArea();
+		if (!is_leaf(target_idx) && child_induced_cost + area < best_cost) {
+			const auto &target = m_bvh.m_node_pool[target_idx];
+			queue.emplace(child_induced_cost, m_ranks[target.left], target.left);
+			queue.emplace(child_induced_cost, m_ranks[target.right], target.right);
+		}
+	}
+	return best_idx;
+}
+
+bool BVHOptimizer::reinsert_node(uint32_t node_idx) {
+	uint32_t parent_idx = m_parents[node_idx], sibling_idx = get_sibling(node_idx);
+	uint32_t grandparent_idx = m_parents[parent_idx];
+
+	// detach the node with its parent, the sibling takes the parent's place
+	replace_child(grandparent_idx, parent_idx, sibling_idx);
+	refit_upward(grandparent_idx);
+
+	// the parent joins the node and its new sibling
+	uint32_t target_idx = find_insertion(node_idx, sibling_idx);
+	replace_child(m_parents[target_idx], target_idx, parent_idx);
+	auto &parent = access_node(parent_idx);
+	parent.left = target_idx;
+	parent.right = node_idx;
+	m_parents[target_idx] = m_parents[node_idx] = parent_idx;
+	refit_upward(parent_idx);
+	return target_idx != sibling_idx;
+}
+
+void BVHOptimizer::reinsert(std::chrono::steady_clock::time_point deadline) {
+	BuildTrace::Scope trace{"reinsert", (uint32_t)m_internal_nodes.size()};
+	const uint32_t root_idx = m_bvh.get_root();
+
+	// nodes much larger than their children first, the combined measure of Bittner et al.
+	std::vector<std::tuple<float, uint32_t, uint32_t>> candidates; // -measure, rank, node
+	candidates.reserve(m_internal_nodes.size());
+	for (uint32_t node_idx : m_internal_nodes) {
+		if (node_idx == root_idx || m_parents[node_idx] == root_idx || m_settled[node_idx])
+			continue;
+		const auto &node = access_node(node_idx);
+		float area = get_area(node_idx), left_area = get_area(node.left), right_area = get_area(node.right);
+		float mean_child_area = std::max(0.5f * (left_area + right_area), FLT_MIN);
+		float min_child_area = std::max(std::min(left_area, right_area), FLT_MIN);
+		float measure = area * area * area / (mean_child_area * min_child_area);
+		candidates.emplace_back(-measure, m_ranks[node_idx], node_idx);
+	}
+	auto count = std::min((uint32_t)candidates.size(),
+	                      std::max(1u, uint32_t((float)m_internal_nodes.size() * kReinsertionRatio)));
+	std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+
+	for (uint32_t i = 0; i < count; ++i) {
+		if ((i & 63u) == 0 && std::chrono::steady_clock::now() >= deadline)
+			return;
+		uint32_t node_idx = std::get<2>(candidates[i]);
+		// an earlier reinsertion may have moved it under the root
+		if (m_parents[node_idx] != root_idx)
+			m_settled[node_idx] = !reinsert_node(node_idx);
+	}
+}
+
+bool BVHOptimizer::restructure_treelet(uint32_t root_idx) {
+	// grow the treelet by turning its largest internal leaf into two, ties go to the earlier leaf
+	std::array<uint32_t, kTreeletLeafCount> leaves{};
+	std::array<uint32_t, kTreeletLeafCount - 1> internal_nodes{};
+	uint32_t leaf_count = 2, internal_count = 1;
+	internal_nodes[0] = root_idx;
+	leaves[0] = access_node(root_idx).left;
+	leaves[1] = access_node(root_idx).right;
+	while (leaf_count < kTreeletLeafCount) {
+		uint32_t expand = UINT32_MAX;
+		float expand_area = -1.0f;
+		for (uint32_t i = 0; i < leaf_count; ++i)
+			if (!is_leaf(leaves[i]) && get_area(leaves[i]) > expand_area) {
+				expand = i;
+				expand_area = get_area(leaves[i]);
+			}
+		if (expand == UINT32_MAX)
+			break;
+		const auto &node = access_node(leaves[expand]);
+		internal_nodes[internal_count++] = leaves[expand];
+		leaves[expand] = node.left;
+		leaves[leaf_count++] = node.right;
+	}
+
+	// optimal cost of every subset of the treelet leaves, a subset only splits into numerically smaller ones
+	constexpr uint32_t kSubsetCount = 1u << kTreeletLeafCount;
+	std::array<AABB, kSubsetCount> aabbs;
+	std::array<float, kSubsetCount> costs{};
+	std::array<uint32_t, kSubsetCount> leaf_counts{};
+	std::array<uint16_t, kSubsetCount> partitions{};
+	const uint32_t full_set = (1u << leaf_count) - 1u;
+	for (uint32_t i = 0; i < leaf_count; ++i) {
+		aabbs[1u << i] = m_bvh.get_aabb(leaves[i]);
+		costs[1u << i] = m_costs[leaves[i]];
+		leaf_counts[1u << i] = m_leaf_counts[leaves[i]];
+	}
+	for (uint32_t set = 1; set <= full_set; ++set) {
+		uint32_t low_bit = set & (~set + 1u);
+		if (set == low_bit)
+			continue;
+		aabbs[set] = AABB{aabbs[set ^ low_bit], aabbs[low_bit]};
+		leaf_counts[set] = leaf_counts[set ^ low_bit] + leaf_counts[low_bit];
+		// the subset holding the lowest leaf goes left, which visits every partition once
+		float best_cost = FLT_MAX;
+		for (uint32_t left = (set - 1u) & set; left; left = (left - 1u) & set) {
+			if (!(left & low_bit))
+				continue;
+			float cost = costs[left] + costs[set ^ left];
+			if (cost < best_cost) {
+				best_cost = cost;
+				partitions[set] = left;
+			}
+		}
+		costs[set] = m_config.GetNodeCost() * aabbs[set].GetHalfArea() + best_cost;
+	}
+	// below the float noise of summing the costs in another order
+	if (costs[full_set] >= m_costs[root_idx] * (1.0f - 1e-5f))
+		return false;
+
+	// rebuild top-down, reusing the internal nodes and keeping the root in place
+	std::array<std::pair<uint32_t, uint32_t>, kTreeletLeafCount - 1> stack; // subset, node
+	uint32_t stack_size = 0, next_internal = 1;
+	stack[stack_size++] = {full_set, root_idx};
+	while (stack_size) {
+		auto [set, node_idx] = stack[--stack_size];
+		auto &node = access_node(node_idx);
+		node.aabb = aabbs[set];
+		m_costs[node_idx] = costs[set];
+		m_leaf_counts[node_idx] = leaf_counts[set];
+		uint32_t *p_children[2] = {&node.left, &node.right};
+		const uint32_t child_sets[2] = {partitions[set], set ^ partitions[set]};
+		for (uint32_t c = 0; c < 2; ++c) {
+			uint32_t child_set = child_sets[c];
+			if ((child_set & (child_set - 1u)) == 0) {
+				uint32_t leaf = 0;
+				while (!(child_set & (1u << leaf)))
+					++leaf;
+				*p_children[c] = leaves[leaf];
+			} else {
+				*p_children[c] = internal_nodes[next_internal++];
+				stack[stack_size++] = {child_set, *p_children[c]};
+			}
+			m_parents[*p_children[c]] = node_idx;
+		}
+	}
+	return true;
+}
+
+void BVHOptimizer::restructure(std::chrono::steady_clock::time_point deadline) {
+	BuildTrace::Scope trace{"treelets", (uint32_t)m_internal_nodes.size()};
+	const uint32_t root_idx = m_bvh.get_root();
+
+	auto visit_counts = std::make_unique<std::atomic_uint32_t[]>(m_bvh.get_node_range());
+	std::atomic_uint32_t counter{0};
+	auto restructure_func = [this, root_idx, deadline, &visit_counts, &counter]() {
+		for (uint32_t i = counter++; i < m_leaves.size(); i = counter++) {
+			for (uint32_t node_idx = m_leaves[i]; node_idx != root_idx;) {
+				node_idx = m_parents[node_idx];
+				// the first thread to arrive leaves the node to the one coming from the other child
+				if (visit_counts[node_idx].fetch_add(1, std::memory_order_acq_rel) == 0)
+					break;
+				const auto &node = access_node(node_idx);
+				m_costs[node_idx] =
+				    m_config.GetNodeCost() * get_area(node_idx) + m_costs[node.left] + m_costs[node.right];
+				if (m_leaf_counts[node_idx] >= kTreeletLeafCount && std::chrono::steady_clock::now() < deadline)
+					restructure_treelet(node_idx);
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < std::min(kThreadCount, (uint32_t)m_leaves.size()); ++i)
+		threads.emplace_back(restructure_func);
+	restructure_func();
+	for (auto &thread : threads)
+		thread.join();
+}
+
+void BVHOptimizer::Run() {
+	if (m_bvh.empty() || is_leaf(m_bvh.get_root()))
+		return;
+	BuildTrace::Scope trace{"optimize", m_bvh.get_leaf_count()};
+	auto begin = std::chrono::steady_clock::now();
+	auto deadline = begin + std::chrono::milliseconds{m_config.m_optimize_ms};
+
+	collect_nodes();
+	const double initial_sah = get_sah();
+	double sah = initial_sah;
+	uint32_t sweep_count = 0;
+	for (;;) {
+		if (m_config.m_optimizer == BVHConfig::kTreeletOptimizer)
+			restructure(deadline);
+		else {
+			reinsert(deadline);
+			rotate();
+		}
+		++sweep_count;
+
+		double sweep_sah = get_sah();
+		bool stuck = sweep_sah >= sah;
+		sah = sweep_sah;
+		if (stuck || sah <= initial_sah * (1.0 - m_config.m_optimize_target) ||
+		    std::chrono::steady_clock::now() >= deadline)
+			break;
+	}
+	auto duration =
+	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+	spdlog::info("Optimized in {} sweeps, {} ms, SAH {} -> {} ({:.2f}% lower)", sweep_count, duration, initial_sah,
+	             sah, initial_sah > 0.0 ? (1.0 - sah / initial_sah) * 100.0 : 0.0);
+}
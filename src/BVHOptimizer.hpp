@@ -0,0 +1,96 @@
+#ifndef ADYPT_BVHOPTIMIZER_HPP
+#define ADYPT_BVHOPTIMIZER_HPP
+
+#include "AtomicBinaryBVH.hpp"
+#include <chrono>
+#include <cinttypes>
+#include <vector>
+
+// Post-build topology optimization of an AtomicBinaryBVH. With kRotationOptimizer each sweep removes the subtrees with
+// the worst area ratios and reinserts them where the SAH grows least (Bittner et al. 2013), then runs Kensler tree
+// rotations bottom-up on disjoint subtrees in parallel, which also refits every node. With kTreeletOptimizer each
+// sweep is a parallel bottom-up pass that gives every treelet of kTreeletLeafCount nodes its optimal topology (Karras
+// and Aila 2013). Sweeps repeat until the time budget is spent, the SAH dropped by the target fraction or a sweep
+// stops helping. Leaves are kept, only the internal nodes move. The result does not depend on the thread count, but a
+// time budget that runs out makes it depend on the machine.
+class BVHOptimizer {
+public:
+	using BVHType = AtomicBinaryBVH;
+
+private:
+	const uint32_t kThreadCount;
+	// subtrees rooted at this depth are rotated in parallel, the nodes above them afterwards
+	static constexpr uint32_t kRotationSubtreeDepth = 8;
+	// share of the internal nodes reinserted per sweep
+	static constexpr float kReinsertionRatio = 0.01f;
+	// treelet leaves, the search over their subsets is 3^n steps, so 7 to 9 is what pays off
+	static constexpr uint32_t kTreeletLeafCount = 7;
+	static_assert(kTreeletLeafCount >= 3 && kTreeletLeafCount <= 9);
+
+	AtomicBinaryBVH &m_bvh;
+	const BVHConfig &m_config;
+	std::vector<uint32_t> m_parents; // indexed by node, the root is its own parent
+	std::vector<uint32_t> m_internal_nodes; // the set is fixed, only the topology changes
+	std::vector<uint32_t> m_leaves;
+	std::vector<uint32_t> m_leaf_counts; // indexed by node, leaves in the subtree
+	std::vector<float> m_costs;          // indexed by node, SAH cost of the subtree times the root area
+	std::vector<bool> m_settled;            // nodes a reinsertion left in place are not tried again
+	// pre-order position in the built tree, unlike the node indices the same for every thread count, breaks ties
+	std::vector<uint32_t> m_ranks;
+	double m_leaf_area{}; // leaf areas times their triangle counts
+
+	inline AtomicBinaryBVH::Node &access_node(uint32_t node_idx) { return m_bvh.m_node_pool[node_idx]; }
+	inline bool is_leaf(uint32_t node_idx) const { return m_bvh.is_leaf(node_idx); }
+	inline float get_area(uint32_t node_idx) const { return m_bvh.get_aabb(node_idx).GetHalfArea(); }
+	inline uint32_t get_sibling(uint32_t node_idx) const {
+		const auto &parent = m_bvh.m_node_pool[m_parents[node_idx]];
+		return parent.left == node_idx ? parent.right : parent.left;
+	}
+	inline void replace_child(uint32_t parent_idx, uint32_t child_idx, uint32_t new_child_idx) {
+		auto &parent = access_node(parent_idx);
+		(parent.left == child_idx ? parent.left : parent.right) = new_child_idx;
+		m_parents[new_child_idx] = parent_idx;
+	}
+	inline void refit_node(uint32_t node_idx) {
+		auto &node = access_node(node_idx);
+		node.aabb = AABB{m_bvh.get_aabb(node.left), m_bvh.get_aabb(node.right)};
+	}
+	// refits node_idx and all of its ancestors
+	inline void refit_upward(uint32_t node_idx) {
+		for (;; node_idx = m_parents[node_idx]) {
+			refit_node(node_idx);
+			if (node_idx == m_bvh.get_root())
+				break;
+		}
+	}
+
+	void collect_nodes();
+	double get_sah() const;
+
+	void rotate_node(uint32_t node_idx);
+	// rotates and refits the nodes of root_idx's subtree down to max_depth levels (unbounded for 0), children first
+	void rotate_subtree(uint32_t root_idx, uint32_t max_depth);
+	void rotate();
+
+	// where the detached node_idx costs least as a sibling, sibling_idx (where it was) unless somewhere is cheaper
+	uint32_t find_insertion(uint32_t node_idx, uint32_t sibling_idx) const;
+	// returns false if the node stayed where it was
+	bool reinsert_node(uint32_t node_idx);
+	// stops early at the deadline
+	void reinsert(std::chrono::steady_clock::time_point deadline);
+
+	// returns false if the current topology of the treelet rooted at root_idx, whose m_costs must be up to date, was
+	// already optimal
+	bool restructure_treelet(uint32_t root_idx);
+	// restructures the treelet of every node with at least kTreeletLeafCount leaves, updating m_costs of all internal
+	// nodes. The second thread to reach a node carries on upward, so a node is done after its whole subtree and
+	// concurrent treelets never overlap. Past the deadline treelets are left as they are.
+	void restructure(std::chrono::steady_clock::time_point deadline);
+
+public:
+	explicit BVHOptimizer(AtomicBinaryBVH *p_bvh)
+	    : kThreadCount(p_bvh->GetConfig().GetThreadCount()), m_bvh{*p_bvh}, m_config(p_bvh->GetConfig()) {}
+	void Run();
+};
+
+#endif
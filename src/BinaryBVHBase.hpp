@@ -5,6 +5,7 @@
 #include <utility>
 
 #include "BVHConfig.hpp"
+#include "BuildStats.hpp"
 #include "Scene.hpp"
 
 template <class BVHType> class BinaryBVHBase {
@@ -29,7 +30,9 @@ public:
 		inline Iterator GetLeft() const { return Iterator{m_p_bvh, m_p_bvh->get_left(m_iterator)}; }
 		inline Iterator GetRight() const { return Iterator{m_p_bvh, m_p_bvh->get_right(m_iterator)}; }
 		inline bool IsLeaf() const { return m_p_bvh->is_leaf(m_iterator); }
-		inline uint32_t GetTriangleIdx() const { return m_p_bvh->get_triangle_idx(m_iterator); }
+		// leaves only, at most BVHConfig::kMaxLeafTriangles
+		inline uint32_t GetTriangleCount() const { return m_p_bvh->get_triangle_count(m_iterator); }
+		inline uint32_t GetTriangleIdx(uint32_t i) const { return m_p_bvh->get_triangle_idx(m_iterator, i); }
 		inline const AABB &GetAABB() const { return m_p_bvh->get_aabb(m_iterator); }
 	};
 
@@ -53,6 +56,7 @@ public:
 
 	uint32_t GetLeafCount() const { return ((BVHType *)this)->get_leaf_count(); }
 	uint32_t GetNodeRange() const { return ((BVHType *)this)->get_node_range(); }
+	const BuildStats &GetBuildStats() const { return ((BVHType *)this)->get_build_stats(); }
 };
 
 #endif
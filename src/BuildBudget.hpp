@@ -0,0 +1,38 @@
+#ifndef ADYPT_BUILDBUDGET_HPP
+#define ADYPT_BUILDBUDGET_HPP
+
+#include "BVHConfig.hpp"
+#include <atomic>
+#include <chrono>
+
+// The time budget and cancellation of a parallel build, see BVHConfig::m_build_ms. The builders ask before every node
+// and finish the tree with median splits once it is exceeded, which it stays for the rest of the build.
+class BuildBudget {
+private:
+	const std::atomic_bool *m_p_cancel;
+	const std::chrono::milliseconds m_budget;
+	std::chrono::steady_clock::time_point m_deadline;
+	std::atomic_bool m_exceeded{false};
+
+public:
+	inline explicit BuildBudget(const BVHConfig &config)
+	    : m_p_cancel{config.m_p_cancel}, m_budget{config.m_build_ms} {}
+
+	// the budget counts from here
+	inline void Start() {
+		m_deadline = std::chrono::steady_clock::now() + m_budget;
+		m_exceeded.store(false, std::memory_order_relaxed);
+	}
+	inline bool IsExceeded() {
+		if (m_exceeded.load(std::memory_order_relaxed))
+			return true;
+		if ((m_p_cancel && m_p_cancel->load(std::memory_order_relaxed)) ||
+		    (m_budget.count() && std::chrono::steady_clock::now() >= m_deadline)) {
+			m_exceeded.store(true, std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
+};
+
+#endif
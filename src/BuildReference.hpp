@@ -0,0 +1,129 @@
+#ifndef ADYPT_BUILDREFERENCE_HPP
+#define ADYPT_BUILDREFERENCE_HPP
+
+#include "Shape.hpp"
+#include <algorithm>
+#include <cinttypes>
+#include <tuple>
+#include <type_traits>
+
+// A triangle reference with float bounds, the one SBVHBuilder sorts and splits
+struct FloatBuildReference {
+	AABB aabb;
+	uint32_t tri_idx{};
+};
+
+class FloatReferenceCodec {
+public:
+	inline explicit FloatReferenceCodec(const AABB &) {}
+	inline static const AABB &GetAABB(const FloatBuildReference &ref) { return ref.aabb; }
+	// References of one triangle in a node come from pre-splitting and lie on different sides of a plane, so ties
+	// broken by triangle index and then by AABB minimum give a unique order. Parallel and serial sorts agree on it and
+	// the builders stay deterministic.
+	template <uint32_t DIM>
+	inline static bool IsCenterLess(const FloatBuildReference &l, const FloatBuildReference &r) {
+		float lc = l.aabb.GetDimCenter<DIM>(), rc = r.aabb.GetDimCenter<DIM>();
+		return lc < rc || (lc == rc && std::tie(l.tri_idx, l.aabb.min.x, l.aabb.min.y, l.aabb.min.z) <
+		                                   std::tie(r.tri_idx, r.aabb.min.x, r.aabb.min.y, r.aabb.min.z));
+	}
+	inline static void SetAABB(FloatBuildReference *p_ref, const AABB &aabb) { p_ref->aabb = aabb; }
+	inline static void SetAABB(FloatBuildReference *p_ref, const AABB &aabb, const FloatBuildReference &) {
+		p_ref->aabb = aabb;
+	}
+};
+
+// The triangle reference the parallel builders copy, split and move. With ADYPT_COMPACT_REFERENCES its bounds are 16
+// bit integers on a grid over the scene AABB, rounded outward so they stay conservative, which takes the record from
+// 28 to 16 bytes. The bounds are only read and written through ReferenceCodec.
+#ifdef ADYPT_COMPACT_REFERENCES
+struct BuildReference {
+	uint16_t lo[3]{}, hi[3]{};
+	uint32_t tri_idx{};
+};
+static_assert(sizeof(BuildReference) == 16);
+
+class ReferenceCodec {
+private:
+	static constexpr float kGridMax = float(UINT16_MAX);
+	glm::vec3 m_base, m_scale, m_cell;
+
+	inline float decode(uint16_t q, int dim) const { return m_base[dim] + float(q) * m_cell[dim]; }
+	inline glm::vec3 decode(const uint16_t *q) const { return m_base + glm::vec3{q[0], q[1], q[2]} * m_cell; }
+
+public:
+	inline explicit ReferenceCodec(const AABB &scene_aabb) : m_base{scene_aabb.min} {
+		glm::vec3 extent = scene_aabb.GetExtent();
+		for (int dim = 0; dim < 3; ++dim) {
+			m_scale[dim] = extent[dim] > 0.0f ? kGridMax / extent[dim] : 0.0f;
+			m_cell[dim] = extent[dim] / kGridMax;
+		}
+	}
+	inline AABB GetAABB(const BuildReference &ref) const { return {decode(ref.lo), decode(ref.hi)}; }
+	// the decoded centers are monotonic in lo + hi, so sorting needs no decoding, ties as in FloatReferenceCodec
+	template <uint32_t DIM> inline bool IsCenterLess(const BuildReference &l, const BuildReference &r) const {
+		uint32_t lc = l.lo[DIM] + l.hi[DIM], rc = r.lo[DIM] + r.hi[DIM];
+		return lc < rc || (lc == rc && std::tie(l.tri_idx, l.lo[0], l.lo[1], l.lo[2]) <
+		                                   std::tie(r.tri_idx, r.lo[0], r.lo[1], r.lo[2]));
+	}
+	// rounds outward, an empty AABB stays empty (lo > hi)
+	inline void SetAABB(BuildReference *p_ref, const AABB &aabb) const {
+		for (int dim = 0; dim < 3; ++dim) {
+			float lo = std::floor(std::clamp((aabb.min[dim] - m_base[dim]) * m_scale[dim], 0.0f, kGridMax));
+			float hi = std::ceil(std::clamp((aabb.max[dim] - m_base[dim]) * m_scale[dim], 0.0f, kGridMax));
+			auto qlo = (uint16_t)lo, qhi = (uint16_t)hi;
+			// the decoded bound may land on the wrong side of the float one by rounding
+			if (qlo && decode(qlo, dim) > aabb.min[dim])
+				--qlo;
+			if (qhi < UINT16_MAX && decode(qhi, dim) < aabb.max[dim])
+				++qhi;
+			p_ref->lo[dim] = qlo;
+			p_ref->hi[dim] = qhi;
+		}
+	}
+	// aabb of a part of parent, which it never grows out of
+	inline void SetAABB(BuildReference *p_ref, const AABB &aabb, const BuildReference &parent) const {
+		SetAABB(p_ref, aabb);
+		for (int dim = 0; dim < 3; ++dim) {
+			p_ref->lo[dim] = std::max(p_ref->lo[dim], parent.lo[dim]);
+			p_ref->hi[dim] = std::min(p_ref->hi[dim], parent.hi[dim]);
+		}
+	}
+};
+#else
+using BuildReference = FloatBuildReference;
+using ReferenceCodec = FloatReferenceCodec;
+#endif
+
+// Moves the index of the reference with the median center in dim to the middle of [first_ref, last_ref), with smaller
+// centers before it. The indices point into references.
+template <class ReferencePool, typename Iter>
+inline void SelectMedianReference(const ReferenceCodec &codec, const ReferencePool &references, Iter first_ref,
+                                  Iter last_ref, uint32_t dim) {
+	auto select = [&codec, &references, first_ref, last_ref](auto dim_constant) {
+		constexpr uint32_t kDim = decltype(dim_constant)::value;
+		auto less = [&codec, &references](uint32_t l, uint32_t r) {
+			return codec.IsCenterLess<kDim>(references[l], references[r]);
+		};
+		std::nth_element(first_ref, first_ref + (last_ref - first_ref) / 2, last_ref, less);
+	};
+	using X = std::integral_constant<uint32_t, 0>;
+	using Y = std::integral_constant<uint32_t, 1>;
+	using Z = std::integral_constant<uint32_t, 2>;
+	dim == 0 ? select(X{}) : (dim == 1 ? select(Y{}) : select(Z{}));
+}
+
+// Writes the triangles of ref_count references to p_tris and returns their count, pre-split pieces of one triangle
+// only once
+template <class ReferencePool>
+inline uint32_t GetLeafTriangles(const ReferencePool &references, const uint32_t *ref_indices, uint32_t ref_count,
+                                 uint32_t *p_tris) {
+	uint32_t tri_count = 0;
+	for (uint32_t i = 0; i < ref_count; ++i) {
+		uint32_t tri_idx = references[ref_indices[i]].tri_idx;
+		if (std::find(p_tris, p_tris + tri_count, tri_idx) == p_tris + tri_count)
+			p_tris[tri_count++] = tri_idx;
+	}
+	return tri_count;
+}
+
+#endif
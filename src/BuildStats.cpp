@@ -0,0 +1,116 @@
+#include "BuildStats.hpp"
+
+#include <spdlog/spdlog.h>
+
+void BuildStats::Merge(const BuildStats &r) {
+	m_triangle_count = std::max(m_triangle_count, r.m_triangle_count);
+	m_presplit_references = std::max(m_presplit_references, r.m_presplit_references);
+	m_reference_list_allocs += r.m_reference_list_allocs;
+	m_reference_list_reuses += r.m_reference_list_reuses;
+	m_reference_list_chunks += r.m_reference_list_chunks;
+	m_localized_references += r.m_localized_references;
+	if (m_levels.size() < r.m_levels.size())
+		m_levels.resize(r.m_levels.size());
+	for (uint32_t d = 0; d < r.m_levels.size(); ++d) {
+		Level &l = m_levels[d];
+		const Level &rl = r.m_levels[d];
+		for (uint32_t s = 0; s < kSplitCount; ++s)
+			l.splits[s] += rl.splits[s];
+		l.leaves += rl.leaves;
+		l.median_leaves += rl.median_leaves;
+		l.duplicates += rl.duplicates;
+		l.unsplits += rl.unsplits;
+	}
+}
+
+uint64_t BuildStats::GetSplitCount(Split split) const {
+	uint64_t ret = 0;
+	for (const Level &l : m_levels)
+		ret += l.splits[split];
+	return ret;
+}
+
+uint64_t BuildStats::GetLeafCount() const {
+	uint64_t ret = 0;
+	for (const Level &l : m_levels)
+		ret += l.leaves;
+	return ret;
+}
+
+uint64_t BuildStats::GetMedianLeafCount() const {
+	uint64_t ret = 0;
+	for (const Level &l : m_levels)
+		ret += l.median_leaves;
+	return ret;
+}
+
+double BuildStats::GetFullQualityFraction() const {
+	uint64_t node_count = GetLeafCount();
+	for (uint32_t s = 0; s < kSplitCount; ++s)
+		node_count += GetSplitCount(Split(s));
+	return node_count ? 1.0 - double(GetSplitCount(kMedianSplit) + GetMedianLeafCount()) / double(node_count) : 1.0;
+}
+
+uint64_t BuildStats::GetDuplicateCount() const {
+	uint64_t ret = 0;
+	for (const Level &l : m_levels)
+		ret += l.duplicates;
+	return ret;
+}
+
+uint64_t BuildStats::GetUnsplitCount() const {
+	uint64_t ret = 0;
+	for (const Level &l : m_levels)
+		ret += l.unsplits;
+	return ret;
+}
+
+uint32_t BuildStats::GetMaxDepth() const {
+	for (auto d = (uint32_t)m_levels.size(); d--;)
+		if (m_levels[d].leaves)
+			return d;
+	return 0;
+}
+
+const char *BuildStats::GetSplitName(Split split) {
+	constexpr const char *kNames[kSplitCount] = {"object", "spatial", "default", "median"};
+	return kNames[split];
+}
+
+void BuildStats::Log() const {
+	spdlog::info("Build: {} object, {} spatial, {} default splits, {} leaves, max depth {}",
+	             GetSplitCount(kObjectSplit), GetSplitCount(kSpatialSplit), GetSplitCount(kDefaultSplit),
+	             GetLeafCount(), GetMaxDepth());
+	spdlog::info("Build: {} pre-split and {} duplicated references (duplication factor {:.3f}), {} unsplit",
+	             m_presplit_references, GetDuplicateCount(), GetDuplicationFactor(), GetUnsplitCount());
+	if (GetSplitCount(kMedianSplit) || GetMedianLeafCount())
+		spdlog::info("Build: stopped early, then {} median splits and {} leaves, {:.1f}% of the nodes at full quality",
+		             GetSplitCount(kMedianSplit), GetMedianLeafCount(), GetFullQualityFraction() * 100.0);
+	if (m_reference_list_allocs)
+		spdlog::info("Build: {} reference lists ({} reused ranges) from {} arena chunks", m_reference_list_allocs,
+		             m_reference_list_reuses, m_reference_list_chunks);
+	if (m_localized_references)
+		spdlog::info("Build: {} references copied to the NUMA node of their subtree", m_localized_references);
+}
+
+std::string BuildStats::ToJSON() const {
+	std::string levels;
+	for (uint32_t d = 0; d < m_levels.size(); ++d) {
+		const Level &l = m_levels[d];
+		levels += fmt::format(R"({}{{"object":{},"spatial":{},"default":{},"median":{},)"
+		                      R"("leaves":{},"median_leaves":{},"duplicates":{},"unsplits":{}}})",
+		                      d ? "," : "", l.splits[kObjectSplit], l.splits[kSpatialSplit], l.splits[kDefaultSplit],
+		                      l.splits[kMedianSplit], l.leaves, l.median_leaves, l.duplicates, l.unsplits);
+	}
+	return fmt::format(R"({{"object_splits":{},"spatial_splits":{},"default_splits":{},"median_splits":{},)"
+	                   R"("leaves":{},"median_leaves":{},"full_quality_fraction":{},"max_depth":{},)"
+	                   R"("presplit_references":{},"duplicates":{},"duplication_factor":{},"unsplits":{},)"
+	                   R"("reference_list_allocs":{},"reference_list_reuses":{},"reference_list_chunks":{},)"
+	                   R"("localized_references":{},)"
+	                   R"("levels":[{}]}})",
+	                   GetSplitCount(kObjectSplit), GetSplitCount(kSpatialSplit), GetSplitCount(kDefaultSplit),
+	                   GetSplitCount(kMedianSplit), GetLeafCount(), GetMedianLeafCount(), GetFullQualityFraction(),
+	                   GetMaxDepth(), m_presplit_references, GetDuplicateCount(),
+	                   GetDuplicationFactor(), GetUnsplitCount(), m_reference_list_allocs, m_reference_list_reuses,
+	                   m_reference_list_chunks, m_localized_references, levels);
+}
@@ -0,0 +1,63 @@
+#ifndef ADYPT_BUILDSTATS_HPP
+#define ADYPT_BUILDSTATS_HPP
+
+#include <array>
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+// Split decisions of a binary BVH build. Parallel builders count into one instance per thread without
+// synchronization and merge them when the build ends.
+struct BuildStats {
+	// median splits finish the nodes left once the build budget is exceeded, see BVHConfig::m_build_ms
+	enum Split { kObjectSplit = 0, kSpatialSplit, kDefaultSplit, kMedianSplit, kSplitCount };
+	struct Level {
+		std::array<uint64_t, kSplitCount> splits{};
+		uint64_t leaves{};
+		uint64_t median_leaves{}; // of the leaves, those made past the build budget
+		uint64_t duplicates{}; // references added by the spatial splits at this depth
+		uint64_t unsplits{};   // references straddling a spatial split that were moved to one side instead
+	};
+
+	uint32_t m_triangle_count{};
+	uint32_t m_presplit_references{}; // references added by pre-splitting before the build
+	std::vector<Level> m_levels; // indexed by depth
+	// reference index lists ParallelSBVHBuilder took from its arenas, how many reused a released range, and the
+	// arena chunks, the only heap allocations for them
+	uint64_t m_reference_list_allocs{}, m_reference_list_reuses{}, m_reference_list_chunks{};
+	uint64_t m_localized_references{}; // copied to the NUMA node of the threads of a subtree, see BVHConfig::m_numa
+
+	inline Level &AtDepth(uint32_t depth) {
+		if (m_levels.size() <= depth)
+			m_levels.resize(depth + 1);
+		return m_levels[depth];
+	}
+	inline void AddSplit(Split split, uint32_t depth) { ++AtDepth(depth).splits[split]; }
+	inline void AddLeaf(uint32_t depth) { ++AtDepth(depth).leaves; }
+	inline void AddMedianLeaf(uint32_t depth) { ++AtDepth(depth).median_leaves; }
+	inline void AddDuplicates(uint32_t depth, uint32_t count) { AtDepth(depth).duplicates += count; }
+	inline void AddUnsplits(uint32_t depth, uint32_t count) { AtDepth(depth).unsplits += count; }
+	void Merge(const BuildStats &r);
+
+	uint64_t GetSplitCount(Split split) const;
+	uint64_t GetLeafCount() const;
+	uint64_t GetMedianLeafCount() const;
+	uint64_t GetDuplicateCount() const;
+	uint64_t GetUnsplitCount() const;
+	// nodes built with the full split search before the build budget was exceeded, as a fraction of all nodes
+	double GetFullQualityFraction() const;
+	// deepest level with a leaf
+	uint32_t GetMaxDepth() const;
+	// references in the finished tree per triangle
+	double GetDuplicationFactor() const {
+		return m_triangle_count
+		           ? double(m_triangle_count + m_presplit_references + GetDuplicateCount()) / m_triangle_count
+		           : 0.0;
+	}
+
+	static const char *GetSplitName(Split split);
+	void Log() const;
+	std::string ToJSON() const;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "BuildTrace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+namespace build_trace_detail {
+
+struct Ring {
+	std::unique_ptr<BuildTrace::Event[]> events{new BuildTrace::Event[BuildTrace::kRingSize]};
+	uint64_t count{};
+};
+
+// rings of every thread that recorded since the last Enable(), a new generation makes threads register again
+static std::mutex s_mutex;
+static std::vector<std::unique_ptr<Ring>> s_rings;
+static std::atomic_uint32_t s_generation{0};
+static uint64_t s_begin_ns{};
+
+} // namespace build_trace_detail
+
+void BuildTrace::Enable() {
+	using namespace build_trace_detail;
+	std::scoped_lock lock{s_mutex};
+	s_rings.clear();
+	s_begin_ns = Now();
+	s_generation.fetch_add(1, std::memory_order_release);
+	s_enabled.store(true, std::memory_order_relaxed);
+}
+
+void BuildTrace::Disable() { s_enabled.store(false, std::memory_order_relaxed); }
+
+void BuildTrace::Record(const Event &event) {
+	using namespace build_trace_detail;
+	thread_local Ring *t_ring = nullptr;
+	thread_local uint32_t t_generation = 0;
+
+	uint32_t generation = s_generation.load(std::memory_order_acquire);
+	if (t_generation != generation) {
+		std::scoped_lock lock{s_mutex};
+		t_ring = s_rings.emplace_back(std::make_unique<Ring>()).get();
+		t_generation = generation;
+	}
+	t_ring->events[t_ring->count++ & (kRingSize - 1u)] = event;
+}
+
+const char *BuildTrace::GetSplitName(Split split) {
+	constexpr const char *kNames[kSplitCount] = {"none", "object", "spatial", "default", "median"};
+	return kNames[split];
+}
+
+bool BuildTrace::WriteJSON(const char *filename) {
+	using namespace build_trace_detail;
+	std::scoped_lock lock{s_mutex};
+
+	FILE *file = fopen(filename, "w");
+	if (!file) {
+		spdlog::error("Failed to open {}", filename);
+		return false;
+	}
+	fputs(R"({"displayTimeUnit":"ns","traceEvents":[)", file);
+	uint64_t event_count = 0, dropped_count = 0;
+	for (uint32_t tid = 0; tid < s_rings.size(); ++tid) {
+		const Ring &ring = *s_rings[tid];
+		fmt::print(file, R"({}{{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":"thread {}"}}}})",
+		           tid ? "," : "", tid, tid);
+		uint64_t first = ring.count > kRingSize ? ring.count - kRingSize : 0;
+		dropped_count += first;
+		for (uint64_t i = first; i < ring.count; ++i) {
+			const Event &e = ring.events[i & (kRingSize - 1u)];
+			// microseconds with nanosecond precision
+			fmt::print(file,
+			           R"(,{{"name":"{}","ph":"X","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f},)"
+			           R"("args":{{"refs":{},"depth":{},"split":"{}"}}}})",
+			           e.name, tid, double(e.begin_ns - s_begin_ns) * 1e-3, double(e.end_ns - e.begin_ns) * 1e-3,
+			           e.ref_count, e.depth, GetSplitName(e.split));
+		}
+		event_count += ring.count - first;
+	}
+	fputs("]}\n", file);
+	fclose(file);
+
+	if (dropped_count)
+		spdlog::warn("Build trace dropped {} oldest events (ring size {})", dropped_count, kRingSize);
+	spdlog::info("Build trace with {} events from {} threads written to {}", event_count, s_rings.size(), filename);
+	return true;
+}
+
+std::vector<BuildTrace::Event> BuildTrace::GetEvents() {
+	using namespace build_trace_detail;
+	std::scoped_lock lock{s_mutex};
+
+	std::vector<Event> events;
+	for (const auto &ring : s_rings)
+		for (uint64_t i = ring->count > kRingSize ? ring->count - kRingSize : 0; i < ring->count; ++i)
+			events.push_back(ring->events[i & (kRingSize - 1u)]);
+	return events;
+}
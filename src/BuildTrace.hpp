@@ -0,0 +1,70 @@
+#ifndef ADYPT_BUILDTRACE_HPP
+#define ADYPT_BUILDTRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <vector>
+
+// Phase tracing of scene loading and BVH builds. Events go to per-thread ring buffers with nanosecond timestamps and
+// are exported as Chrome trace-event JSON (chrome://tracing or ui.perfetto.dev). While disabled, a Scope costs one
+// relaxed atomic load.
+class BuildTrace {
+public:
+	enum Split : uint32_t { kNoSplit = 0, kObjectSplit, kSpatialSplit, kDefaultSplit, kMedianSplit, kSplitCount };
+	struct Event {
+		const char *name;
+		uint64_t begin_ns, end_ns;
+		uint32_t ref_count, depth;
+		Split split;
+	};
+	// events kept per thread, older ones are overwritten
+	static constexpr uint32_t kRingSize = 1u << 16u;
+
+	// records the lifetime of the scope, a null name records nothing
+	class Scope {
+	private:
+		const char *m_name;
+		uint64_t m_begin_ns{};
+		uint32_t m_ref_count, m_depth;
+		Split m_split{kNoSplit};
+
+	public:
+		inline explicit Scope(const char *name, uint32_t ref_count = 0, uint32_t depth = 0)
+		    : m_name{name && IsEnabled() ? name : nullptr}, m_ref_count{ref_count}, m_depth{depth} {
+			if (m_name)
+				m_begin_ns = Now();
+		}
+		inline ~Scope() {
+			if (m_name)
+				Record({m_name, m_begin_ns, Now(), m_ref_count, m_depth, m_split});
+		}
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+		inline void SetSplit(Split split) { m_split = split; }
+	};
+
+private:
+	inline static std::atomic_bool s_enabled{false};
+
+public:
+	inline static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+	inline static uint64_t Now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		           std::chrono::steady_clock::now().time_since_epoch())
+		    .count();
+	}
+
+	// drops the events of any previous trace and starts recording
+	static void Enable();
+	static void Disable();
+	static void Record(const Event &event);
+
+	static const char *GetSplitName(Split split);
+	// call while no thread is recording
+	static bool WriteJSON(const char *filename);
+	// the kept events of every thread, call while no thread is recording
+	static std::vector<Event> GetEvents();
+};
+
+#endif
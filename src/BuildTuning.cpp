@@ -0,0 +1,176 @@
+#include "BuildTuning.hpp"
+
+#include "BVHBuilder.hpp"
+#include "BuildTrace.hpp"
+#include "SceneGenerator.hpp"
+#include <atomic>
+#include <chrono>
+#include <concurrentqueue.h>
+#include <cstdio>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <vector>
+
+namespace {
+// queued work is worth this many times the queue operations, as the task also takes its references to the cache of
+// another thread; a parallel-for block is worth this many times claiming it
+constexpr float kTaskOverheadRatio = 1024.0f, kBlockOverheadRatio = 128.0f;
+constexpr uint32_t kCalibrationTriangleCount = 100000, kQueueOpCount = 1u << 16u, kBlockOpCount = 1u << 20u;
+
+template <class F> double time_ns(F &&func) {
+	auto begin = std::chrono::steady_clock::now();
+	func();
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// the queue operations and counter updates around a task the builders hand to the pool
+float measure_task_overhead() {
+	struct Item {
+		uint64_t data[8]; // about the size of a builder task
+	};
+	moodycamel::ConcurrentQueue<Item> queue;
+	moodycamel::ProducerToken producer_token{queue};
+	moodycamel::ConsumerToken consumer_token{queue};
+	std::atomic_uint32_t task_count{};
+	double ns = time_ns([&] {
+		for (uint32_t i = 0; i < kQueueOpCount; ++i) {
+			++task_count;
+			queue.enqueue(producer_token, Item{{i}});
+		}
+		for (Item item{}; queue.try_dequeue(consumer_token, item);)
+			--task_count;
+	});
+	return float(ns / kQueueOpCount);
+}
+
+// claiming a block from the shared counter with thread_count threads doing the same
+float measure_block_overhead(uint32_t thread_count) {
+	std::atomic_uint32_t counter{};
+	auto claim_all = [&counter] {
+		while (counter++ < kBlockOpCount)
+			;
+	};
+	double ns = time_ns([&] {
+		std::vector<std::thread> threads;
+		for (uint32_t t = 1; t < thread_count; ++t)
+			threads.emplace_back(claim_all);
+		claim_all();
+		for (auto &thread : threads)
+			thread.join();
+	});
+	return float(ns * thread_count / kBlockOpCount);
+}
+} // namespace
+
+bool BuildTuning::Calibrate(const BVHConfig &config, BuildTuning *p_tuning) {
+	spdlog::info("Calibrating build tuning on {} generated triangles", kCalibrationTriangleCount);
+	BuildTuning ret{};
+
+	// the builder traces the binning and partitioning of every task above the local run threshold, with the default
+	// config so a time budget, cancellation or NUMA placement of the caller can't cut the measured build short
+	BVHConfig build_config{};
+	build_config.m_builder = BVHConfig::kParallelSBVH;
+	build_config.m_thread_count = 1;
+	build_config.m_tuning = ret;
+	auto scene = SceneGenerator::Generate(SceneGenerator::kArchitecture, kCalibrationTriangleCount);
+	BuildTrace::Enable();
+	AtomicBinaryBVH::Build<ParallelSBVHBuilder>(build_config, scene);
+	BuildTrace::Disable();
+
+	double object_bin_ns = 0, object_ns = 0, object_refs = 0, spatial_ns = 0, spatial_refs = 0;
+	for (const auto &event : BuildTrace::GetEvents()) {
+		auto ns = double(event.end_ns - event.begin_ns);
+		if (strcmp(event.name, "object_binning") == 0) {
+			object_bin_ns += ns;
+			object_ns += ns;
+			object_refs += event.ref_count;
+		} else if (strcmp(event.name, "object_partition") == 0 || strcmp(event.name, "default_partition") == 0)
+			object_ns += ns;
+		else if (strcmp(event.name, "spatial_binning") == 0) {
+			spatial_ns += ns;
+			spatial_refs += event.ref_count;
+		} else if (strcmp(event.name, "spatial_partition") == 0)
+			spatial_ns += ns;
+	}
+	if (object_refs == 0 || spatial_refs == 0) {
+		spdlog::error("Build tuning calibration traced no split binning");
+		return false;
+	}
+	ret.m_object_ns_per_ref = float(object_ns / object_refs);
+	ret.m_spatial_ns_per_ref = float(spatial_ns / spatial_refs);
+	ret.m_task_overhead_ns = measure_task_overhead();
+	ret.m_block_overhead_ns = measure_block_overhead(config.GetThreadCount());
+
+	ret.m_local_run_work_ns = kTaskOverheadRatio * ret.m_task_overhead_ns;
+	auto bin_ns_per_ref = float(object_bin_ns / object_refs);
+	float block_size = kBlockOverheadRatio * ret.m_block_overhead_ns / std::max(bin_ns_per_ref, 1e-3f);
+	ret.m_parallel_for_block_size = 16;
+	while (ret.m_parallel_for_block_size < 4096 && float(ret.m_parallel_for_block_size) < block_size)
+		ret.m_parallel_for_block_size *= 2;
+	ret.Log();
+	*p_tuning = ret;
+	return true;
+}
+
+bool BuildTuning::Load(const char *filename) {
+	FILE *file = fopen(filename, "r");
+	if (!file)
+		return false;
+	char name[64];
+	double value;
+	while (fscanf(file, "%63s %lf", name, &value) == 2) {
+		if (strcmp(name, "object_ns_per_ref") == 0)
+			m_object_ns_per_ref = float(value);
+		else if (strcmp(name, "spatial_ns_per_ref") == 0)
+			m_spatial_ns_per_ref = float(value);
+		else if (strcmp(name, "task_overhead_ns") == 0)
+			m_task_overhead_ns = float(value);
+		else if (strcmp(name, "block_overhead_ns") == 0)
+			m_block_overhead_ns = float(value);
+		else if (strcmp(name, "local_run_work_ns") == 0)
+			m_local_run_work_ns = float(value);
+		else if (strcmp(name, "parallel_for_block_size") == 0)
+			m_parallel_for_block_size = std::max(uint32_t(value), 1u);
+	}
+	fclose(file);
+	spdlog::info("Build tuning loaded from {}", filename);
+	return true;
+}
+
+bool BuildTuning::Save(const char *filename) const {
+	FILE *file = fopen(filename, "w");
+	if (!file) {
+		spdlog::error("Failed to open {}", filename);
+		return false;
+	}
+	fmt::print(file,
+	           "object_ns_per_ref {}\nspatial_ns_per_ref {}\ntask_overhead_ns {}\nblock_overhead_ns {}\n"
+	           "local_run_work_ns {}\nparallel_for_block_size {}\n",
+	           m_object_ns_per_ref, m_spatial_ns_per_ref, m_task_overhead_ns, m_block_overhead_ns,
+	           m_local_run_work_ns, m_parallel_for_block_size);
+	fclose(file);
+	spdlog::info("Build tuning saved to {}", filename);
+	return true;
+}
+
+BuildTuning BuildTuning::LoadOrCalibrate(const char *filename, const BVHConfig &config) {
+	BuildTuning ret{};
+	if (ret.Load(filename)) {
+		ret.Log();
+		return ret;
+	}
+	if (Calibrate(config, &ret))
+		ret.Save(filename);
+	else
+		spdlog::warn("Build tuning left at the defaults, {} is not written", filename);
+	return ret;
+}
+
+void BuildTuning::Log() const {
+	spdlog::info("Build tuning: {:.1f} ns object and {:.1f} ns spatial split work per reference and level",
+	             m_object_ns_per_ref, m_spatial_ns_per_ref);
+	spdlog::info("Build tuning: {:.0f} ns per queued task, {:.0f} ns per block, local runs below {:.0f} us, blocks "
+	             "of {} references",
+	             m_task_overhead_ns, m_block_overhead_ns, m_local_run_work_ns * 1e-3f, m_parallel_for_block_size);
+}
@@ -0,0 +1,41 @@
+#ifndef ADYPT_BUILDTUNING_HPP
+#define ADYPT_BUILDTUNING_HPP
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+
+struct BVHConfig;
+
+// Task granularity of the parallel builders, from per-reference costs of the host. The work of a subtree is estimated
+// from its reference count and how many of its levels still search spatial splits. A task is queued for other
+// threads only if its subtree is worth more than m_local_run_work_ns, thread ranges split in proportion to the work
+// of the children, and parallel-for blocks are sized so claiming them costs little next to binning them. The defaults
+// are about the former fixed thresholds (512 references, blocks of 64), Calibrate() measures them on the host.
+struct BuildTuning {
+	float m_object_ns_per_ref = 25.0f;  // object split binning and partitioning, per reference and level
+	float m_spatial_ns_per_ref = 50.0f; // the same for spatial splits
+	float m_task_overhead_ns = 2500.0f; // queueing and dequeuing a task
+	float m_block_overhead_ns = 50.0f;  // claiming a parallel-for block
+	float m_local_run_work_ns = GetSubtreeWork(512, 9);
+	uint32_t m_parallel_for_block_size = 64;
+
+	// estimated ns to build a subtree of ref_count references whose top spatial_levels levels search spatial splits
+	inline float GetSubtreeWork(uint32_t ref_count, uint32_t spatial_levels) const {
+		float levels = std::log2(float(std::max(ref_count, 2u)));
+		return float(ref_count) * (levels * m_object_ns_per_ref + std::min(float(spatial_levels), levels) *
+		                                                              m_spatial_ns_per_ref);
+	}
+
+	// builds a generated scene on one thread to measure the costs, then derives the thresholds, for the thread count
+	// of config. False if the build traced no split binning to measure.
+	static bool Calibrate(const BVHConfig &config, BuildTuning *p_tuning);
+	// a text file of "name value" lines, false if it can't be opened
+	bool Load(const char *filename);
+	bool Save(const char *filename) const;
+	void Log() const;
+	// Load() from filename, or Calibrate() and Save() to it if that fails (the defaults if both fail)
+	static BuildTuning LoadOrCalibrate(const char *filename, const BVHConfig &config);
+};
+
+#endif
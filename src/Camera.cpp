@@ -74,17 +74,22 @@ void Camera::Control(GLFWwindow *window, float delta) {
 	m_last_mouse_pos = cur_pos;
 }
 
-Camera::UniformData Camera::fetch_uniform_data() const {
-	UniformData data = {};
+void Camera::GetRayBasis(glm::vec3 *p_look, glm::vec3 *p_side, glm::vec3 *p_up) const {
 	glm::mat4 trans = glm::identity<glm::mat4>();
 	trans = glm::rotate(trans, m_yaw, glm::vec3(0.0f, 1.0f, 0.0f));
 	trans = glm::rotate(trans, m_pitch, glm::vec3(-1.0f, 0.0f, 0.0f));
 	float tg = glm::tan(m_fov * 0.5f);
 	glm::vec3 look = (trans * glm::vec4(0.0, 0.0, 1.0, 0.0));
 	glm::vec3 side = (trans * glm::vec4(1.0, 0.0, 0.0, 0.0));
-	look = glm::normalize(look);
-	side = glm::normalize(side) * tg * m_aspect_ratio;
-	glm::vec3 up = glm::normalize(glm::cross(look, side)) * tg;
+	*p_look = glm::normalize(look);
+	*p_side = glm::normalize(side) * tg * m_aspect_ratio;
+	*p_up = glm::normalize(glm::cross(*p_look, *p_side)) * tg;
+}
+
+Camera::UniformData Camera::fetch_uniform_data() const {
+	UniformData data = {};
+	glm::vec3 look, side, up;
+	GetRayBasis(&look, &side, &up);
 
 	data.m_position = glm::vec4(m_position, 1.0);
 	data.m_look = glm::vec4(look, 1.0);
@@ -37,6 +37,9 @@ public:
 
 	void Control(GLFWwindow *window, float delta);
 
+	// the vectors CameraGenRay() in shader/camera.glsl builds primary rays from
+	void GetRayBasis(glm::vec3 *p_look, glm::vec3 *p_side, glm::vec3 *p_up) const;
+
 	void UpdateFrameUniformBuffer(uint32_t current_frame) const;
 
 	const std::shared_ptr<myvk::DescriptorSetLayout> &GetDescriptorSetLayout() const { return m_descriptor_set_layout; }
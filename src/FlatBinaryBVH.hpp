@@ -13,14 +13,18 @@ public:
 	using Iterator = uint32_t;
 
 private:
-	struct Node { // a bvh with only 1 primitive per node
+	struct Node {
 		AABB aabb;
-		uint32_t tri_idx{};  // triangle index
+		uint32_t tri_begin : 30; // first of the tri_count entries of m_tri_indices
+		uint32_t tri_count : 2;
 		uint32_t left_idx{}; // left node index (-1 for leaf nodes) (right node index = current + 1)
 	};
+	static_assert(BVHConfig::kMaxLeafTriangles < 4);
 
 	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_tri_indices;
 	uint32_t m_leaf_cnt{};
+	BuildStats m_build_stats;
 
 public:
 	inline FlatBinaryBVH(const BVHConfig &config, std::shared_ptr<Scene> scene)
@@ -31,7 +35,10 @@ public:
 	static inline uint32_t get_index(uint32_t idx) { return idx; }
 	inline uint32_t get_left(uint32_t idx) const { return m_nodes[idx].left_idx; }
 	inline uint32_t get_right(uint32_t idx) const { return idx + 1; }
-	inline uint32_t get_triangle_idx(uint32_t idx) const { return m_nodes[idx].tri_idx; }
+	inline uint32_t get_triangle_count(uint32_t idx) const { return m_nodes[idx].tri_count; }
+	inline uint32_t get_triangle_idx(uint32_t idx, uint32_t i) const {
+		return m_tri_indices[m_nodes[idx].tri_begin + i];
+	}
 	inline const AABB &get_aabb(uint32_t idx) const { return m_nodes[idx].aabb; }
 
 	inline uint32_t get_root() const { return 0; }
@@ -39,6 +46,7 @@ public:
 
 	inline uint32_t get_node_range() const { return m_nodes.size(); }
 	inline uint32_t get_leaf_count() const { return m_leaf_cnt; }
+	inline const BuildStats &get_build_stats() const { return m_build_stats; }
 
 	friend class SBVHBuilder;
 };
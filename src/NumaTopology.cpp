@@ -0,0 +1,105 @@
+#include "NumaTopology.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+namespace {
+// parses a sysfs CPU or node list like "0-3,8-11"
+std::vector<uint32_t> read_id_list(const char *filename) {
+	std::vector<uint32_t> ret;
+	std::ifstream fin{filename};
+	std::string range;
+	while (std::getline(fin, range, ',')) {
+		uint32_t first, last;
+		int count = sscanf(range.c_str(), "%u-%u", &first, &last);
+		if (count < 1)
+			continue;
+		if (count == 1)
+			last = first;
+		for (uint32_t id = first; id <= last; ++id)
+			ret.push_back(id);
+	}
+	return ret;
+}
+} // namespace
+
+NumaTopology::NumaTopology() {
+#ifdef __linux__
+	cpu_set_t usable{};
+	if (sched_getaffinity(0, sizeof(usable), &usable) != 0)
+		return;
+	// node indices count the nodes with usable CPUs only
+	uint32_t node_idx = 0;
+	for (uint32_t node : read_id_list("/sys/devices/system/node/online")) {
+		std::string filename = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+		auto cpu_count = (uint32_t)m_cpus.size();
+		for (uint32_t cpu : read_id_list(filename.c_str()))
+			if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &usable)) {
+				m_cpus.push_back(cpu);
+				m_cpu_nodes.push_back(node_idx);
+			}
+		if (m_cpus.size() > cpu_count)
+			++node_idx;
+	}
+	m_node_count = std::max(node_idx, 1u);
+#endif
+}
+
+const NumaTopology &NumaTopology::Get() {
+	static const NumaTopology topology = [] {
+		NumaTopology ret{};
+		spdlog::info("NUMA: {} nodes, {} usable CPUs", ret.m_node_count, ret.m_cpus.size());
+		return ret;
+	}();
+	return topology;
+}
+
+uint32_t NumaTopology::AlignThreadSplit(uint32_t thread_begin, uint32_t thread_count,
+                                        uint32_t left_thread_count) const {
+	if (m_node_count == 1 || left_thread_count == 0 || left_thread_count == thread_count)
+		return left_thread_count;
+	uint32_t ret = left_thread_count, min_dist = thread_count / 4 + 1;
+	for (uint32_t lc = 1; lc < thread_count; ++lc) {
+		if (GetThreadNode(thread_begin + lc) == GetThreadNode(thread_begin + lc - 1))
+			continue;
+		uint32_t dist = lc > left_thread_count ? lc - left_thread_count : left_thread_count - lc;
+		if (dist < min_dist) {
+			min_dist = dist;
+			ret = lc;
+		}
+	}
+	return ret;
+}
+
+bool NumaTopology::PinThread(uint32_t thread) const {
+#ifdef __linux__
+	if (m_cpus.empty())
+		return false;
+	cpu_set_t cpus{};
+	CPU_SET(m_cpus[thread % m_cpus.size()], &cpus);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+	return false;
+#endif
+}
+
+NumaTopology::ThreadPin::ThreadPin(const NumaTopology &topology, uint32_t thread) {
+#ifdef __linux__
+	if (pthread_getaffinity_np(pthread_self(), sizeof(m_prev_cpus), &m_prev_cpus) == 0)
+		m_pinned = topology.PinThread(thread);
+#endif
+}
+
+NumaTopology::ThreadPin::~ThreadPin() {
+#ifdef __linux__
+	if (m_pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(m_prev_cpus), &m_prev_cpus);
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef ADYPT_NUMATOPOLOGY_HPP
+#define ADYPT_NUMATOPOLOGY_HPP
+
+#include <cinttypes>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// The usable CPUs grouped by NUMA node, read from /sys/devices/system/node on Linux. Builder thread t is placed on
+// the (t mod CPU count)-th CPU in node order, so a contiguous range of threads spans as few nodes as possible. Without
+// the sysfs directory (or off Linux) it is a single node and pinning does nothing.
+class NumaTopology {
+private:
+	std::vector<uint32_t> m_cpus;       // ordered by node
+	std::vector<uint32_t> m_cpu_nodes;  // node of m_cpus[i]
+	uint32_t m_node_count{1};
+
+	NumaTopology();
+
+public:
+	// queried on first use
+	static const NumaTopology &Get();
+
+	inline uint32_t GetNodeCount() const { return m_node_count; }
+	inline uint32_t GetThreadNode(uint32_t thread) const {
+		return m_cpus.empty() ? 0 : m_cpu_nodes[thread % m_cpus.size()];
+	}
+	// the left thread count of the range [thread_begin, thread_begin + thread_count) split at left_thread_count,
+	// moved onto the nearest node boundary in the range if that is at most a quarter of the range away
+	uint32_t AlignThreadSplit(uint32_t thread_begin, uint32_t thread_count, uint32_t left_thread_count) const;
+	// pins the calling thread to the CPU of builder thread thread, returns false if it stays unpinned
+	bool PinThread(uint32_t thread) const;
+
+	// PinThread() for a scope, restoring the previous affinity at its end
+	class ThreadPin {
+	private:
+#ifdef __linux__
+		cpu_set_t m_prev_cpus{};
+#endif
+		bool m_pinned{};
+
+	public:
+		ThreadPin(const NumaTopology &topology, uint32_t thread);
+		~ThreadPin();
+		ThreadPin(const ThreadPin &r) = delete;
+		ThreadPin &operator=(const ThreadPin &r) = delete;
+		inline bool IsPinned() const { return m_pinned; }
+	};
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "PSSBVHBuilder.hpp"
 
+#include "Presplit.hpp"
 #include <iterator>
 #include <pdqsort.h>
 #include <queue>
@@ -13,12 +14,15 @@ void PSSBVHBuilder::Run() {
 	m_consumer_tokens.reserve(kThreadCount);
 	m_producer_tokens.reserve(kThreadCount);
 	m_thread_node_allocators.reserve(kThreadCount);
+	m_thread_tri_index_allocators.reserve(kThreadCount);
 	m_thread_reference_allocators.reserve(kThreadCount);
+	m_thread_stats.resize(kThreadCount);
 	m_thread_reference_block_allocators.reserve(kThreadCount);
 	for (uint32_t i = 0; i < kThreadCount; ++i) {
 		m_consumer_tokens.emplace_back(m_task_queue);
 		m_producer_tokens.emplace_back(m_task_queue);
 		m_thread_node_allocators.emplace_back(m_bvh.m_node_pool);
+		m_thread_tri_index_allocators.emplace_back(m_bvh.m_tri_index_pool);
 		m_thread_reference_allocators.emplace_back(m_reference_pool);
 		if (i == 0)
 			m_thread_reference_block_allocators.emplace_back(m_reference_block_pool,
@@ -27,9 +31,28 @@ void PSSBVHBuilder::Run() {
 			m_thread_reference_block_allocators.emplace_back(m_reference_block_pool);
 	}
 
-	spdlog::info("Begin, threshold = {}", kLocalRunThreshold);
+	// with NUMA placement every thread stays on its CPU for the build, and the allocators touch their chunks first
+	// on the thread that uses them, which puts them on its node
+	std::optional<NumaTopology::ThreadPin> thread_pin;
+	if (m_p_numa) {
+		thread_pin.emplace(*m_p_numa, 0);
+		std::vector<std::future<bool>> futures;
+		for (uint32_t t = 1; t < kThreadCount; ++t)
+			futures.push_back(m_thread_group[t - 1].Push([this, t] { return m_p_numa->PinThread(t); }));
+		uint32_t pinned_count = thread_pin->IsPinned();
+		for (auto &future : futures)
+			pinned_count += future.get();
+		spdlog::info("NUMA: {} of {} threads pinned", pinned_count, kThreadCount);
+	}
+
+	m_budget.Start();
+	spdlog::info("Begin, local runs below {:.0f} us, blocks of at least {} references",
+	             m_config.m_tuning.m_local_run_work_ns * 1e-3f, m_config.m_tuning.m_parallel_for_block_size);
 	auto begin = std::chrono::high_resolution_clock::now();
-	make_root_task().BlockRun();
+	{
+		BuildTrace::Scope trace{"pss_build", (uint32_t)m_scene.GetTriangles().size()};
+		make_root_task().BlockRun();
+	}
 	spdlog::info(
 	    "End {} ms, {} nodes, {} leaves",
 	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - begin)
@@ -37,61 +60,98 @@ void PSSBVHBuilder::Run() {
 	    m_bvh.get_node_range(), m_leaf_count);
 
 	m_bvh.m_leaf_cnt = m_leaf_count;
+	m_bvh.m_build_stats.m_triangle_count = m_scene.GetTriangles().size();
+	for (const auto &stats : m_thread_stats)
+		m_bvh.m_build_stats.Merge(stats);
 }
 
 PSSBVHBuilder::Task PSSBVHBuilder::make_root_task() {
 	uint32_t root_idx = m_thread_node_allocators[0].Alloc();
 	assert(root_idx == 0);
 	m_node_pool[root_idx].aabb = m_scene.GetAABB();
+	std::vector<Presplit::Reference> presplit_refs = Presplit::Run(m_scene, m_config.m_presplit_threshold);
+	const auto triangle_count = (uint32_t)m_scene.GetTriangles().size();
+	const auto reference_count = (uint32_t)presplit_refs.size();
 	auto [reference_block, tmp_reference_block, reference_block_size] =
-	    alloc_reference_block(&m_thread_reference_block_allocators[0], m_scene.GetTriangles().size());
+	    alloc_reference_block(&m_thread_reference_block_allocators[0], reference_count);
 	{
-		for (uint32_t i = 0; i < m_scene.GetTriangles().size(); ++i) {
+		for (uint32_t i = 0; i < reference_count; ++i) {
 			uint32_t ref_idx = m_thread_reference_allocators[0].Alloc();
 			auto &ref = m_reference_pool[ref_idx];
-			ref.tri_idx = i;
-			ref.aabb = m_scene.GetTriangles()[i].GetAABB();
+			ref.tri_idx = presplit_refs[i].tri_idx;
+			m_reference_codec.SetAABB(&ref, presplit_refs[i].aabb);
 			reference_block[i] = ref_idx;
 		}
 	}
-	return Task{this,
-	            root_idx,
-	            Task::kAlignLeft,
-	            (uint32_t)m_scene.GetTriangles().size(),
-	            reference_block_size,
-	            reference_block,
-	            tmp_reference_block,
-	            0,
-	            0,
-	            kThreadCount};
+	m_bvh.m_build_stats.m_presplit_references = reference_count - triangle_count;
+	Task task{this,
+	          root_idx,
+	          Task::kAlignLeft,
+	          reference_count,
+	          reference_block_size,
+	          reference_block,
+	          tmp_reference_block,
+	          0,
+	          0,
+	          kThreadCount};
+	task.SetDuplicateBudget(m_config.GetDuplicateBudget(triangle_count, reference_count));
+	return task;
 }
 
 std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task> PSSBVHBuilder::Task::Run() {
+	const uint32_t ref_count = m_reference_count;
+	BuildTrace::Scope trace{trace_name("task"), ref_count, m_depth};
+	if (m_p_builder->m_budget.IsExceeded()) {
+		if (ref_count <= BVHConfig::kMaxLeafTriangles) {
+			get_stats().AddMedianLeaf(m_depth);
+			make_leaf();
+			return {};
+		}
+		trace.SetSplit(BuildTrace::kMedianSplit);
+		get_stats().AddSplit(BuildStats::kMedianSplit, m_depth);
+		return pass_duplicate_budget(perform_median_split(), 0);
+	}
 	if (m_reference_count == 1) {
 		make_leaf();
 		return {};
 	}
 
 	ObjectSplit object_split = find_object_split();
+	if (m_p_builder->m_config.IsLeafCheaper(ref_count, access_node(m_node_index).aabb.GetHalfArea(),
+	                                        object_split.sah)) {
+		make_leaf();
+		return {};
+	}
 	SpatialSplit spatial_split{};
-	if (m_depth <= m_p_builder->m_config.m_max_spatial_depth) {
+	if (m_depth <= m_p_builder->m_config.m_max_spatial_depth && m_duplicate_budget) {
 		AABB overlap = object_split.left_aabb;
 		overlap.IntersectAABB(object_split.right_aabb);
 		if (overlap.GetHalfArea() >= m_p_builder->m_min_overlap_area) {
 			spatial_split = find_spatial_split();
 		}
 	}
-	if (spatial_split.sah < object_split.sah) {
+	// the binned reference count estimates the duplicates, the partitions check the exact count
+	if (spatial_split.sah < object_split.sah && spatial_split.ref_cnt - ref_count <= m_duplicate_budget) {
 		auto ret = perform_spatial_split(spatial_split);
-		if (!PairEmpty(ret))
-			return ret;
+		if (!PairEmpty(ret)) {
+			trace.SetSplit(BuildTrace::kSpatialSplit);
+			get_stats().AddSplit(BuildStats::kSpatialSplit, m_depth);
+			uint32_t child_ref_count = std::get<0>(ret).m_reference_count + std::get<1>(ret).m_reference_count;
+			get_stats().AddDuplicates(m_depth, child_ref_count - ref_count);
+			return pass_duplicate_budget(std::move(ret), child_ref_count - ref_count);
+		}
 	}
 	if (object_split.sah < FLT_MAX) {
 		auto ret = perform_object_split(object_split);
-		if (!PairEmpty(ret))
-			return ret;
+		if (!PairEmpty(ret)) {
+			trace.SetSplit(BuildTrace::kObjectSplit);
+			get_stats().AddSplit(BuildStats::kObjectSplit, m_depth);
+			return pass_duplicate_budget(std::move(ret), 0);
+		}
 	}
-	return perform_default_split();
+	trace.SetSplit(BuildTrace::kDefaultSplit);
+	get_stats().AddSplit(BuildStats::kDefaultSplit, m_depth);
+	return pass_duplicate_budget(perform_default_split(), 0);
 }
 
 void PSSBVHBuilder::Task::BlockRun() {
@@ -111,6 +171,7 @@ void PSSBVHBuilder::Task::BlockRun() {
 			// Subdivide the thread
 			auto future = right_task.AsyncRun();
 			left_task.BlockRun();
+			BuildTrace::Scope trace{"wait", m_reference_count, m_depth};
 			future.wait();
 		}
 	} else if (m_thread_count == 1) {
@@ -121,11 +182,17 @@ void PSSBVHBuilder::Task::BlockRun() {
 			m_p_builder->m_task_queue.enqueue(get_queue_producer_token(), std::move(right_task));
 		}
 		Task task;
+		uint64_t idle_begin_ns = 0; // start of the current run of empty dequeues, traced as "idle"
 		while (m_p_builder->m_task_count.load()) {
 			if (m_p_builder->m_task_queue.try_dequeue(get_queue_consumer_token(), task)) {
+				if (idle_begin_ns) {
+					BuildTrace::Record({"idle", idle_begin_ns, BuildTrace::Now(), 0, m_depth, BuildTrace::kNoSplit});
+					idle_begin_ns = 0;
+				}
 				task.AssignToThread(m_thread);
 
-				if (m_reference_count <= kLocalRunThreshold) {
+				if (task.is_local()) {
+					BuildTrace::Scope trace{"local_run", task.m_reference_count, task.m_depth};
 					task.LocalRun();
 					--m_p_builder->m_task_count;
 				} else {
@@ -140,8 +207,11 @@ void PSSBVHBuilder::Task::BlockRun() {
 						                                  std::move(std::get<0>(new_tasks)));
 					}
 				}
-			}
+			} else if (!idle_begin_ns && BuildTrace::IsEnabled())
+				idle_begin_ns = BuildTrace::Now();
 		}
+		if (idle_begin_ns)
+			BuildTrace::Record({"idle", idle_begin_ns, BuildTrace::Now(), 0, m_depth, BuildTrace::kNoSplit});
 	}
 }
 
@@ -157,7 +227,7 @@ void PSSBVHBuilder::Task::LocalRun() {
 
 template <uint32_t DIM, typename Iter> void PSSBVHBuilder::sort_references(Iter first_ref, Iter last_ref) {
 	pdqsort_branchless(first_ref, last_ref, [this](uint32_t l, uint32_t r) {
-		return m_reference_pool[l].aabb.GetDimCenter<DIM>() < m_reference_pool[r].aabb.GetDimCenter<DIM>();
+		return m_reference_codec.IsCenterLess<DIM>(m_reference_pool[l], m_reference_pool[r]);
 	});
 }
 template <typename Iter> void PSSBVHBuilder::sort_references(Iter first_ref, Iter last_ref, uint32_t dim) {
@@ -165,31 +235,38 @@ template <typename Iter> void PSSBVHBuilder::sort_references(Iter first_ref, Ite
 	         : (dim == 1 ? sort_references<1>(first_ref, last_ref) : sort_references<2>(first_ref, last_ref));
 }
 
-std::tuple<PSSBVHBuilder::Reference, PSSBVHBuilder::Reference>
-PSSBVHBuilder::split_reference(const PSSBVHBuilder::Reference &ref, uint32_t dim, float pos) const {
-	Reference left, right;
-	left.aabb = right.aabb = AABB();
-	left.tri_idx = right.tri_idx = ref.tri_idx;
+std::tuple<AABB, AABB> PSSBVHBuilder::split_aabb(uint32_t tri_idx, const AABB &aabb, uint32_t dim, float pos) const {
+	AABB left_aabb, right_aabb;
 
-	const Triangle &tri = m_scene.GetTriangles()[ref.tri_idx];
+	const Triangle &tri = m_scene.GetTriangles()[tri_idx];
 	for (uint32_t i = 0; i < 3; ++i) {
 		const glm::vec3 &v0 = tri.positions[i], &v1 = tri.positions[(i + 1) % 3];
 		float p0 = v0[(int)dim], p1 = v1[(int)dim];
 		if (p0 <= pos)
-			left.aabb.Expand(v0);
+			left_aabb.Expand(v0);
 		if (p0 >= pos)
-			right.aabb.Expand(v0);
+			right_aabb.Expand(v0);
 
 		if ((p0 < pos && pos < p1) || (p1 < pos && pos < p0)) { // Edges
 			glm::vec3 x = glm::mix(v0, v1, (pos - p0) / (p1 - p0));
-			left.aabb.Expand(x);
-			right.aabb.Expand(x);
+			left_aabb.Expand(x);
+			right_aabb.Expand(x);
 		}
 	}
 
-	left.aabb.IntersectAABB(ref.aabb);
-	right.aabb.IntersectAABB(ref.aabb);
+	left_aabb.IntersectAABB(aabb);
+	right_aabb.IntersectAABB(aabb);
+
+	return {left_aabb, right_aabb};
+}
 
+std::tuple<PSSBVHBuilder::Reference, PSSBVHBuilder::Reference>
+PSSBVHBuilder::split_reference(const PSSBVHBuilder::Reference &ref, uint32_t dim, float pos) const {
+	auto [left_aabb, right_aabb] = split_aabb(ref.tri_idx, get_aabb(ref), dim, pos);
+	Reference left, right;
+	left.tri_idx = right.tri_idx = ref.tri_idx;
+	m_reference_codec.SetAABB(&left, left_aabb, ref);
+	m_reference_codec.SetAABB(&right, right_aabb, ref);
 	return {left, right};
 }
 
@@ -205,8 +282,10 @@ PSSBVHBuilder::alloc_reference_block(LocalBlockAllocator<RefBlockItem> *p_block_
 uint32_t PSSBVHBuilder::Task::split_thread(uint32_t left_ref_count, uint32_t right_ref_count) const {
 	if (m_thread_count == 0)
 		return 0u;
-	auto lt = (float)left_ref_count, tt = float(left_ref_count + right_ref_count);
-	return std::clamp(uint32_t(glm::round(lt / tt * float(m_thread_count))), 0u, m_thread_count);
+	// in proportion to the estimated work of the children, which is not that of their reference counts
+	auto lt = get_work(left_ref_count, m_depth + 1), tt = lt + get_work(right_ref_count, m_depth + 1);
+	auto lc = std::clamp(uint32_t(glm::round(lt / tt * float(m_thread_count))), 0u, m_thread_count);
+	return m_p_builder->m_p_numa ? m_p_builder->m_p_numa->AlignThreadSplit(m_thread, m_thread_count, lc) : lc;
 }
 
 uint32_t PSSBVHBuilder::Task::split_reference_block(uint32_t left_ref_count, uint32_t right_ref_count,
@@ -245,44 +324,45 @@ std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task> PSSBVHBuilder::Task::split_
 /*
  Spatial split
  */
-template <uint32_t DIM> void PSSBVHBuilder::Task::_find_spatial_split_dim(SpatialSplit *p_ss) {
-	SpatialBin spatial_bins[kSpatialBinNum];
-	AABB right_aabbs[kSpatialBinNum];
+template <uint32_t BIN_NUM, uint32_t DIM> void PSSBVHBuilder::Task::_find_spatial_split_dim(SpatialSplit *p_ss) {
+	SpatialBin spatial_bins[BIN_NUM];
+	AABB right_aabbs[BIN_NUM];
 
-	std::fill(spatial_bins, spatial_bins + kSpatialBinNum, SpatialBin{AABB(), 0, 0}); // initialize bins
+	std::fill(spatial_bins, spatial_bins + BIN_NUM, SpatialBin{AABB(), 0, 0}); // initialize bins
 	auto &node = access_node(m_node_index);
-	const float bin_width = node.aabb.GetExtent()[DIM] / (float)kSpatialBinNum, inv_bin_width = 1.0f / bin_width;
+	const float bin_width = node.aabb.GetExtent()[DIM] / (float)BIN_NUM, inv_bin_width = 1.0f / bin_width;
 	const float bound_base = node.aabb.min[DIM];
 
 	// Put references into bins
 	auto ref_begin = get_reference_begin();
 	for (uint32_t i = 0; i < m_reference_count; ++i) {
 		const auto &ref = access_reference(ref_begin[i]);
-		uint32_t bin = glm::clamp(uint32_t((ref.aabb.min[DIM] - bound_base) * inv_bin_width), 0u, kSpatialBinNum - 1);
+		const AABB &ref_aabb = get_aabb(ref);
+		uint32_t bin = glm::clamp(uint32_t((ref_aabb.min[DIM] - bound_base) * inv_bin_width), 0u, BIN_NUM - 1);
 		uint32_t last_bin =
-		    glm::clamp(uint32_t((ref.aabb.max[DIM] - bound_base) * inv_bin_width), 0u, kSpatialBinNum - 1);
+		    glm::clamp(uint32_t((ref_aabb.max[DIM] - bound_base) * inv_bin_width), 0u, BIN_NUM - 1);
 
 		spatial_bins[bin].in++;
-		Reference cur_ref = ref;
+		AABB cur_aabb = ref_aabb;
 		for (; bin < last_bin; ++bin) {
-			auto [left_ref, right_ref] =
-			    m_p_builder->split_reference(cur_ref, DIM, float(bin + 1) * bin_width + bound_base);
-			spatial_bins[bin].aabb.Expand(left_ref.aabb);
-			cur_ref = right_ref;
+			auto [left_aabb, right_aabb] =
+			    m_p_builder->split_aabb(ref.tri_idx, cur_aabb, DIM, float(bin + 1) * bin_width + bound_base);
+			spatial_bins[bin].aabb.Expand(left_aabb);
+			cur_aabb = right_aabb;
 		}
-		spatial_bins[last_bin].aabb.Expand(cur_ref.aabb);
+		spatial_bins[last_bin].aabb.Expand(cur_aabb);
 		spatial_bins[last_bin].out++;
 	}
 
 	// Compute the AABBs from right
-	right_aabbs[kSpatialBinNum - 1] = spatial_bins[kSpatialBinNum - 1].aabb;
-	for (int32_t i = kSpatialBinNum - 2; i >= 1; --i)
+	right_aabbs[BIN_NUM - 1] = spatial_bins[BIN_NUM - 1].aabb;
+	for (int32_t i = BIN_NUM - 2; i >= 1; --i)
 		right_aabbs[i] = AABB(spatial_bins[i].aabb, right_aabbs[i + 1]);
 
 	// Find optimal spatial split
 	AABB left_aabb = spatial_bins[0].aabb;
 	uint32_t left_num = 0, right_num = m_reference_count;
-	for (uint32_t i = 1; i < kSpatialBinNum; ++i) {
+	for (uint32_t i = 1; i < BIN_NUM; ++i) {
 		left_num += spatial_bins[i - 1].in;
 		right_num -= spatial_bins[i - 1].out;
 
@@ -297,19 +377,20 @@ template <uint32_t DIM> void PSSBVHBuilder::Task::_find_spatial_split_dim(Spatia
 		left_aabb.Expand(spatial_bins[i].aabb);
 	}
 }
+template <uint32_t BIN_NUM>
 void PSSBVHBuilder::Task::_find_spatial_split_parallel(PSSBVHBuilder::Task::SpatialSplit *p_ss) {
 	auto &node = access_node(m_node_index);
 
 	const glm::vec3 &bin_bases = node.aabb.min;
-	const glm::vec3 bin_widths = node.aabb.GetExtent() / (float)kSpatialBinNum, inv_bin_widths = 1.0f / bin_widths;
+	const glm::vec3 bin_widths = node.aabb.GetExtent() / (float)BIN_NUM, inv_bin_widths = 1.0f / bin_widths;
 
-	uint32_t block_size = GetParallelForBlockSize(m_reference_count);
+	uint32_t block_size = m_p_builder->get_parallel_for_block_size(m_reference_count);
 	std::atomic_uint32_t counter{0};
 
 	auto ref_begin = get_reference_begin();
 	auto compute_spatial_bins_func = [this, ref_begin, &bin_bases, &bin_widths, &inv_bin_widths, block_size,
 	                                  &counter](uint32_t thread_idx) {
-		std::array<std::array<PSSBVHBuilder::Task::SpatialBin, PSSBVHBuilder::kSpatialBinNum>, 3> ret{};
+		std::array<std::array<SpatialBin, BIN_NUM>, 3> ret{};
 
 		for (uint32_t cur_block = counter.fetch_add(1, std::memory_order_relaxed);
 		     cur_block * block_size < m_reference_count; cur_block = counter.fetch_add(1, std::memory_order_relaxed)) {
@@ -317,24 +398,25 @@ void PSSBVHBuilder::Task::_find_spatial_split_parallel(PSSBVHBuilder::Task::Spat
 			         cur_last = std::min((cur_block + 1) * block_size, m_reference_count);
 			for (uint32_t cur = cur_first; cur < cur_last; ++cur) {
 				const auto &ref = access_reference(ref_begin[cur]);
+				const AABB &ref_aabb = get_aabb(ref);
 				glm::u32vec3 bins =
-				    glm::clamp(glm::u32vec3((ref.aabb.min - bin_bases) * inv_bin_widths), 0u, kSpatialBinNum - 1);
+				    glm::clamp(glm::u32vec3((ref_aabb.min - bin_bases) * inv_bin_widths), 0u, BIN_NUM - 1);
 				glm::u32vec3 last_bins =
-				    glm::clamp(glm::u32vec3((ref.aabb.max - bin_bases) * inv_bin_widths), 0u, kSpatialBinNum - 1);
+				    glm::clamp(glm::u32vec3((ref_aabb.max - bin_bases) * inv_bin_widths), 0u, BIN_NUM - 1);
 
 				for (int dim = 0; dim < 3; ++dim) {
 					uint32_t bin = bins[dim], last_bin = last_bins[dim];
 					auto &spatial_bins = ret[dim];
 
 					++spatial_bins[bin].in;
-					Reference cur_ref = ref;
+					AABB cur_aabb = ref_aabb;
 					for (; bin < last_bin; ++bin) {
-						auto [left_ref, right_ref] = m_p_builder->split_reference(
-						    cur_ref, dim, float(bin + 1) * bin_widths[dim] + bin_bases[dim]);
-						spatial_bins[bin].aabb.Expand(left_ref.aabb);
-						cur_ref = right_ref;
+						auto [left_aabb, right_aabb] = m_p_builder->split_aabb(
+						    ref.tri_idx, cur_aabb, dim, float(bin + 1) * bin_widths[dim] + bin_bases[dim]);
+						spatial_bins[bin].aabb.Expand(left_aabb);
+						cur_aabb = right_aabb;
 					}
-					spatial_bins[last_bin].aabb.Expand(cur_ref.aabb);
+					spatial_bins[last_bin].aabb.Expand(cur_aabb);
 					++spatial_bins[last_bin].out;
 				}
 			}
@@ -343,7 +425,7 @@ void PSSBVHBuilder::Task::_find_spatial_split_parallel(PSSBVHBuilder::Task::Spat
 	};
 
 	// Async compute bins
-	std::vector<std::future<std::array<std::array<SpatialBin, kSpatialBinNum>, 3>>> futures(m_thread_count - 1);
+	std::vector<std::future<std::array<std::array<SpatialBin, BIN_NUM>, 3>>> futures(m_thread_count - 1);
 	for (uint32_t i = 1; i < m_thread_count; ++i)
 		futures[i - 1] = get_thread_unit(i).Push(compute_spatial_bins_func, i);
 	auto bins = compute_spatial_bins_func(0);
@@ -352,7 +434,7 @@ void PSSBVHBuilder::Task::_find_spatial_split_parallel(PSSBVHBuilder::Task::Spat
 	for (auto &f : futures) {
 		auto r = f.get();
 		for (int dim = 0; dim < 3; ++dim) {
-			for (uint32_t x = 0; x < kSpatialBinNum; ++x) {
+			for (uint32_t x = 0; x < BIN_NUM; ++x) {
 				auto &cl = bins[dim][x];
 				const auto &cr = r[dim][x];
 				cl.aabb.Expand(cr.aabb);
@@ -362,18 +444,18 @@ void PSSBVHBuilder::Task::_find_spatial_split_parallel(PSSBVHBuilder::Task::Spat
 		}
 	}
 
-	AABB right_aabbs[kSpatialBinNum];
+	AABB right_aabbs[BIN_NUM];
 	for (int dim = 0; dim < 3; ++dim) {
 		const auto &dim_bins = bins[dim];
 
-		right_aabbs[kSpatialBinNum - 1] = dim_bins[kSpatialBinNum - 1].aabb;
-		for (int32_t i = kSpatialBinNum - 2; i >= 1; --i)
+		right_aabbs[BIN_NUM - 1] = dim_bins[BIN_NUM - 1].aabb;
+		for (int32_t i = BIN_NUM - 2; i >= 1; --i)
 			right_aabbs[i] = AABB(dim_bins[i].aabb, right_aabbs[i + 1]);
 
 		// Find optimal spatial split
 		AABB left_aabb = dim_bins[0].aabb;
 		uint32_t left_num = 0, right_num = m_reference_count;
-		for (uint32_t i = 1; i < kSpatialBinNum; ++i) {
+		for (uint32_t i = 1; i < BIN_NUM; ++i) {
 			left_num += dim_bins[i - 1].in;
 			right_num -= dim_bins[i - 1].out;
 
@@ -390,20 +472,26 @@ void PSSBVHBuilder::Task::_find_spatial_split_parallel(PSSBVHBuilder::Task::Spat
 	}
 }
 PSSBVHBuilder::Task::SpatialSplit PSSBVHBuilder::Task::find_spatial_split() {
+	BuildTrace::Scope trace{trace_name("spatial_binning"), m_reference_count, m_depth};
 	SpatialSplit ss{};
-	if (m_thread_count > 1) {
-		_find_spatial_split_parallel(&ss);
-	} else {
-		_find_spatial_split_dim<0>(&ss);
-		_find_spatial_split_dim<1>(&ss);
-		_find_spatial_split_dim<2>(&ss);
-	}
+	BVHConfig::VisitBinCount(get_bin_count(), [this, &ss](auto bin_num) {
+		constexpr uint32_t kBinNum = decltype(bin_num)::value;
+		if (m_thread_count > 1) {
+			_find_spatial_split_parallel<kBinNum>(&ss);
+		} else {
+			_find_spatial_split_dim<kBinNum, 0>(&ss);
+			_find_spatial_split_dim<kBinNum, 1>(&ss);
+			_find_spatial_split_dim<kBinNum, 2>(&ss);
+		}
+	});
 	return ss;
 }
 std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task>
 PSSBVHBuilder::Task::perform_spatial_split(const SpatialSplit &ss) {
-	// return _perform_spatial_split(ss);
-	return m_thread_count > 1 ? _perform_spatial_split_parallel(ss) : _perform_spatial_split(ss);
+	BuildTrace::Scope trace{trace_name("spatial_partition"), m_reference_count, m_depth};
+	// The two partitions differ (only the serial one unsplits references), so pick by size rather than thread count
+	return m_reference_count >= kParallelSpatialSplitThreshold ? _perform_spatial_split_parallel(ss)
+	                                                           : _perform_spatial_split(ss);
 }
 std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task>
 PSSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
@@ -423,14 +511,16 @@ PSSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 
 	uint32_t left_num = 0, right_num = 0;
 	uint32_t split_num = 0; // The number of references to splitted
+	uint32_t unsplit_num = 0;
 	for (uint32_t i = 0; i < m_reference_count; ++i) {
 		uint32_t ref_idx = ref_begin[i];
 		const auto &ref = access_reference(ref_idx);
-		if (ref.aabb.max[(int)ss.dim] <= ss.pos) {
-			left_node.aabb.Expand(ref.aabb);
+		const AABB &ref_aabb = get_aabb(ref);
+		if (ref_aabb.max[(int)ss.dim] <= ss.pos) {
+			left_node.aabb.Expand(ref_aabb);
 			*(tmp_ref_block_begin + (left_num++)) = ref_idx;
-		} else if (ref.aabb.min[(int)ss.dim] >= ss.pos) {
-			right_node.aabb.Expand(ref.aabb);
+		} else if (ref_aabb.min[(int)ss.dim] >= ss.pos) {
+			right_node.aabb.Expand(ref_aabb);
 			*(tmp_ref_block_end - (++right_num)) = ref_idx;
 		} else
 			std::swap(ref_begin[i], ref_begin[split_num++]);
@@ -438,6 +528,9 @@ PSSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 
 	if ((left_num == 0 || right_num == 0) && split_num == 0)
 		return {};
+	// at most every straddling reference is duplicated
+	if (split_num > m_duplicate_budget)
+		return {};
 
 	AABB lub; // Unsplit to left:     new left-hand bounds.
 	AABB rub; // Unsplit to right:    new right-hand bounds.
@@ -446,20 +539,21 @@ PSSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 	for (uint32_t i = 0; i < split_num; ++i) {
 		uint32_t ref_idx = ref_begin[i];
 		const auto &ref = access_reference(ref_idx);
+		const AABB &ref_aabb = get_aabb(ref);
 		auto [left_ref, right_ref] = m_p_builder->split_reference(ref, ss.dim, ss.pos);
 
-		AABB lb = AABB{left_node.aabb, ref.aabb};
-		AABB rb = AABB{right_node.aabb, ref.aabb};
+		AABB lb = AABB{left_node.aabb, ref_aabb};
+		AABB rb = AABB{right_node.aabb, ref_aabb};
 		float left_sah = lb.GetHalfArea() * float(1 + left_num) + right_node.aabb.GetHalfArea() * float(right_num);
 		float right_sah = left_node.aabb.GetHalfArea() * float(left_num) + rb.GetHalfArea() * float(1 + right_num);
 
 		lub = lsb = left_node.aabb;
 		rub = rsb = right_node.aabb;
 
-		lub.Expand(ref.aabb);
-		rub.Expand(ref.aabb);
-		lsb.Expand(left_ref.aabb);
-		rsb.Expand(right_ref.aabb);
+		lub.Expand(ref_aabb);
+		rub.Expand(ref_aabb);
+		lsb.Expand(get_aabb(left_ref));
+		rsb.Expand(get_aabb(right_ref));
 
 		float unsplit_left_sah =
 		    lub.GetHalfArea() * float(1 + left_num) + right_node.aabb.GetHalfArea() * float(right_num);
@@ -470,9 +564,11 @@ PSSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 		if (unsplit_left_sah < unsplit_right_sah && unsplit_left_sah < split_sah && right_num > 0) { // unsplit to left
 			left_node.aabb = lub;
 			*(tmp_ref_block_begin + (left_num++)) = ref_idx;
+			++unsplit_num;
 		} else if (unsplit_right_sah < split_sah && left_num > 0) { // unsplit to right
 			right_node.aabb = rub;
 			*(tmp_ref_block_end - (++right_num)) = ref_idx;
+			++unsplit_num;
 		} else { // duplicate
 			left_node.aabb = lsb;
 			right_node.aabb = rsb;
@@ -489,6 +585,7 @@ PSSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 	if (left_num == 0 || right_num == 0)
 		return {};
 
+	get_stats().AddUnsplits(m_depth, unsplit_num);
 	return split_task_with_block(left_num, right_num, ref_block_size, tmp_ref_block, ref_block);
 }
 std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task>
@@ -506,74 +603,91 @@ PSSBVHBuilder::Task::_perform_spatial_split_parallel(const SpatialSplit &ss) {
 	}
 	RefBlockItem *tmp_ref_block_begin = tmp_ref_block, *tmp_ref_block_end = tmp_ref_block + ref_block_size;
 
-	std::atomic_uint32_t left_num{0}, right_num{0};
+	// Count the references each block sends to each side first, so every block writes to a fixed range and the
+	// output order does not depend on which thread takes which block
+	uint32_t block_size = m_p_builder->get_parallel_for_block_size(m_reference_count);
+	uint32_t block_count = (m_reference_count + block_size - 1) / block_size;
+	std::vector<uint32_t> left_offsets(block_count + 1, 0), right_offsets(block_count + 1, 0);
+
+	std::atomic_uint32_t count_counter{0};
+	auto count_func = [this, &ss, &count_counter, block_size, block_count, ref_begin, &left_offsets,
+	                   &right_offsets](uint32_t thread_idx) {
+		for (uint32_t cur_block = count_counter.fetch_add(1, std::memory_order_relaxed); cur_block < block_count;
+		     cur_block = count_counter.fetch_add(1, std::memory_order_relaxed)) {
+			uint32_t cur_first = cur_block * block_size,
+			         cur_last = std::min((cur_block + 1) * block_size, m_reference_count);
+			uint32_t local_left_num = 0, local_right_num = 0;
+			for (uint32_t cur = cur_first; cur < cur_last; ++cur) {
+				const auto &ref = access_reference(ref_begin[cur]);
+				const AABB &ref_aabb = get_aabb(ref);
+				bool left_only = ref_aabb.max[(int)ss.dim] <= ss.pos;
+				bool right_only = !left_only && ref_aabb.min[(int)ss.dim] >= ss.pos;
+				local_left_num += !right_only;
+				local_right_num += !left_only;
+			}
+			left_offsets[cur_block + 1] = local_left_num;
+			right_offsets[cur_block + 1] = local_right_num;
+		}
+	};
+	{
+		std::vector<std::future<void>> futures(get_worker_count() - 1);
+		for (uint32_t i = 1; i < get_worker_count(); ++i)
+			futures[i - 1] = get_thread_unit(i).Push(count_func, i);
+		count_func(0);
+		for (auto &f : futures)
+			f.wait();
+	}
+	for (uint32_t i = 0; i < block_count; ++i) {
+		left_offsets[i + 1] += left_offsets[i];
+		right_offsets[i + 1] += right_offsets[i];
+	}
+	uint32_t left_num = left_offsets[block_count], right_num = right_offsets[block_count];
+	if (left_num + right_num - m_reference_count > m_duplicate_budget)
+		return {};
 
-	uint32_t block_size = GetParallelForBlockSize(m_reference_count);
 	std::atomic_uint32_t counter{0};
-	auto left_right_spatial_split_func = [this, &ss, &counter, block_size, &left_num, &right_num, ref_begin,
-	                                      tmp_ref_block_begin, tmp_ref_block_end](uint32_t thread_idx) {
-		uint32_t local_left_refs[kLocalReferenceCount], local_right_refs[kLocalReferenceCount];
-		uint32_t local_left_num = 0, local_right_num = 0;
-
+	auto left_right_spatial_split_func = [this, &ss, &counter, block_size, block_count, ref_begin, &left_offsets,
+	                                      &right_offsets, tmp_ref_block_begin,
+	                                      tmp_ref_block_end](uint32_t thread_idx) {
 		std::pair<AABB, AABB> ret{};
 		AABB &left_aabb = ret.first;
 		AABB &right_aabb = ret.second;
 		left_aabb = {};
 		right_aabb = {};
 
-		for (uint32_t cur_block = counter.fetch_add(1, std::memory_order_relaxed);
-		     cur_block * block_size < m_reference_count; cur_block = counter.fetch_add(1, std::memory_order_relaxed)) {
+		for (uint32_t cur_block = counter.fetch_add(1, std::memory_order_relaxed); cur_block < block_count;
+		     cur_block = counter.fetch_add(1, std::memory_order_relaxed)) {
 			uint32_t cur_first = cur_block * block_size,
 			         cur_last = std::min((cur_block + 1) * block_size, m_reference_count);
+			uint32_t local_left_num = left_offsets[cur_block], local_right_num = right_offsets[cur_block];
 			for (uint32_t cur = cur_first; cur < cur_last; ++cur) {
 				uint32_t ref_idx = ref_begin[cur];
 				const auto &ref = access_reference(ref_idx);
-
-				if (local_left_num == kLocalReferenceCount) {
-					std::copy(local_left_refs, local_left_refs + local_left_num,
-					          tmp_ref_block_begin + left_num.fetch_add(local_left_num, std::memory_order_relaxed));
-					local_left_num = 0;
-				}
-				if (local_right_num == kLocalReferenceCount) {
-					std::copy(local_right_refs, local_right_refs + local_right_num,
-					          tmp_ref_block_end - right_num.fetch_add(local_right_num, std::memory_order_relaxed) -
-					              local_right_num);
-					local_right_num = 0;
-				}
-
-				if (ref.aabb.max[(int)ss.dim] <= ss.pos) {
-					left_aabb.Expand(ref.aabb);
-					local_left_refs[local_left_num++] = ref_idx;
-				} else if (ref.aabb.min[(int)ss.dim] >= ss.pos) {
-					right_aabb.Expand(ref.aabb);
-					local_right_refs[local_right_num++] = ref_idx;
+				const AABB &ref_aabb = get_aabb(ref);
+
+				if (ref_aabb.max[(int)ss.dim] <= ss.pos) {
+					left_aabb.Expand(ref_aabb);
+					tmp_ref_block_begin[local_left_num++] = ref_idx;
+				} else if (ref_aabb.min[(int)ss.dim] >= ss.pos) {
+					right_aabb.Expand(ref_aabb);
+					*(tmp_ref_block_end - (++local_right_num)) = ref_idx;
 				} else {
 					auto [left_ref, right_ref] = m_p_builder->split_reference(ref, ss.dim, ss.pos);
-					left_aabb.Expand(left_ref.aabb);
-					right_aabb.Expand(right_ref.aabb);
+					left_aabb.Expand(get_aabb(left_ref));
+					right_aabb.Expand(get_aabb(right_ref));
 
 					access_reference(ref_idx) = left_ref;
 					uint32_t right_ref_idx = new_reference(thread_idx);
 					access_reference(right_ref_idx) = right_ref;
-					local_left_refs[local_left_num++] = ref_idx;
-					local_right_refs[local_right_num++] = right_ref_idx;
+					tmp_ref_block_begin[local_left_num++] = ref_idx;
+					*(tmp_ref_block_end - (++local_right_num)) = right_ref_idx;
 				}
 			}
 		}
-
-		if (local_left_num > 0) {
-			std::copy(local_left_refs, local_left_refs + local_left_num,
-			          tmp_ref_block_begin + left_num.fetch_add(local_left_num, std::memory_order_relaxed));
-		}
-		if (local_right_num > 0) {
-			std::copy(local_right_refs, local_right_refs + local_right_num,
-			          tmp_ref_block_end - right_num.fetch_add(local_right_num, std::memory_order_relaxed) -
-			              local_right_num);
-		}
 		return ret;
 	};
-	std::vector<std::future<std::pair<AABB, AABB>>> futures(m_thread_count - 1);
-	for (uint32_t i = 1; i < m_thread_count; ++i)
+	std::vector<std::future<std::pair<AABB, AABB>>> futures(get_worker_count() - 1);
+	for (uint32_t i = 1; i < get_worker_count(); ++i)
 		futures[i - 1] = get_thread_unit(i).Push(left_right_spatial_split_func, i);
 	std::tie(left_node.aabb, right_node.aabb) = left_right_spatial_split_func(0);
 	// Merge AABBs
@@ -599,18 +713,18 @@ template <uint32_t DIM> void PSSBVHBuilder::Task::_find_object_split_sweep_dim(O
 
 	// Preprocess right_aabbs
 	AABB right_aabbs[kSweptObjectSplitThreshold];
-	right_aabbs[m_reference_count - 1] = access_reference(ref_begin[m_reference_count - 1]).aabb;
+	right_aabbs[m_reference_count - 1] = get_aabb(access_reference(ref_begin[m_reference_count - 1]));
 	for (int32_t i = (int32_t)m_reference_count - 2; i >= 1; --i)
-		right_aabbs[i] = AABB(access_reference(ref_begin[i]).aabb, right_aabbs[i + 1]);
+		right_aabbs[i] = AABB(get_aabb(access_reference(ref_begin[i])), right_aabbs[i + 1]);
 
 	// Find optimal object split
-	AABB left_aabb = access_reference(ref_begin[0]).aabb;
+	AABB left_aabb = get_aabb(access_reference(ref_begin[0]));
 	for (uint32_t i = 1; i < m_reference_count; ++i) {
 		float sah = float(i) * left_aabb.GetHalfArea() + float(m_reference_count - i) * right_aabbs[i].GetHalfArea();
 		if (sah < p_os->sah) {
 			p_os->dim = DIM;
-			p_os->pos = (access_reference(ref_begin[i - 1]).aabb.GetDimCenter<DIM>() +
-			             access_reference(ref_begin[i]).aabb.GetDimCenter<DIM>()) *
+			p_os->pos = (get_aabb(access_reference(ref_begin[i - 1])).GetDimCenter<DIM>() +
+			             get_aabb(access_reference(ref_begin[i])).GetDimCenter<DIM>()) *
 			            0.5f;
 			p_os->left_aabb = left_aabb;
 			p_os->right_aabb = right_aabbs[i];
@@ -618,19 +732,19 @@ template <uint32_t DIM> void PSSBVHBuilder::Task::_find_object_split_sweep_dim(O
 			p_os->bin_width = 0.0f;
 		}
 
-		left_aabb.Expand(access_reference(ref_begin[i]).aabb);
+		left_aabb.Expand(get_aabb(access_reference(ref_begin[i])));
 	}
 }
-template <uint32_t DIM> void PSSBVHBuilder::Task::_find_object_split_binned_dim(ObjectSplit *p_os) {
-	ObjectBin object_bins[kObjectBinNum];
-	AABB right_aabbs[kObjectBinNum];
+template <uint32_t BIN_NUM, uint32_t DIM> void PSSBVHBuilder::Task::_find_object_split_binned_dim(ObjectSplit *p_os) {
+	ObjectBin object_bins[BIN_NUM];
+	AABB right_aabbs[BIN_NUM];
 
 	auto ref_begin = get_reference_begin();
 
 	float bound_min = FLT_MAX, bound_max = -FLT_MAX;
 	for (uint32_t i = 0; i < m_reference_count; ++i) {
 		const auto &ref = access_reference(ref_begin[i]);
-		float c = ref.aabb.GetDimCenter<DIM>();
+		float c = get_aabb(ref).GetDimCenter<DIM>();
 		bound_max = std::max(bound_max, c);
 		bound_min = std::min(bound_min, c);
 	}
@@ -638,28 +752,29 @@ template <uint32_t DIM> void PSSBVHBuilder::Task::_find_object_split_binned_dim(
 	if (bound_min == bound_max)
 		return;
 
-	std::fill(object_bins, object_bins + kObjectBinNum, ObjectBin{AABB(), 0}); // initialize bins
-	const float bin_width = (bound_max - bound_min) / kObjectBinNum, inv_bin_width = 1.0f / bin_width;
+	std::fill(object_bins, object_bins + BIN_NUM, ObjectBin{AABB(), 0}); // initialize bins
+	const float bin_width = (bound_max - bound_min) / BIN_NUM, inv_bin_width = 1.0f / bin_width;
 	const float bin_base = bound_min; // m_node->aabb.min[DIM];
 
 	// Put references into bins according to centers
 	for (uint32_t i = 0; i < m_reference_count; ++i) {
 		const auto &ref = access_reference(ref_begin[i]);
+		const AABB &ref_aabb = get_aabb(ref);
 		uint32_t bin =
-		    glm::clamp(uint32_t((ref.aabb.GetDimCenter<DIM>() - bin_base) * inv_bin_width), 0u, kObjectBinNum - 1);
-		object_bins[bin].aabb.Expand(ref.aabb);
+		    glm::clamp(uint32_t((ref_aabb.GetDimCenter<DIM>() - bin_base) * inv_bin_width), 0u, BIN_NUM - 1);
+		object_bins[bin].aabb.Expand(ref_aabb);
 		++object_bins[bin].cnt;
 	}
 
 	// Compute the AABBs from right
-	right_aabbs[kObjectBinNum - 1] = object_bins[kObjectBinNum - 1].aabb;
-	for (int32_t i = kObjectBinNum - 2; i >= 1; --i)
+	right_aabbs[BIN_NUM - 1] = object_bins[BIN_NUM - 1].aabb;
+	for (int32_t i = BIN_NUM - 2; i >= 1; --i)
 		right_aabbs[i] = AABB(object_bins[i].aabb, right_aabbs[i + 1]);
 
 	// Find optimal object split
 	AABB left_aabb = object_bins[0].aabb;
 	uint32_t left_num = 0;
-	for (uint32_t i = 1; i < kObjectBinNum; ++i) {
+	for (uint32_t i = 1; i < BIN_NUM; ++i) {
 		left_num += object_bins[i - 1].cnt;
 		uint32_t right_num = m_reference_count - left_num;
 
@@ -676,10 +791,10 @@ template <uint32_t DIM> void PSSBVHBuilder::Task::_find_object_split_binned_dim(
 		left_aabb.Expand(object_bins[i].aabb);
 	}
 }
-void PSSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os) {
+template <uint32_t BIN_NUM> void PSSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os) {
 	auto ref_begin = get_reference_begin();
 
-	uint32_t block_size = GetParallelForBlockSize(m_reference_count);
+	uint32_t block_size = m_p_builder->get_parallel_for_block_size(m_reference_count);
 
 	AABB center_bound;
 	{ // Parallel compute center bound
@@ -694,7 +809,7 @@ void PSSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os)
 				         cur_last = std::min((cur_block + 1) * block_size, m_reference_count);
 				for (uint32_t cur = cur_first; cur < cur_last; ++cur) {
 					const auto &ref = access_reference(ref_begin[cur]);
-					ret.Expand(ref.aabb.GetCenter());
+					ret.Expand(get_aabb(ref).GetCenter());
 				}
 			}
 			return ret;
@@ -708,12 +823,12 @@ void PSSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os)
 	}
 
 	const glm::vec3 &bin_bases = center_bound.min;
-	const glm::vec3 bin_widths = center_bound.GetExtent() / (float)kObjectBinNum, inv_bin_widths = 1.0f / bin_widths;
+	const glm::vec3 bin_widths = center_bound.GetExtent() / (float)BIN_NUM, inv_bin_widths = 1.0f / bin_widths;
 
 	std::atomic_uint32_t counter{0};
 	auto compute_object_bins_func = [this, block_size, &counter, ref_begin, &bin_bases, &bin_widths,
 	                                 &inv_bin_widths](uint32_t thread_idx) {
-		std::array<std::array<ObjectBin, kObjectBinNum>, 3> ret{};
+		std::array<std::array<ObjectBin, BIN_NUM>, 3> ret{};
 
 		for (uint32_t cur_block = counter.fetch_add(1, std::memory_order_relaxed);
 		     cur_block * block_size < m_reference_count; cur_block = counter.fetch_add(1, std::memory_order_relaxed)) {
@@ -721,14 +836,15 @@ void PSSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os)
 			         cur_last = std::min((cur_block + 1) * block_size, m_reference_count);
 			for (uint32_t cur = cur_first; cur < cur_last; ++cur) {
 				const auto &ref = access_reference(ref_begin[cur]);
-				glm::u32vec3 bins = glm::clamp(glm::u32vec3((ref.aabb.GetCenter() - bin_bases) * inv_bin_widths), 0u,
-				                               kObjectBinNum - 1);
+				const AABB &ref_aabb = get_aabb(ref);
+				glm::u32vec3 bins = glm::clamp(glm::u32vec3((ref_aabb.GetCenter() - bin_bases) * inv_bin_widths), 0u,
+				                               BIN_NUM - 1);
 				for (int dim = 0; dim < 3; ++dim) {
 					auto &object_bins = ret[dim];
 					uint32_t bin = bins[dim];
 
 					++object_bins[bin].cnt;
-					object_bins[bin].aabb.Expand(ref.aabb);
+					object_bins[bin].aabb.Expand(ref_aabb);
 				}
 			}
 		}
@@ -736,7 +852,7 @@ void PSSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os)
 	};
 
 	// Async compute bins
-	std::vector<std::future<std::array<std::array<ObjectBin, kObjectBinNum>, 3>>> futures(m_thread_count - 1);
+	std::vector<std::future<std::array<std::array<ObjectBin, BIN_NUM>, 3>>> futures(m_thread_count - 1);
 	for (uint32_t i = 1; i < m_thread_count; ++i)
 		futures[i - 1] = get_thread_unit(i).Push(compute_object_bins_func, i);
 	auto bins = compute_object_bins_func(0);
@@ -745,7 +861,7 @@ void PSSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os)
 	for (auto &f : futures) {
 		auto r = f.get();
 		for (int dim = 0; dim < 3; ++dim) {
-			for (uint32_t x = 0; x < kObjectBinNum; ++x) {
+			for (uint32_t x = 0; x < BIN_NUM; ++x) {
 				auto &cl = bins[dim][x];
 				const auto &cr = r[dim][x];
 				cl.aabb.Expand(cr.aabb);
@@ -754,18 +870,18 @@ void PSSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os)
 		}
 	}
 
-	AABB right_aabbs[kObjectBinNum];
+	AABB right_aabbs[BIN_NUM];
 	for (int dim = 0; dim < 3; ++dim) {
 		const auto &dim_bins = bins[dim];
 
-		right_aabbs[kObjectBinNum - 1] = dim_bins[kObjectBinNum - 1].aabb;
-		for (int32_t i = kObjectBinNum - 2; i >= 1; --i)
+		right_aabbs[BIN_NUM - 1] = dim_bins[BIN_NUM - 1].aabb;
+		for (int32_t i = BIN_NUM - 2; i >= 1; --i)
 			right_aabbs[i] = AABB(dim_bins[i].aabb, right_aabbs[i + 1]);
 
 		// Find optimal object split
 		AABB left_aabb = dim_bins[0].aabb;
 		uint32_t left_num = 0;
-		for (uint32_t i = 1; i < kObjectBinNum; ++i) {
+		for (uint32_t i = 1; i < BIN_NUM; ++i) {
 			left_num += dim_bins[i - 1].cnt;
 			uint32_t right_num = m_reference_count - left_num;
 
@@ -784,16 +900,20 @@ void PSSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os)
 	}
 }
 PSSBVHBuilder::Task::ObjectSplit PSSBVHBuilder::Task::find_object_split() {
+	BuildTrace::Scope trace{trace_name("object_binning"), m_reference_count, m_depth};
 	ObjectSplit os{};
 	os.left_aabb = os.right_aabb = access_node(m_node_index).aabb;
-	if (m_reference_count >= kObjectBinNum) {
-		if (m_thread_count > 1)
-			_find_object_split_binned_parallel(&os);
-		else {
-			_find_object_split_binned_dim<0>(&os);
-			_find_object_split_binned_dim<1>(&os);
-			_find_object_split_binned_dim<2>(&os);
-		}
+	if (m_reference_count >= kSweptObjectSplitThreshold) {
+		BVHConfig::VisitBinCount(get_bin_count(), [this, &os](auto bin_num) {
+			constexpr uint32_t kBinNum = decltype(bin_num)::value;
+			if (m_thread_count > 1)
+				_find_object_split_binned_parallel<kBinNum>(&os);
+			else {
+				_find_object_split_binned_dim<kBinNum, 0>(&os);
+				_find_object_split_binned_dim<kBinNum, 1>(&os);
+				_find_object_split_binned_dim<kBinNum, 2>(&os);
+			}
+		});
 	}
 	// Fallback to sweep SAH if failed
 	if (os.sah == FLT_MAX && m_reference_count <= kSweptObjectSplitThreshold) {
@@ -804,6 +924,7 @@ PSSBVHBuilder::Task::ObjectSplit PSSBVHBuilder::Task::find_object_split() {
 	return os;
 }
 std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task> PSSBVHBuilder::Task::perform_object_split(const ObjectSplit &os) {
+	BuildTrace::Scope trace{trace_name("object_partition"), m_reference_count, m_depth};
 	return _perform_object_split(os);
 	return m_thread_count > 1 ? _perform_object_split_parallel(os) : _perform_object_split(os);
 }
@@ -822,12 +943,13 @@ std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task> PSSBVHBuilder::Task::_perfo
 	for (uint32_t i = 0; i < m_reference_count; ++i) {
 		uint32_t ref_idx = ref_begin[i];
 		const auto &ref = access_reference(ref_idx);
-		float c = ref.aabb.GetDimCenter((int)os.dim);
+		const AABB &ref_aabb = get_aabb(ref);
+		float c = ref_aabb.GetDimCenter((int)os.dim);
 		if (c < os.pos - delta) {
-			left_node.aabb.Expand(ref.aabb);
+			left_node.aabb.Expand(ref_aabb);
 			tmp_ref_block_begin[left_num++] = ref_idx;
 		} else if (c > os.pos + delta) {
-			right_node.aabb.Expand(ref.aabb);
+			right_node.aabb.Expand(ref_aabb);
 			*(tmp_ref_block_end - (++right_num)) = ref_idx;
 		} else
 			std::swap(ref_begin[i], ref_begin[tbd_num++]);
@@ -839,9 +961,10 @@ std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task> PSSBVHBuilder::Task::_perfo
 	for (uint32_t i = 0; i < tbd_num; ++i) {
 		uint32_t ref_idx = ref_begin[i];
 		const auto &ref = access_reference(ref_idx);
+		const AABB &ref_aabb = get_aabb(ref);
 
-		AABB lb = AABB{left_node.aabb, ref.aabb};
-		AABB rb = AABB{right_node.aabb, ref.aabb};
+		AABB lb = AABB{left_node.aabb, ref_aabb};
+		AABB rb = AABB{right_node.aabb, ref_aabb};
 		float left_sah = lb.GetHalfArea() * float(1 + left_num) + right_node.aabb.GetHalfArea() * float(right_num);
 		float right_sah = left_node.aabb.GetHalfArea() * float(left_num) + rb.GetHalfArea() * float(1 + right_num);
 
@@ -869,7 +992,7 @@ PSSBVHBuilder::Task::_perform_object_split_parallel(const ObjectSplit &os) {
 
 	std::atomic_uint32_t left_num{0}, right_num{0};
 
-	uint32_t block_size = GetParallelForBlockSize(m_reference_count);
+	uint32_t block_size = m_p_builder->get_parallel_for_block_size(m_reference_count);
 	std::atomic_uint32_t counter{0};
 	auto object_split_func = [this, &os, block_size, &counter, &left_num, &right_num, ref_begin, tmp_ref_block_begin,
 	                          tmp_ref_block_end](uint32_t thread_idx) {
@@ -901,12 +1024,13 @@ PSSBVHBuilder::Task::_perform_object_split_parallel(const ObjectSplit &os) {
 
 				uint32_t ref_idx = ref_begin[cur];
 				const auto &ref = access_reference(ref_idx);
-				float c = ref.aabb.GetDimCenter((int)os.dim);
+				const AABB &ref_aabb = get_aabb(ref);
+				float c = ref_aabb.GetDimCenter((int)os.dim);
 				if (c < os.pos) {
-					left_aabb.Expand(ref.aabb);
+					left_aabb.Expand(ref_aabb);
 					local_left_refs[local_left_num++] = ref_idx;
 				} else {
-					right_aabb.Expand(ref.aabb);
+					right_aabb.Expand(ref_aabb);
 					local_right_refs[local_right_num++] = ref_idx;
 				}
 			}
@@ -939,18 +1063,34 @@ PSSBVHBuilder::Task::_perform_object_split_parallel(const ObjectSplit &os) {
 	return split_task(left_num, right_num, true);
 }
 
+std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task> PSSBVHBuilder::Task::perform_median_split() {
+	{
+		BuildTrace::Scope trace{trace_name("median_partition"), m_reference_count, m_depth};
+		auto ref_begin = get_reference_begin();
+		AABB center_bound{};
+		for (uint32_t i = 0; i < m_reference_count; ++i)
+			center_bound.Expand(get_aabb(access_reference(ref_begin[i])).GetCenter());
+		glm::vec3 extent = center_bound.GetExtent();
+		uint32_t dim = extent.x >= extent.y ? (extent.x >= extent.z ? 0 : 2) : (extent.y >= extent.z ? 1 : 2);
+		SelectMedianReference(m_p_builder->m_reference_codec, m_p_builder->m_reference_pool, ref_begin,
+		                      ref_begin + m_reference_count, dim);
+	}
+	return perform_default_split();
+}
+
 std::tuple<PSSBVHBuilder::Task, PSSBVHBuilder::Task> PSSBVHBuilder::Task::perform_default_split() {
+	BuildTrace::Scope trace{trace_name("default_partition"), m_reference_count, m_depth};
 	auto [left_node, right_node] = maintain_child_nodes();
 
 	uint32_t left_num = m_reference_count >> 1u, right_num = m_reference_count - left_num;
 	auto ref_begin = get_reference_begin();
-	left_node.aabb = access_reference(ref_begin[0]).aabb;
+	left_node.aabb = get_aabb(access_reference(ref_begin[0]));
 	for (uint32_t i = 1; i < left_num; ++i)
-		left_node.aabb.Expand(access_reference(ref_begin[i]).aabb);
+		left_node.aabb.Expand(get_aabb(access_reference(ref_begin[i])));
 
-	right_node.aabb = access_reference(ref_begin[left_num]).aabb;
+	right_node.aabb = get_aabb(access_reference(ref_begin[left_num]));
 	for (uint32_t i = left_num + 1; i < m_reference_count; ++i)
-		right_node.aabb.Expand(access_reference(ref_begin[i]).aabb);
+		right_node.aabb.Expand(get_aabb(access_reference(ref_begin[i])));
 
 	if (m_reference_alignment == kAlignLeft) {
 		std::copy(ref_begin + left_num, ref_begin + m_reference_count,
@@ -1,5 +1,6 @@
 #include "ParallelSBVHBuilder.hpp"
 
+#include "Presplit.hpp"
 #include <iterator>
 #include <pdqsort.h>
 #include <queue>
@@ -12,55 +13,224 @@ void ParallelSBVHBuilder::Run() {
 	m_consumer_tokens.reserve(kThreadCount);
 	m_producer_tokens.reserve(kThreadCount);
 	m_thread_node_allocators.reserve(kThreadCount);
+	m_thread_tri_index_allocators.reserve(kThreadCount);
 	m_thread_reference_allocators.reserve(kThreadCount);
+	m_thread_reference_arenas.reserve(kThreadCount);
+	m_thread_stats.resize(kThreadCount);
 	// m_thread_tmp_references.resize(kThreadCount);
 	for (uint32_t i = 0; i < kThreadCount; ++i) {
 		m_consumer_tokens.emplace_back(m_task_queue);
 		m_producer_tokens.emplace_back(m_task_queue);
 		m_thread_node_allocators.emplace_back(m_bvh.m_node_pool);
+		m_thread_tri_index_allocators.emplace_back(m_bvh.m_tri_index_pool);
 		m_thread_reference_allocators.emplace_back(m_reference_pool);
+		m_thread_reference_arenas.emplace_back(m_reference_list_pool);
 	}
 
-	spdlog::info("Begin, threshold = {}", kLocalRunThreshold);
+	// with NUMA placement every thread stays on its CPU for the build, and the allocators touch their chunks first
+	// on the thread that uses them, which puts them on its node
+	std::optional<NumaTopology::ThreadPin> thread_pin;
+	if (m_p_numa) {
+		thread_pin.emplace(*m_p_numa, 0);
+		std::vector<std::future<bool>> futures;
+		for (uint32_t t = 1; t < kThreadCount; ++t)
+			futures.push_back(m_thread_group[t - 1].Push([this, t] { return m_p_numa->PinThread(t); }));
+		uint32_t pinned_count = thread_pin->IsPinned();
+		for (auto &future : futures)
+			pinned_count += future.get();
+		spdlog::info("NUMA: {} of {} threads pinned", pinned_count, kThreadCount);
+	}
+
+	m_budget.Start();
+	spdlog::info("Begin, local runs below {:.0f} us, blocks of {} references",
+	             m_config.m_tuning.m_local_run_work_ns * 1e-3f, m_config.m_tuning.m_parallel_for_block_size);
 	auto begin = std::chrono::steady_clock::now();
-	make_root_task().BlockRun();
+	{
+		BuildTrace::Scope trace{"parallel_sbvh_build", (uint32_t)m_scene.GetTriangles().size()};
+		if (m_config.m_builder == BVHConfig::kShapeSBVH && m_scene.GetShapeBegins().size() > 1)
+			run_shape_tasks();
+		else
+			make_root_task().BlockRun();
+	}
 	spdlog::info(
 	    "End {} ms",
 	    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count());
 
 	m_bvh.m_leaf_cnt = m_leaf_count;
+	m_bvh.m_build_stats.m_triangle_count = m_scene.GetTriangles().size();
+	for (const auto &stats : m_thread_stats)
+		m_bvh.m_build_stats.Merge(stats);
+	for (const auto &arena : m_thread_reference_arenas) {
+		m_bvh.m_build_stats.m_reference_list_allocs += arena.GetAllocCount();
+		m_bvh.m_build_stats.m_reference_list_reuses += arena.GetReuseCount();
+	}
+	m_bvh.m_build_stats.m_reference_list_chunks = m_reference_list_pool.GetChunkCount();
+}
+
+ReferenceList ParallelSBVHBuilder::make_references() {
+	std::vector<Presplit::Reference> presplit_refs = Presplit::Run(m_scene, m_config.m_presplit_threshold);
+	ReferenceList references = m_thread_reference_arenas[0].Alloc(0, presplit_refs.size());
+	for (const auto &presplit_ref : presplit_refs) {
+		uint32_t ref_idx = m_thread_reference_allocators[0].Alloc();
+		auto &ref = m_reference_pool[ref_idx];
+		ref.tri_idx = presplit_ref.tri_idx;
+		m_reference_codec.SetAABB(&ref, presplit_ref.aabb);
+		references.push_back(ref_idx);
+	}
+	m_bvh.m_build_stats.m_presplit_references = references.size() - m_scene.GetTriangles().size();
+	return references;
 }
 
 ParallelSBVHBuilder::Task ParallelSBVHBuilder::make_root_task() {
 	uint32_t root_idx = m_thread_node_allocators[0].Alloc();
 	assert(root_idx == 0);
 	m_node_pool[root_idx].aabb = m_scene.GetAABB();
-	std::vector<uint32_t> references;
+	ReferenceList references = make_references();
+	const auto triangle_count = (uint32_t)m_scene.GetTriangles().size();
+	const auto reference_count = (uint32_t)references.size();
+	Task task{this, root_idx, std::move(references), 0, 0, kThreadCount};
+	task.SetDuplicateBudget(m_config.GetDuplicateBudget(triangle_count, reference_count));
+	return task;
+}
+
+void ParallelSBVHBuilder::make_shape_tree(Shape *first, Shape *last, uint32_t node_idx, uint32_t depth,
+                                          std::vector<Task> *p_parallel_tasks, std::vector<Task> *p_batch_tasks) {
+	if (last - first == 1) {
+		m_node_pool[node_idx].aabb = first->aabb;
+		auto ref_count = (uint32_t)first->references.size();
+		Task task{this, node_idx,
+		          m_thread_reference_arenas[0].Alloc(first->references.data(), first->references.data() + ref_count),
+		          depth, 0, first->parallel ? kThreadCount : 0};
+		task.SetDuplicateBudget(m_config.GetDuplicateBudget(first->tri_count, ref_count));
+		(first->parallel ? p_parallel_tasks : p_batch_tasks)->push_back(std::move(task));
+		return;
+	}
+
+	AABB aabb;
+	for (const Shape *shape = first; shape != last; ++shape)
+		aabb.Expand(shape->aabb);
+	m_node_pool[node_idx].aabb = aabb;
+
+	// sweep the shapes sorted by centroid on every axis, weighted by their reference counts
+	const auto count = uint32_t(last - first);
+	std::vector<float> right_sah(count);
+	float min_sah = FLT_MAX;
+	uint32_t split_dim = 0, split_idx = count / 2;
+	for (uint32_t dim = 0; dim < 3; ++dim) {
+		std::sort(first, last, [dim](const Shape &l, const Shape &r) {
+			return l.aabb.GetDimCenter(dim) < r.aabb.GetDimCenter(dim);
+		});
+		AABB right_aabb;
+		uint32_t right_ref_count = 0;
+		for (uint32_t i = count - 1; i > 0; --i) {
+			right_aabb.Expand(first[i].aabb);
+			right_ref_count += first[i].references.size();
+			right_sah[i] = right_aabb.GetHalfArea() * float(right_ref_count);
+		}
+		AABB left_aabb;
+		uint32_t left_ref_count = 0;
+		for (uint32_t i = 1; i < count; ++i) {
+			left_aabb.Expand(first[i - 1].aabb);
+			left_ref_count += first[i - 1].references.size();
+			float sah = left_aabb.GetHalfArea() * float(left_ref_count) + right_sah[i];
+			if (sah < min_sah) {
+				min_sah = sah;
+				split_dim = dim;
+				split_idx = i;
+			}
+		}
+	}
+	if (split_dim != 2)
+		std::sort(first, last, [split_dim](const Shape &l, const Shape &r) {
+			return l.aabb.GetDimCenter(split_dim) < r.aabb.GetDimCenter(split_dim);
+		});
+
+	auto &node = m_node_pool[node_idx];
+	node.left = m_thread_node_allocators[0].Alloc();
+	node.right = m_thread_node_allocators[0].Alloc();
+	m_thread_stats[0].AddSplit(BuildStats::kObjectSplit, depth);
+	make_shape_tree(first, first + split_idx, node.left, depth + 1, p_parallel_tasks, p_batch_tasks);
+	make_shape_tree(first + split_idx, last, node.right, depth + 1, p_parallel_tasks, p_batch_tasks);
+}
+
+void ParallelSBVHBuilder::run_shape_tasks() {
+	uint32_t root_idx = m_thread_node_allocators[0].Alloc();
+	assert(root_idx == 0);
+
+	// the references come in triangle order, so every shape is a range of them
+	std::vector<Task> parallel_tasks, batch_tasks;
 	{
-		references.reserve(m_scene.GetTriangles().size());
-		for (uint32_t i = 0; i < m_scene.GetTriangles().size(); ++i) {
-			uint32_t ref_idx = m_thread_reference_allocators[0].Alloc();
-			auto &ref = m_reference_pool[ref_idx];
-			ref.tri_idx = i;
-			ref.aabb = m_scene.GetTriangles()[i].GetAABB();
-			references.push_back(ref_idx);
+		ReferenceList references = make_references();
+		const auto &shape_begins = m_scene.GetShapeBegins();
+		const auto triangle_count = (uint32_t)m_scene.GetTriangles().size();
+		std::vector<Shape> shapes(shape_begins.size());
+		for (uint32_t s = 0, r = 0; s < shape_begins.size(); ++s) {
+			uint32_t shape_end = s + 1 < shape_begins.size() ? shape_begins[s + 1] : triangle_count;
+			shapes[s].tri_count = shape_end - shape_begins[s];
+			for (; r < references.size() && m_reference_pool[references[r]].tri_idx < shape_end; ++r) {
+				shapes[s].aabb.Expand(get_aabb(m_reference_pool[references[r]]));
+				shapes[s].references.push_back(references[r]);
+			}
+			shapes[s].parallel = uint64_t(shapes[s].references.size()) * kThreadCount > references.size();
 		}
+		m_thread_reference_arenas[0].Release(&references);
+		make_shape_tree(shapes.data(), shapes.data() + shapes.size(), root_idx, 0, &parallel_tasks, &batch_tasks);
+	}
+	spdlog::info("{} shapes, {} built on all threads", parallel_tasks.size() + batch_tasks.size(),
+	             parallel_tasks.size());
+
+	for (Task &task : parallel_tasks)
+		task.BlockRun();
+	if (batch_tasks.empty())
+		return;
+
+	m_task_count += batch_tasks.size();
+	for (Task &task : batch_tasks)
+		m_task_queue.enqueue(m_producer_tokens[0], std::move(task));
+	std::vector<Task> workers;
+	workers.reserve(kThreadCount);
+	std::vector<std::future<void>> futures;
+	for (uint32_t t = 0; t < kThreadCount; ++t) {
+		workers.emplace_back(this, 0, ReferenceList{}, 0, t, 1);
+		if (t)
+			futures.push_back(m_thread_group[t - 1].Push(&Task::PoolRun, &workers[t]));
 	}
-	return Task{this, root_idx, std::move(references), 0, 0, kThreadCount};
+	workers[0].PoolRun();
+	for (auto &future : futures)
+		future.wait();
 }
 
 std::tuple<ParallelSBVHBuilder::Task, ParallelSBVHBuilder::Task> ParallelSBVHBuilder::Task::Run() {
+	const uint32_t ref_count = (uint32_t)m_references.size();
+	BuildTrace::Scope trace{trace_name("task"), ref_count, m_depth};
+	if (m_p_builder->m_budget.IsExceeded()) {
+		if (ref_count <= BVHConfig::kMaxLeafTriangles) {
+			get_stats().AddMedianLeaf(m_depth);
+			make_leaf();
+			return {};
+		}
+		trace.SetSplit(BuildTrace::kMedianSplit);
+		get_stats().AddSplit(BuildStats::kMedianSplit, m_depth);
+		return pass_duplicate_budget(perform_median_split(), 0);
+	}
 	if (m_references.size() == 1) {
 		make_leaf();
 		return {};
 	}
 
 	ObjectSplit object_split = find_object_split();
-	if (object_split.sah == FLT_MAX)
-		return perform_default_split();
+	if (m_p_builder->m_config.IsLeafCheaper(ref_count, access_node(m_node_idx).aabb.GetHalfArea(), object_split.sah)) {
+		make_leaf();
+		return {};
+	}
+	if (object_split.sah == FLT_MAX) {
+		trace.SetSplit(BuildTrace::kDefaultSplit);
+		get_stats().AddSplit(BuildStats::kDefaultSplit, m_depth);
+		return pass_duplicate_budget(perform_default_split(), 0);
+	}
 
 	SpatialSplit spatial_split{};
-	if (m_depth <= m_p_builder->m_config.m_max_spatial_depth) {
+	if (m_depth <= m_p_builder->m_config.m_max_spatial_depth && m_duplicate_budget) {
 		AABB overlap = object_split.left_aabb;
 		overlap.IntersectAABB(object_split.right_aabb);
 		if (overlap.GetHalfArea() >= m_p_builder->m_min_overlap_area)
@@ -68,15 +238,25 @@ std::tuple<ParallelSBVHBuilder::Task, ParallelSBVHBuilder::Task> ParallelSBVHBui
 	}
 	if (spatial_split.sah < object_split.sah) {
 		auto ret = perform_spatial_split(spatial_split);
-		if (!PairEmpty(ret))
-			return ret;
+		if (!PairEmpty(ret)) {
+			trace.SetSplit(BuildTrace::kSpatialSplit);
+			get_stats().AddSplit(BuildStats::kSpatialSplit, m_depth);
+			uint32_t child_ref_count = std::get<0>(ret).m_references.size() + std::get<1>(ret).m_references.size();
+			get_stats().AddDuplicates(m_depth, child_ref_count - ref_count);
+			return pass_duplicate_budget(std::move(ret), child_ref_count - ref_count);
+		}
 	}
 	{
 		auto ret = perform_object_split(object_split);
-		if (!PairEmpty(ret))
-			return ret;
+		if (!PairEmpty(ret)) {
+			trace.SetSplit(BuildTrace::kObjectSplit);
+			get_stats().AddSplit(BuildStats::kObjectSplit, m_depth);
+			return pass_duplicate_budget(std::move(ret), 0);
+		}
 	}
-	return perform_default_split();
+	trace.SetSplit(BuildTrace::kDefaultSplit);
+	get_stats().AddSplit(BuildStats::kDefaultSplit, m_depth);
+	return pass_duplicate_budget(perform_default_split(), 0);
 }
 
 void ParallelSBVHBuilder::Task::BlockRun() {
@@ -94,8 +274,9 @@ void ParallelSBVHBuilder::Task::BlockRun() {
 			left_task.BlockRun();
 		} else {
 			// Subdivide the thread
-			auto future = right_task.AsyncRun();
+			auto future = right_task.AsyncRun(m_thread);
 			left_task.BlockRun();
+			BuildTrace::Scope trace{"wait", (uint32_t)m_references.size(), m_depth};
 			future.wait();
 		}
 	} else if (m_thread_count == 1) {
@@ -106,32 +287,66 @@ void ParallelSBVHBuilder::Task::BlockRun() {
 			m_p_builder->m_task_queue.enqueue(get_queue_producer_token(), std::move(right_task));
 		}
 
-		Task task;
-		while (m_p_builder->m_task_count.load()) {
-			if (m_p_builder->m_task_queue.try_dequeue(get_queue_consumer_token(), task)) {
-				task.assign_to_thread(m_thread);
+		PoolRun();
+	}
+}
 
-				if (task.m_references.size() <= kLocalRunThreshold) {
-					task.LocalRun();
+void ParallelSBVHBuilder::Task::PoolRun() {
+	Task task;
+	uint64_t idle_begin_ns = 0; // start of the current run of empty dequeues, traced as "idle"
+	while (m_p_builder->m_task_count.load()) {
+		if (m_p_builder->m_task_queue.try_dequeue(get_queue_consumer_token(), task)) {
+			if (idle_begin_ns) {
+				BuildTrace::Record({"idle", idle_begin_ns, BuildTrace::Now(), 0, m_depth, BuildTrace::kNoSplit});
+				idle_begin_ns = 0;
+			}
+			task.assign_to_thread(m_thread);
+
+			if (task.is_local()) {
+				BuildTrace::Scope trace{"local_run", (uint32_t)task.m_references.size(), task.m_depth};
+				task.LocalRun();
+				--m_p_builder->m_task_count;
+			} else {
+				auto new_tasks = task.Run();
+				if (Task::PairEmpty(new_tasks)) {
 					--m_p_builder->m_task_count;
 				} else {
-					auto new_tasks = task.Run();
-					if (Task::PairEmpty(new_tasks)) {
-						--m_p_builder->m_task_count;
-					} else {
-						++m_p_builder->m_task_count;
-						m_p_builder->m_task_queue.enqueue(get_queue_producer_token(),
-						                                  std::move(std::get<1>(new_tasks)));
-						m_p_builder->m_task_queue.enqueue(get_queue_producer_token(),
-						                                  std::move(std::get<0>(new_tasks)));
-					}
+					++m_p_builder->m_task_count;
+					m_p_builder->m_task_queue.enqueue(get_queue_producer_token(),
+					                                  std::move(std::get<1>(new_tasks)));
+					m_p_builder->m_task_queue.enqueue(get_queue_producer_token(),
+					                                  std::move(std::get<0>(new_tasks)));
 				}
 			}
-		}
+		} else if (!idle_begin_ns && BuildTrace::IsEnabled())
+			idle_begin_ns = BuildTrace::Now();
 	}
+	if (idle_begin_ns)
+		BuildTrace::Record({"idle", idle_begin_ns, BuildTrace::Now(), 0, m_depth, BuildTrace::kNoSplit});
 }
 
-std::future<void> ParallelSBVHBuilder::Task::AsyncRun() { return get_thread_unit(0).Push(&Task::BlockRun, this); }
+std::future<void> ParallelSBVHBuilder::Task::AsyncRun(uint32_t parent_thread) {
+	return get_thread_unit(0).Push([this, parent_thread] {
+		localize_references(parent_thread);
+		BlockRun();
+	});
+}
+
+void ParallelSBVHBuilder::Task::localize_references(uint32_t parent_thread) {
+	const NumaTopology *p_numa = m_p_builder->m_p_numa;
+	if (!p_numa || p_numa->GetThreadNode(m_thread) == p_numa->GetThreadNode(parent_thread))
+		return;
+	BuildTrace::Scope trace{"localize_references", (uint32_t)m_references.size(), m_depth};
+	// the old records and range stay unused until the build ends, reusing them here would hand remote memory back out
+	ReferenceList references = get_reference_arena().Alloc(0, m_references.size());
+	for (uint32_t ref_idx : m_references) {
+		uint32_t local_ref_idx = new_reference();
+		access_reference(local_ref_idx) = access_reference(ref_idx);
+		references.push_back(local_ref_idx);
+	}
+	std::exchange(m_references, std::move(references));
+	get_stats().m_localized_references += m_references.size();
+}
 
 void ParallelSBVHBuilder::Task::LocalRun() {
 	auto new_tasks = Run();
@@ -143,7 +358,7 @@ void ParallelSBVHBuilder::Task::LocalRun() {
 
 template <uint32_t DIM, typename Iter> void ParallelSBVHBuilder::sort_references(Iter first_ref, Iter last_ref) {
 	pdqsort_branchless(first_ref, last_ref, [this](uint32_t l, uint32_t r) {
-		return m_reference_pool[l].aabb.GetDimCenter<DIM>() < m_reference_pool[r].aabb.GetDimCenter<DIM>();
+		return m_reference_codec.IsCenterLess<DIM>(m_reference_pool[l], m_reference_pool[r]);
 	});
 }
 template <typename Iter> void ParallelSBVHBuilder::sort_references(Iter first_ref, Iter last_ref, uint32_t dim) {
@@ -151,34 +366,42 @@ template <typename Iter> void ParallelSBVHBuilder::sort_references(Iter first_re
 	         : (dim == 1 ? sort_references<1>(first_ref, last_ref) : sort_references<2>(first_ref, last_ref));
 }
 
-std::tuple<ParallelSBVHBuilder::Reference, ParallelSBVHBuilder::Reference>
-ParallelSBVHBuilder::split_reference(const ParallelSBVHBuilder::Reference &ref, uint32_t dim, float pos) const {
-	Reference left, right;
-	left.aabb = right.aabb = AABB();
-	left.tri_idx = right.tri_idx = ref.tri_idx;
+std::tuple<AABB, AABB> ParallelSBVHBuilder::split_aabb(uint32_t tri_idx, const AABB &aabb, uint32_t dim,
+                                                       float pos) const {
+	AABB left_aabb, right_aabb;
 
-	const Triangle &tri = m_scene.GetTriangles()[ref.tri_idx];
+	const Triangle &tri = m_scene.GetTriangles()[tri_idx];
 	for (uint32_t i = 0; i < 3; ++i) {
 		const glm::vec3 &v0 = tri.positions[i], &v1 = tri.positions[(i + 1) % 3];
 		float p0 = v0[(int)dim], p1 = v1[(int)dim];
 		if (p0 <= pos)
-			left.aabb.Expand(v0);
+			left_aabb.Expand(v0);
 		if (p0 >= pos)
-			right.aabb.Expand(v0);
+			right_aabb.Expand(v0);
 
 		if ((p0 < pos && pos < p1) || (p1 < pos && pos < p0)) { // Edges
 			glm::vec3 x = glm::mix(v0, v1, glm::clamp((pos - p0) / (p1 - p0), 0.0f, 1.0f));
-			left.aabb.Expand(x);
-			right.aabb.Expand(x);
+			left_aabb.Expand(x);
+			right_aabb.Expand(x);
 		}
 	}
 
-	left.aabb.max[(int)dim] = pos;
-	left.aabb.IntersectAABB(ref.aabb);
+	left_aabb.max[(int)dim] = pos;
+	left_aabb.IntersectAABB(aabb);
+
+	right_aabb.min[(int)dim] = pos;
+	right_aabb.IntersectAABB(aabb);
 
-	right.aabb.min[(int)dim] = pos;
-	right.aabb.IntersectAABB(ref.aabb);
+	return {left_aabb, right_aabb};
+}
 
+std::tuple<ParallelSBVHBuilder::Reference, ParallelSBVHBuilder::Reference>
+ParallelSBVHBuilder::split_reference(const ParallelSBVHBuilder::Reference &ref, uint32_t dim, float pos) const {
+	auto [left_aabb, right_aabb] = split_aabb(ref.tri_idx, get_aabb(ref), dim, pos);
+	Reference left, right;
+	left.tri_idx = right.tri_idx = ref.tri_idx;
+	m_reference_codec.SetAABB(&left, left_aabb, ref);
+	m_reference_codec.SetAABB(&right, right_aabb, ref);
 	return {left, right};
 }
 
@@ -186,50 +409,54 @@ std::tuple<uint32_t, uint32_t> ParallelSBVHBuilder::Task::get_child_thread_count
                                                                                   uint32_t right_ref_count) const {
 	if (m_thread_count == 0)
 		return {0u, 0u};
-	auto lt = (float)left_ref_count, tt = float(left_ref_count + right_ref_count);
+	// in proportion to the estimated work of the children, which is not that of their reference counts
+	auto lt = get_work(left_ref_count, m_depth + 1), tt = lt + get_work(right_ref_count, m_depth + 1);
 	auto lc = std::clamp(uint32_t(glm::round(lt / tt * float(m_thread_count))), 0u, m_thread_count);
+	if (m_p_builder->m_p_numa)
+		lc = m_p_builder->m_p_numa->AlignThreadSplit(m_thread, m_thread_count, lc);
 	return {lc, m_thread_count - lc};
 }
 /*
  Spatial split
  */
-template <uint32_t DIM> void ParallelSBVHBuilder::Task::_find_spatial_split_dim(SpatialSplit *p_ss) {
-	SpatialBin spatial_bins[kSpatialBinNum];
-	AABB right_aabbs[kSpatialBinNum];
+template <uint32_t BIN_NUM, uint32_t DIM> void ParallelSBVHBuilder::Task::_find_spatial_split_dim(SpatialSplit *p_ss) {
+	SpatialBin spatial_bins[BIN_NUM];
+	AABB right_aabbs[BIN_NUM];
 
-	std::fill(spatial_bins, spatial_bins + kSpatialBinNum, SpatialBin{AABB(), 0, 0}); // initialize bins
+	std::fill(spatial_bins, spatial_bins + BIN_NUM, SpatialBin{AABB(), 0, 0}); // initialize bins
 	auto &node = access_node(m_node_idx);
-	const float bin_width = node.aabb.GetExtent()[DIM] / kSpatialBinNum, inv_bin_width = 1.0f / bin_width;
+	const float bin_width = node.aabb.GetExtent()[DIM] / BIN_NUM, inv_bin_width = 1.0f / bin_width;
 	const float bound_base = node.aabb.min[DIM];
 
 	// Put references into bins
 	for (uint32_t ref_idx : m_references) {
 		const auto &ref = access_reference(ref_idx);
-		uint32_t bin = glm::clamp(uint32_t((ref.aabb.min[DIM] - bound_base) * inv_bin_width), 0u, kSpatialBinNum - 1);
+		const AABB &ref_aabb = get_aabb(ref);
+		uint32_t bin = glm::clamp(uint32_t((ref_aabb.min[DIM] - bound_base) * inv_bin_width), 0u, BIN_NUM - 1);
 		uint32_t last_bin =
-		    glm::clamp(uint32_t((ref.aabb.max[DIM] - bound_base) * inv_bin_width), 0u, kSpatialBinNum - 1);
+		    glm::clamp(uint32_t((ref_aabb.max[DIM] - bound_base) * inv_bin_width), 0u, BIN_NUM - 1);
 
 		spatial_bins[bin].in++;
-		Reference cur_ref = ref;
+		AABB cur_aabb = ref_aabb;
 		for (; bin < last_bin; ++bin) {
-			auto [left_ref, right_ref] =
-			    m_p_builder->split_reference(cur_ref, DIM, float(bin + 1) * bin_width + bound_base);
-			spatial_bins[bin].aabb.Expand(left_ref.aabb);
-			cur_ref = right_ref;
+			auto [left_aabb, right_aabb] =
+			    m_p_builder->split_aabb(ref.tri_idx, cur_aabb, DIM, float(bin + 1) * bin_width + bound_base);
+			spatial_bins[bin].aabb.Expand(left_aabb);
+			cur_aabb = right_aabb;
 		}
-		spatial_bins[last_bin].aabb.Expand(cur_ref.aabb);
+		spatial_bins[last_bin].aabb.Expand(cur_aabb);
 		spatial_bins[last_bin].out++;
 	}
 
 	// Compute the AABBs from right
-	right_aabbs[kSpatialBinNum - 1] = spatial_bins[kSpatialBinNum - 1].aabb;
-	for (int32_t i = kSpatialBinNum - 2; i >= 1; --i)
+	right_aabbs[BIN_NUM - 1] = spatial_bins[BIN_NUM - 1].aabb;
+	for (int32_t i = BIN_NUM - 2; i >= 1; --i)
 		right_aabbs[i] = AABB(spatial_bins[i].aabb, right_aabbs[i + 1]);
 
 	// Find optimal spatial split
 	AABB left_aabb = spatial_bins[0].aabb;
 	uint32_t left_num = 0, right_num = m_references.size();
-	for (uint32_t i = 1; i < kSpatialBinNum; ++i) {
+	for (uint32_t i = 1; i < BIN_NUM; ++i) {
 		left_num += spatial_bins[i - 1].in;
 		right_num -= spatial_bins[i - 1].out;
 
@@ -243,41 +470,43 @@ template <uint32_t DIM> void ParallelSBVHBuilder::Task::_find_spatial_split_dim(
 		left_aabb.Expand(spatial_bins[i].aabb);
 	}
 }
+template <uint32_t BIN_NUM>
 void ParallelSBVHBuilder::Task::_find_spatial_split_parallel(ParallelSBVHBuilder::Task::SpatialSplit *p_ss) {
 	auto &node = access_node(m_node_idx);
 
 	const glm::vec3 &bin_bases = node.aabb.min;
-	const glm::vec3 bin_widths = node.aabb.GetExtent() / (float)kSpatialBinNum, inv_bin_widths = 1.0f / bin_widths;
+	const glm::vec3 bin_widths = node.aabb.GetExtent() / (float)BIN_NUM, inv_bin_widths = 1.0f / bin_widths;
+	const uint32_t block_size = get_parallel_for_block_size();
 	std::atomic_uint32_t counter{0};
 
-	auto compute_spatial_bins_func = [this, &bin_bases, &bin_widths, &inv_bin_widths, &counter]() {
-		std::array<std::array<ParallelSBVHBuilder::Task::SpatialBin, ParallelSBVHBuilder::kSpatialBinNum>, 3> ret{};
+	auto compute_spatial_bins_func = [this, &bin_bases, &bin_widths, &inv_bin_widths, block_size, &counter]() {
+		std::array<std::array<SpatialBin, BIN_NUM>, 3> ret{};
 
-		for (uint32_t cur_block = counter++; cur_block * kParallelForBlockSize < m_references.size();
-		     cur_block = counter++) {
-			uint32_t cur_first = cur_block * kParallelForBlockSize,
-			         cur_last = std::min((cur_block + 1) * kParallelForBlockSize, (uint32_t)m_references.size());
+		for (uint32_t cur_block = counter++; cur_block * block_size < m_references.size(); cur_block = counter++) {
+			uint32_t cur_first = cur_block * block_size,
+			         cur_last = std::min((cur_block + 1) * block_size, (uint32_t)m_references.size());
 
 			for (uint32_t cur = cur_first; cur < cur_last; ++cur) {
 				const auto &ref = access_reference(m_references[cur]);
+				const AABB &ref_aabb = get_aabb(ref);
 				glm::u32vec3 bins =
-				    glm::clamp(glm::u32vec3((ref.aabb.min - bin_bases) * inv_bin_widths), 0u, kSpatialBinNum - 1);
+				    glm::clamp(glm::u32vec3((ref_aabb.min - bin_bases) * inv_bin_widths), 0u, BIN_NUM - 1);
 				glm::u32vec3 last_bins =
-				    glm::clamp(glm::u32vec3((ref.aabb.max - bin_bases) * inv_bin_widths), 0u, kSpatialBinNum - 1);
+				    glm::clamp(glm::u32vec3((ref_aabb.max - bin_bases) * inv_bin_widths), 0u, BIN_NUM - 1);
 
 				for (int dim = 0; dim < 3; ++dim) {
 					uint32_t bin = bins[dim], last_bin = last_bins[dim];
 					auto &spatial_bins = ret[dim];
 
 					++spatial_bins[bin].in;
-					Reference cur_ref = ref;
+					AABB cur_aabb = ref_aabb;
 					for (; bin < last_bin; ++bin) {
-						auto [left_ref, right_ref] = m_p_builder->split_reference(
-						    cur_ref, dim, float(bin + 1) * bin_widths[dim] + bin_bases[dim]);
-						spatial_bins[bin].aabb.Expand(left_ref.aabb);
-						cur_ref = right_ref;
+						auto [left_aabb, right_aabb] = m_p_builder->split_aabb(
+						    ref.tri_idx, cur_aabb, dim, float(bin + 1) * bin_widths[dim] + bin_bases[dim]);
+						spatial_bins[bin].aabb.Expand(left_aabb);
+						cur_aabb = right_aabb;
 					}
-					spatial_bins[last_bin].aabb.Expand(cur_ref.aabb);
+					spatial_bins[last_bin].aabb.Expand(cur_aabb);
 					++spatial_bins[last_bin].out;
 				}
 			}
@@ -286,7 +515,7 @@ void ParallelSBVHBuilder::Task::_find_spatial_split_parallel(ParallelSBVHBuilder
 	};
 
 	// Async compute bins
-	std::vector<std::future<std::array<std::array<SpatialBin, kSpatialBinNum>, 3>>> futures(m_thread_count - 1);
+	std::vector<std::future<std::array<std::array<SpatialBin, BIN_NUM>, 3>>> futures(m_thread_count - 1);
 	for (uint32_t i = 1; i < m_thread_count; ++i)
 		futures[i - 1] = get_thread_unit(i).Push(compute_spatial_bins_func);
 	auto bins = compute_spatial_bins_func();
@@ -295,7 +524,7 @@ void ParallelSBVHBuilder::Task::_find_spatial_split_parallel(ParallelSBVHBuilder
 	for (auto &f : futures) {
 		auto r = f.get();
 		for (int dim = 0; dim < 3; ++dim) {
-			for (uint32_t x = 0; x < kSpatialBinNum; ++x) {
+			for (uint32_t x = 0; x < BIN_NUM; ++x) {
 				auto &cl = bins[dim][x];
 				const auto &cr = r[dim][x];
 				cl.aabb.Expand(cr.aabb);
@@ -305,18 +534,18 @@ void ParallelSBVHBuilder::Task::_find_spatial_split_parallel(ParallelSBVHBuilder
 		}
 	}
 
-	AABB right_aabbs[kSpatialBinNum];
+	AABB right_aabbs[BIN_NUM];
 	for (int dim = 0; dim < 3; ++dim) {
 		const auto &dim_bins = bins[dim];
 
-		right_aabbs[kSpatialBinNum - 1] = dim_bins[kSpatialBinNum - 1].aabb;
-		for (int32_t i = kSpatialBinNum - 2; i >= 1; --i)
+		right_aabbs[BIN_NUM - 1] = dim_bins[BIN_NUM - 1].aabb;
+		for (int32_t i = BIN_NUM - 2; i >= 1; --i)
 			right_aabbs[i] = AABB(dim_bins[i].aabb, right_aabbs[i + 1]);
 
 		// Find optimal spatial split
 		AABB left_aabb = dim_bins[0].aabb;
 		uint32_t left_num = 0, right_num = m_references.size();
-		for (uint32_t i = 1; i < kSpatialBinNum; ++i) {
+		for (uint32_t i = 1; i < BIN_NUM; ++i) {
 			left_num += dim_bins[i - 1].in;
 			right_num -= dim_bins[i - 1].out;
 
@@ -332,18 +561,23 @@ void ParallelSBVHBuilder::Task::_find_spatial_split_parallel(ParallelSBVHBuilder
 	}
 }
 ParallelSBVHBuilder::Task::SpatialSplit ParallelSBVHBuilder::Task::find_spatial_split() {
+	BuildTrace::Scope trace{trace_name("spatial_binning"), (uint32_t)m_references.size(), m_depth};
 	SpatialSplit ss{};
-	if (m_thread_count > 1) {
-		_find_spatial_split_parallel(&ss);
-	} else {
-		_find_spatial_split_dim<0>(&ss);
-		_find_spatial_split_dim<1>(&ss);
-		_find_spatial_split_dim<2>(&ss);
-	}
+	BVHConfig::VisitBinCount(get_bin_count(), [this, &ss](auto bin_num) {
+		constexpr uint32_t kBinNum = decltype(bin_num)::value;
+		if (m_thread_count > 1) {
+			_find_spatial_split_parallel<kBinNum>(&ss);
+		} else {
+			_find_spatial_split_dim<kBinNum, 0>(&ss);
+			_find_spatial_split_dim<kBinNum, 1>(&ss);
+			_find_spatial_split_dim<kBinNum, 2>(&ss);
+		}
+	});
 	return ss;
 }
 std::tuple<ParallelSBVHBuilder::Task, ParallelSBVHBuilder::Task>
 ParallelSBVHBuilder::Task::perform_spatial_split(const SpatialSplit &ss) {
+	BuildTrace::Scope trace{trace_name("spatial_partition"), (uint32_t)m_references.size(), m_depth};
 	return _perform_spatial_split(ss);
 	// return m_thread_count > 1 ? _perform_spatial_split_parallel(ss) : _perform_spatial_split(ss);
 }
@@ -367,11 +601,12 @@ ParallelSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 	for (uint32_t i = left_begin; i < right_begin; ++i) {
 		// put to left
 		const auto &ref = access_reference(m_references[i]);
-		if (ref.aabb.max[(int)ss.dim] <= ss.pos) {
-			left_node.aabb.Expand(ref.aabb);
+		const AABB &ref_aabb = get_aabb(ref);
+		if (ref_aabb.max[(int)ss.dim] <= ss.pos) {
+			left_node.aabb.Expand(ref_aabb);
 			std::swap(m_references[i], m_references[left_end++]);
-		} else if (ref.aabb.min[(int)ss.dim] >= ss.pos) {
-			right_node.aabb.Expand(ref.aabb);
+		} else if (ref_aabb.min[(int)ss.dim] >= ss.pos) {
+			right_node.aabb.Expand(ref_aabb);
 			std::swap(m_references[i--], m_references[--right_begin]);
 		}
 	}
@@ -379,7 +614,12 @@ ParallelSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 	if ((left_begin == left_end || right_begin == right_end) && left_end == right_begin) {
 		return {};
 	}
+	// at most every straddling reference is duplicated, fall back to the object split if the budget can't cover it
+	if (right_begin - left_end > m_duplicate_budget)
+		return {};
+	get_reference_arena().Reserve(&m_references, right_end + (right_begin - left_end));
 
+	uint32_t unsplit_num = 0;
 	if (right_begin - left_end < kSpatialSplitUnsplitThreshold) {
 		AABB lub; // Unsplit to left:     new left-hand bounds.
 		AABB rub; // Unsplit to right:    new right-hand bounds.
@@ -392,10 +632,10 @@ ParallelSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 			lub = lsb = left_node.aabb;
 			rub = rsb = right_node.aabb;
 
-			lub.Expand(cur_ref.aabb);
-			rub.Expand(cur_ref.aabb);
-			lsb.Expand(left_ref.aabb);
-			rsb.Expand(right_ref.aabb);
+			lub.Expand(get_aabb(cur_ref));
+			rub.Expand(get_aabb(cur_ref));
+			lsb.Expand(get_aabb(left_ref));
+			rsb.Expand(get_aabb(right_ref));
 
 			auto lac = float(left_end - left_begin);
 			auto rac = float(right_end - right_begin);
@@ -410,11 +650,12 @@ ParallelSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 			    right_begin < right_end) { // unsplit to left
 				left_node.aabb = lub;
 				++left_end;
+				++unsplit_num;
 			} else if (unsplit_right_sah < split_sah && left_begin < left_end) { // unsplit to right
 				right_node.aabb = rub;
 				std::swap(m_references[left_end], m_references[--right_begin]);
+				++unsplit_num;
 			} else { // duplicate
-				m_references.emplace_back();
 				left_node.aabb = lsb;
 				right_node.aabb = rsb;
 
@@ -423,7 +664,8 @@ ParallelSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 				access_reference(right_ref_idx) = right_ref;
 				++left_end;
 				// m_references[left_end++] = p_left_ref;
-				m_references[right_end++] = right_ref_idx;
+				m_references.push_back(right_ref_idx);
+				++right_end;
 			}
 		}
 	} else {
@@ -431,22 +673,24 @@ ParallelSBVHBuilder::Task::_perform_spatial_split(const SpatialSplit &ss) {
 			auto &cur_ref = access_reference(m_references[left_end]);
 			auto [left_ref, right_ref] = m_p_builder->split_reference(cur_ref, ss.dim, ss.pos);
 
-			left_node.aabb.Expand(left_ref.aabb);
-			right_node.aabb.Expand(right_ref.aabb);
-			m_references.emplace_back();
+			left_node.aabb.Expand(get_aabb(left_ref));
+			right_node.aabb.Expand(get_aabb(right_ref));
 
 			cur_ref = left_ref;
 			uint32_t right_ref_idx = new_reference();
 			access_reference(right_ref_idx) = right_ref;
 			++left_end;
-			m_references[right_end++] = right_ref_idx;
+			m_references.push_back(right_ref_idx);
+			++right_end;
 		}
 	}
 
 	assert(left_begin < left_end && right_begin < right_end);
+	get_stats().AddUnsplits(m_depth, unsplit_num);
 
-	std::vector<uint32_t> &left_refs = m_references;
-	std::vector<uint32_t> right_refs{m_references.begin() + right_begin, m_references.begin() + right_end};
+	ReferenceList &left_refs = m_references;
+	ReferenceList right_refs =
+	    get_reference_arena().Alloc(m_references.begin() + right_begin, m_references.begin() + right_end);
 	left_refs.resize(left_end - left_begin);
 
 	auto [left_thread_count, right_thread_count] = get_child_thread_counts(left_refs.size(), right_refs.size());
@@ -491,17 +735,18 @@ ParallelSBVHBuilder::Task::_perform_spatial_split_parallel(const SpatialSplit &s
 
                 for (uint32_t cur = cur_first; cur < cur_last; ++cur) {
                     const auto &ref = access_reference(m_references[cur]);
+                    const AABB &ref_aabb = get_aabb(ref);
 
-                    if (ref.aabb.max[(int)ss.dim] <= ss.pos) {
-                        left_aabb.Expand(ref.aabb);
+                    if (ref_aabb.max[(int)ss.dim] <= ss.pos) {
+                        left_aabb.Expand(ref_aabb);
                         tmp_references[left_counter++] = m_references[cur];
-                    } else if (ref.aabb.min[(int)ss.dim] >= ss.pos) {
-                        right_aabb.Expand(ref.aabb);
+                    } else if (ref_aabb.min[(int)ss.dim] >= ss.pos) {
+                        right_aabb.Expand(ref_aabb);
                         tmp_references[m_references.size() - (++right_counter)] = m_references[cur];
                     } else {
                         auto [left_ref, right_ref] = m_p_builder->split_reference(ref, ss.dim, ss.pos);
-                        left_aabb.Expand(left_ref.aabb);
-                        right_aabb.Expand(right_ref.aabb);
+                        left_aabb.Expand(get_aabb(left_ref));
+                        right_aabb.Expand(get_aabb(right_ref));
 
                         uint32_t left_ref_idx = m_references[cur];
                         access_reference(left_ref_idx) = left_ref;
@@ -562,18 +807,18 @@ template <uint32_t DIM> void ParallelSBVHBuilder::Task::_find_object_split_swept
 	// Preprocess right_aabbs
 	AABB right_aabbs[kSweptObjectSplitThreshold];
 
-	right_aabbs[m_references.size() - 1] = access_reference(m_references.back()).aabb;
+	right_aabbs[m_references.size() - 1] = get_aabb(access_reference(m_references.back()));
 	for (int32_t i = (int32_t)m_references.size() - 2; i >= 1; --i)
-		right_aabbs[i] = AABB(access_reference(m_references[i]).aabb, right_aabbs[i + 1]);
+		right_aabbs[i] = AABB(get_aabb(access_reference(m_references[i])), right_aabbs[i + 1]);
 
 	// Find optimal object split
-	AABB left_aabb = access_reference(m_references.front()).aabb;
+	AABB left_aabb = get_aabb(access_reference(m_references.front()));
 	for (uint32_t i = 1; i < m_references.size(); ++i) {
 		float sah = float(i) * left_aabb.GetHalfArea() + float(m_references.size() - i) * right_aabbs[i].GetHalfArea();
 		if (sah < p_os->sah) {
 			p_os->dim = DIM;
-			p_os->pos = (access_reference(m_references[i - 1]).aabb.GetDimCenter<DIM>() +
-			             access_reference(m_references[i]).aabb.GetDimCenter<DIM>()) *
+			p_os->pos = (get_aabb(access_reference(m_references[i - 1])).GetDimCenter<DIM>() +
+			             get_aabb(access_reference(m_references[i])).GetDimCenter<DIM>()) *
 			            0.5f;
 			p_os->left_aabb = left_aabb;
 			p_os->right_aabb = right_aabbs[i];
@@ -581,43 +826,45 @@ template <uint32_t DIM> void ParallelSBVHBuilder::Task::_find_object_split_swept
 			p_os->bin_width = 0.0f;
 		}
 
-		left_aabb.Expand(access_reference(m_references[i]).aabb);
+		left_aabb.Expand(get_aabb(access_reference(m_references[i])));
 	}
 }
-template <uint32_t DIM> void ParallelSBVHBuilder::Task::_find_object_split_binned_dim(ObjectSplit *p_os) {
-	ObjectBin object_bins[kObjectBinNum];
-	AABB right_aabbs[kObjectBinNum];
+template <uint32_t BIN_NUM, uint32_t DIM>
+void ParallelSBVHBuilder::Task::_find_object_split_binned_dim(ObjectSplit *p_os) {
+	ObjectBin object_bins[BIN_NUM];
+	AABB right_aabbs[BIN_NUM];
 
 	float bound_min = FLT_MAX, bound_max = -FLT_MAX;
 	for (uint32_t ref_idx : m_references) {
 		const auto &ref = access_reference(ref_idx);
-		float c = ref.aabb.GetDimCenter<DIM>();
+		float c = get_aabb(ref).GetDimCenter<DIM>();
 		bound_max = std::max(bound_max, c);
 		bound_min = std::min(bound_min, c);
 	}
 
-	std::fill(object_bins, object_bins + kObjectBinNum, ObjectBin{AABB(), 0}); // initialize bins
-	const float bin_width = (bound_max - bound_min) / kObjectBinNum, inv_bin_width = 1.0f / bin_width;
+	std::fill(object_bins, object_bins + BIN_NUM, ObjectBin{AABB(), 0}); // initialize bins
+	const float bin_width = (bound_max - bound_min) / BIN_NUM, inv_bin_width = 1.0f / bin_width;
 	const float bound_base = bound_min; // m_node->aabb.min[DIM];
 
 	// Put references into bins according to centers
 	for (uint32_t ref_idx : m_references) {
 		const auto &ref = access_reference(ref_idx);
+		const AABB &ref_aabb = get_aabb(ref);
 		uint32_t bin =
-		    glm::clamp(uint32_t((ref.aabb.GetDimCenter<DIM>() - bound_base) * inv_bin_width), 0u, kObjectBinNum - 1);
-		object_bins[bin].aabb.Expand(ref.aabb);
+		    glm::clamp(uint32_t((ref_aabb.GetDimCenter<DIM>() - bound_base) * inv_bin_width), 0u, BIN_NUM - 1);
+		object_bins[bin].aabb.Expand(ref_aabb);
 		++object_bins[bin].cnt;
 	}
 
 	// Compute the AABBs from right
-	right_aabbs[kObjectBinNum - 1] = object_bins[kObjectBinNum - 1].aabb;
-	for (int32_t i = kObjectBinNum - 2; i >= 1; --i)
+	right_aabbs[BIN_NUM - 1] = object_bins[BIN_NUM - 1].aabb;
+	for (int32_t i = BIN_NUM - 2; i >= 1; --i)
 		right_aabbs[i] = AABB(object_bins[i].aabb, right_aabbs[i + 1]);
 
 	// Find optimal object split
 	AABB left_aabb = object_bins[0].aabb;
 	uint32_t left_num = 0;
-	for (uint32_t i = 1; i < kObjectBinNum; ++i) {
+	for (uint32_t i = 1; i < BIN_NUM; ++i) {
 		left_num += object_bins[i - 1].cnt;
 		uint32_t right_num = m_references.size() - left_num;
 
@@ -634,19 +881,19 @@ template <uint32_t DIM> void ParallelSBVHBuilder::Task::_find_object_split_binne
 		left_aabb.Expand(object_bins[i].aabb);
 	}
 }
-void ParallelSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os) {
+template <uint32_t BIN_NUM> void ParallelSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *p_os) {
+	const uint32_t block_size = get_parallel_for_block_size();
 	AABB center_bound;
 	{ // Parallel compute center bound
 		std::atomic_uint32_t counter{0};
-		auto compute_center_bound_func = [this, &counter]() {
+		auto compute_center_bound_func = [this, block_size, &counter]() {
 			AABB ret{};
-			for (uint32_t cur_block = counter++; cur_block * kParallelForBlockSize < m_references.size();
-			     cur_block = counter++) {
-				uint32_t cur_first = cur_block * kParallelForBlockSize,
-				         cur_last = std::min((cur_block + 1) * kParallelForBlockSize, (uint32_t)m_references.size());
+			for (uint32_t cur_block = counter++; cur_block * block_size < m_references.size(); cur_block = counter++) {
+				uint32_t cur_first = cur_block * block_size,
+				         cur_last = std::min((cur_block + 1) * block_size, (uint32_t)m_references.size());
 				for (uint32_t cur = cur_first; cur < cur_last; ++cur) {
 					const auto &ref = access_reference(m_references[cur]);
-					ret.Expand(ref.aabb.GetCenter());
+					ret.Expand(get_aabb(ref).GetCenter());
 				}
 			}
 			return ret;
@@ -660,27 +907,27 @@ void ParallelSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *
 	}
 
 	const glm::vec3 &bin_bases = center_bound.min;
-	const glm::vec3 bin_widths = center_bound.GetExtent() / (float)kObjectBinNum, inv_bin_widths = 1.0f / bin_widths;
+	const glm::vec3 bin_widths = center_bound.GetExtent() / (float)BIN_NUM, inv_bin_widths = 1.0f / bin_widths;
 
 	std::atomic_uint32_t counter{0};
-	auto compute_object_bins_func = [this, &bin_bases, &bin_widths, &inv_bin_widths, &counter]() {
-		std::array<std::array<ObjectBin, kObjectBinNum>, 3> ret{};
+	auto compute_object_bins_func = [this, &bin_bases, &bin_widths, &inv_bin_widths, block_size, &counter]() {
+		std::array<std::array<ObjectBin, BIN_NUM>, 3> ret{};
 
-		for (uint32_t cur_block = counter++; cur_block * kParallelForBlockSize < m_references.size();
-		     cur_block = counter++) {
-			uint32_t cur_first = cur_block * kParallelForBlockSize,
-			         cur_last = std::min((cur_block + 1) * kParallelForBlockSize, (uint32_t)m_references.size());
+		for (uint32_t cur_block = counter++; cur_block * block_size < m_references.size(); cur_block = counter++) {
+			uint32_t cur_first = cur_block * block_size,
+			         cur_last = std::min((cur_block + 1) * block_size, (uint32_t)m_references.size());
 
 			for (uint32_t cur = cur_first; cur < cur_last; ++cur) {
 				const auto &ref = access_reference(m_references[cur]);
-				glm::u32vec3 bins = glm::clamp(glm::u32vec3((ref.aabb.GetCenter() - bin_bases) * inv_bin_widths), 0u,
-				                               kObjectBinNum - 1);
+				const AABB &ref_aabb = get_aabb(ref);
+				glm::u32vec3 bins = glm::clamp(glm::u32vec3((ref_aabb.GetCenter() - bin_bases) * inv_bin_widths), 0u,
+				                               BIN_NUM - 1);
 				for (int dim = 0; dim < 3; ++dim) {
 					auto &object_bins = ret[dim];
 					uint32_t bin = bins[dim];
 
 					++object_bins[bin].cnt;
-					object_bins[bin].aabb.Expand(ref.aabb);
+					object_bins[bin].aabb.Expand(ref_aabb);
 				}
 			}
 		}
@@ -688,7 +935,7 @@ void ParallelSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *
 	};
 
 	// Async compute bins
-	std::vector<std::future<std::array<std::array<ObjectBin, kObjectBinNum>, 3>>> futures(m_thread_count - 1);
+	std::vector<std::future<std::array<std::array<ObjectBin, BIN_NUM>, 3>>> futures(m_thread_count - 1);
 	for (uint32_t i = 1; i < m_thread_count; ++i)
 		futures[i - 1] = get_thread_unit(i).Push(compute_object_bins_func);
 	auto bins = compute_object_bins_func();
@@ -697,7 +944,7 @@ void ParallelSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *
 	for (auto &f : futures) {
 		auto r = f.get();
 		for (int dim = 0; dim < 3; ++dim) {
-			for (uint32_t x = 0; x < kObjectBinNum; ++x) {
+			for (uint32_t x = 0; x < BIN_NUM; ++x) {
 				auto &cl = bins[dim][x];
 				const auto &cr = r[dim][x];
 				cl.aabb.Expand(cr.aabb);
@@ -706,18 +953,18 @@ void ParallelSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *
 		}
 	}
 
-	AABB right_aabbs[kObjectBinNum];
+	AABB right_aabbs[BIN_NUM];
 	for (int dim = 0; dim < 3; ++dim) {
 		const auto &dim_bins = bins[dim];
 
-		right_aabbs[kObjectBinNum - 1] = dim_bins[kObjectBinNum - 1].aabb;
-		for (int32_t i = kObjectBinNum - 2; i >= 1; --i)
+		right_aabbs[BIN_NUM - 1] = dim_bins[BIN_NUM - 1].aabb;
+		for (int32_t i = BIN_NUM - 2; i >= 1; --i)
 			right_aabbs[i] = AABB(dim_bins[i].aabb, right_aabbs[i + 1]);
 
 		// Find optimal object split
 		AABB left_aabb = dim_bins[0].aabb;
 		uint32_t left_num = 0;
-		for (uint32_t i = 1; i < kObjectBinNum; ++i) {
+		for (uint32_t i = 1; i < BIN_NUM; ++i) {
 			left_num += dim_bins[i - 1].cnt;
 			uint32_t right_num = m_references.size() - left_num;
 
@@ -736,15 +983,19 @@ void ParallelSBVHBuilder::Task::_find_object_split_binned_parallel(ObjectSplit *
 	}
 }
 ParallelSBVHBuilder::Task::ObjectSplit ParallelSBVHBuilder::Task::find_object_split() {
+	BuildTrace::Scope trace{trace_name("object_binning"), (uint32_t)m_references.size(), m_depth};
 	ObjectSplit os{};
-	if (m_references.size() >= kObjectBinNum) {
-		if (m_thread_count > 1)
-			_find_object_split_binned_parallel(&os);
-		else {
-			_find_object_split_binned_dim<0>(&os);
-			_find_object_split_binned_dim<1>(&os);
-			_find_object_split_binned_dim<2>(&os);
-		}
+	if (m_references.size() >= kSweptObjectSplitThreshold) {
+		BVHConfig::VisitBinCount(get_bin_count(), [this, &os](auto bin_num) {
+			constexpr uint32_t kBinNum = decltype(bin_num)::value;
+			if (m_thread_count > 1)
+				_find_object_split_binned_parallel<kBinNum>(&os);
+			else {
+				_find_object_split_binned_dim<kBinNum, 0>(&os);
+				_find_object_split_binned_dim<kBinNum, 1>(&os);
+				_find_object_split_binned_dim<kBinNum, 2>(&os);
+			}
+		});
 	}
 	// Fallback to sweep SAH if failed
 	if (os.sah == FLT_MAX && m_references.size() <= kSweptObjectSplitThreshold) {
@@ -756,6 +1007,7 @@ ParallelSBVHBuilder::Task::ObjectSplit ParallelSBVHBuilder::Task::find_object_sp
 }
 std::tuple<ParallelSBVHBuilder::Task, ParallelSBVHBuilder::Task>
 ParallelSBVHBuilder::Task::perform_object_split(const ObjectSplit &os) {
+	BuildTrace::Scope trace{trace_name("object_partition"), (uint32_t)m_references.size(), m_depth};
 	return _perform_object_split(os);
 	// return m_thread_count > 1 ? _perform_object_split_parallel(os) : _perform_object_split(os);
 }
@@ -781,12 +1033,13 @@ ParallelSBVHBuilder::Task::_perform_object_split(const ObjectSplit &os) {
 	for (uint32_t i = left_begin; i < right_begin; ++i) {
 		// put to left
 		const auto &ref = access_reference(m_references[i]);
-		float c = ref.aabb.GetDimCenter((int)os.dim);
+		const AABB &ref_aabb = get_aabb(ref);
+		float c = ref_aabb.GetDimCenter((int)os.dim);
 		if (c < os.pos - delta) {
-			left_node.aabb.Expand(ref.aabb);
+			left_node.aabb.Expand(ref_aabb);
 			std::swap(m_references[i], m_references[left_end++]);
 		} else if (c > os.pos + delta) {
-			right_node.aabb.Expand(ref.aabb);
+			right_node.aabb.Expand(ref_aabb);
 			std::swap(m_references[i--], m_references[--right_begin]);
 		}
 	}
@@ -797,8 +1050,8 @@ ParallelSBVHBuilder::Task::_perform_object_split(const ObjectSplit &os) {
 	std::shuffle(m_references.begin() + left_end, m_references.begin() + right_begin, std::minstd_rand{});
 	while (left_end < right_begin) {
 		auto &cur_ref = access_reference(m_references[left_end]);
-		AABB lb = AABB{left_node.aabb, cur_ref.aabb};
-		AABB rb = AABB{right_node.aabb, cur_ref.aabb};
+		AABB lb = AABB{left_node.aabb, get_aabb(cur_ref)};
+		AABB rb = AABB{right_node.aabb, get_aabb(cur_ref)};
 
 		float left_sah = lb.GetHalfArea() * float(1 + left_end - left_begin) +
 		                 right_node.aabb.GetHalfArea() * float(right_end - right_begin);
@@ -817,8 +1070,9 @@ ParallelSBVHBuilder::Task::_perform_object_split(const ObjectSplit &os) {
 	if (left_begin == left_end || right_begin == right_end)
 		return {};
 
-	std::vector<uint32_t> &left_refs = m_references;
-	std::vector<uint32_t> right_refs{m_references.begin() + right_begin, m_references.begin() + right_end};
+	ReferenceList &left_refs = m_references;
+	ReferenceList right_refs =
+	    get_reference_arena().Alloc(m_references.begin() + right_begin, m_references.begin() + right_end);
 	left_refs.resize(left_end - left_begin);
 
 	auto [left_thread_count, right_thread_count] = get_child_thread_counts(left_refs.size(), right_refs.size());
@@ -839,8 +1093,23 @@ ParallelSBVHBuilder::Task::_perform_object_split_parallel(const ObjectSplit &os)
     left_node.aabb = right_node.aabb = AABB();
 }*/
 
+std::tuple<ParallelSBVHBuilder::Task, ParallelSBVHBuilder::Task> ParallelSBVHBuilder::Task::perform_median_split() {
+	{
+		BuildTrace::Scope trace{trace_name("median_partition"), (uint32_t)m_references.size(), m_depth};
+		AABB center_bound{};
+		for (uint32_t ref_idx : m_references)
+			center_bound.Expand(get_aabb(access_reference(ref_idx)).GetCenter());
+		glm::vec3 extent = center_bound.GetExtent();
+		uint32_t dim = extent.x >= extent.y ? (extent.x >= extent.z ? 0 : 2) : (extent.y >= extent.z ? 1 : 2);
+		SelectMedianReference(m_p_builder->m_reference_codec, m_p_builder->m_reference_pool, m_references.begin(),
+		                      m_references.end(), dim);
+	}
+	return perform_default_split();
+}
+
 std::tuple<ParallelSBVHBuilder::Task, ParallelSBVHBuilder::Task> ParallelSBVHBuilder::Task::perform_default_split() {
-	spdlog::warn("Default split, {}", m_references.size());
+	BuildTrace::Scope trace{trace_name("default_partition"), (uint32_t)m_references.size(), m_depth};
+	spdlog::debug("Default split, {}", m_references.size());
 	uint32_t left_num = m_references.size() >> 1u;
 
 	auto &node = access_node(m_node_idx);
@@ -850,16 +1119,16 @@ std::tuple<ParallelSBVHBuilder::Task, ParallelSBVHBuilder::Task> ParallelSBVHBui
 		node.right = new_node();
 
 	auto &left_node = access_node(node.left), &right_node = access_node(node.right);
-	left_node.aabb = access_reference(m_references[0]).aabb;
+	left_node.aabb = get_aabb(access_reference(m_references[0]));
 	for (uint32_t i = 1; i < left_num; ++i)
-		left_node.aabb.Expand(access_reference(m_references[i]).aabb);
+		left_node.aabb.Expand(get_aabb(access_reference(m_references[i])));
 
-	right_node.aabb = access_reference(m_references[left_num]).aabb;
+	right_node.aabb = get_aabb(access_reference(m_references[left_num]));
 	for (uint32_t i = left_num + 1; i < m_references.size(); ++i)
-		right_node.aabb.Expand(access_reference(m_references[i]).aabb);
+		right_node.aabb.Expand(get_aabb(access_reference(m_references[i])));
 
-	std::vector<uint32_t> &left_refs = m_references;
-	std::vector<uint32_t> right_refs{m_references.begin() + left_num, m_references.end()};
+	ReferenceList &left_refs = m_references;
+	ReferenceList right_refs = get_reference_arena().Alloc(m_references.begin() + left_num, m_references.end());
 	left_refs.resize(left_num);
 
 	auto [left_thread_count, right_thread_count] = get_child_thread_counts(left_refs.size(), right_refs.size());
@@ -3,6 +3,13 @@
 
 #include "AtomicAllocator.hpp"
 #include "AtomicBinaryBVH.hpp"
+#include "BuildBudget.hpp"
+#include "BuildReference.hpp"
+#include "BuildTrace.hpp"
+#include "NumaTopology.hpp"
+#include "ReferenceArena.hpp"
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <cfloat>
 #include <concurrentqueue.h>
@@ -18,32 +25,45 @@ public:
 
 private:
 	const uint32_t kThreadCount;
-	static constexpr uint32_t kSpatialBinNum = 32, kObjectBinNum = 32, kSweptObjectSplitThreshold = 32;
-	static constexpr uint32_t kParallelForBlockSize = 64;
-	static constexpr uint32_t kLocalRunThreshold = 512;
+	static constexpr uint32_t kSweptObjectSplitThreshold = 32;
 	static constexpr uint32_t kSpatialSplitUnsplitThreshold = 16;
 
 	AtomicBinaryBVH &m_bvh;
 	const Scene &m_scene;
 	const BVHConfig &m_config;
 	float m_min_overlap_area;
+	const NumaTopology *m_p_numa; // nullptr without NUMA placement
+	BuildBudget m_budget;
 
 	AtomicAllocator<AtomicBinaryBVH::Node> &m_node_pool;
 	std::vector<LocalAllocator<AtomicBinaryBVH::Node>> m_thread_node_allocators;
+	std::vector<LocalAllocator<uint32_t>> m_thread_tri_index_allocators;
 
 	std::atomic_uint32_t m_leaf_count{0};
 
-	struct Reference {
-		AABB aabb;
-		uint32_t tri_idx{};
-	};
+	using Reference = BuildReference;
+	const ReferenceCodec m_reference_codec;
 	AtomicAllocator<Reference> m_reference_pool;
 	std::vector<LocalAllocator<Reference>> m_thread_reference_allocators;
+	// the tasks' reference index lists, a split keeps the parent's range for the left child and the leaves release them
+	AtomicBlockAllocator<uint32_t> m_reference_list_pool;
+	std::vector<ReferenceArena> m_thread_reference_arenas;
+	std::vector<BuildStats> m_thread_stats;
 	// std::vector<std::vector<uint32_t>> m_thread_tmp_references;
 
 	template <uint32_t DIM, typename Iter> inline void sort_references(Iter first_ref, Iter last_ref);
 	template <typename Iter> inline void sort_references(Iter first_ref, Iter last_ref, uint32_t dim);
+	inline decltype(auto) get_aabb(const Reference &ref) const { return m_reference_codec.GetAABB(ref); }
+	// clips the part of triangle tri_idx inside aabb at pos
+	inline std::tuple<AABB, AABB> split_aabb(uint32_t tri_idx, const AABB &aabb, uint32_t dim, float pos) const;
 	inline std::tuple<Reference, Reference> split_reference(const Reference &ref, uint32_t dim, float pos) const;
+	// stores the triangles of ref_count references in the leaf
+	inline void make_leaf(uint32_t thread, uint32_t node_idx, const uint32_t *references, uint32_t ref_count) {
+		std::array<uint32_t, BVHConfig::kMaxLeafTriangles> tris{};
+		uint32_t tri_count = GetLeafTriangles(m_reference_pool, references, ref_count, tris.data());
+		m_bvh.set_leaf(node_idx, &m_thread_tri_index_allocators[thread], tris.data(), tri_count);
+		++m_leaf_count;
+	}
 
 	// A simple thread pool with 1 thread and 1 task
 	class ThreadUnit {
@@ -95,8 +115,9 @@ private:
 	private:
 		ParallelSBVHBuilder *m_p_builder{};
 		uint32_t m_node_idx{};
-		std::vector<uint32_t> m_references;
+		ReferenceList m_references;
 		uint32_t m_depth{}, m_thread{}, m_thread_count{};
+		uint32_t m_duplicate_budget{BVHConfig::kUnlimitedDuplicates}; // references spatial splits may add below
 
 		struct ObjectSplit {
 			AABB left_aabb, right_aabb;
@@ -116,37 +137,76 @@ private:
 			uint32_t in{}, out{};
 		};
 
-		template <uint32_t DIM> inline void _find_spatial_split_dim(SpatialSplit *p_ss);
-		inline void _find_spatial_split_parallel(SpatialSplit *p_ss);
+		template <uint32_t BIN_NUM, uint32_t DIM> inline void _find_spatial_split_dim(SpatialSplit *p_ss);
+		template <uint32_t BIN_NUM> inline void _find_spatial_split_parallel(SpatialSplit *p_ss);
 		inline SpatialSplit find_spatial_split();
 		inline std::tuple<Task, Task> perform_spatial_split(const SpatialSplit &ss);
 		inline std::tuple<Task, Task> _perform_spatial_split(const SpatialSplit &ss);
 		// inline std::tuple<Task, Task> _perform_spatial_split_parallel(const SpatialSplit &ss);
 
 		template <uint32_t DIM> inline void _find_object_split_swept_dim(ObjectSplit *p_os);
-		template <uint32_t DIM> inline void _find_object_split_binned_dim(ObjectSplit *p_os);
-		inline void _find_object_split_binned_parallel(ObjectSplit *p_os);
+		template <uint32_t BIN_NUM, uint32_t DIM> inline void _find_object_split_binned_dim(ObjectSplit *p_os);
+		template <uint32_t BIN_NUM> inline void _find_object_split_binned_parallel(ObjectSplit *p_os);
 		inline ObjectSplit find_object_split();
 		inline std::tuple<Task, Task> perform_object_split(const ObjectSplit &os);
 		inline std::tuple<Task, Task> _perform_object_split(const ObjectSplit &os);
 		// inline std::tuple<Task, Task> _perform_object_split_parallel(const ObjectSplit &os);
 
 		inline std::tuple<Task, Task> perform_default_split();
+		// halves the references at the median center on the axis of the largest center extent, the split of the
+		// nodes left once the build budget is exceeded
+		inline std::tuple<Task, Task> perform_median_split();
+
+		// with NUMA placement, copies the references into memory of this task's node if the parent, which made them,
+		// ran on another node
+		void localize_references(uint32_t parent_thread);
 
 		inline std::tuple<uint32_t, uint32_t> get_child_thread_counts(uint32_t left_ref_count,
 		                                                              uint32_t right_ref_count) const;
 
+		// estimated ns to build the subtree of ref_count references at depth, see BuildTuning
+		inline float get_work(uint32_t ref_count, uint32_t depth) const {
+			const BVHConfig &config = m_p_builder->m_config;
+			uint32_t spatial_levels =
+			    m_duplicate_budget && depth <= config.m_max_spatial_depth ? config.m_max_spatial_depth + 1 - depth : 0;
+			return config.m_tuning.GetSubtreeWork(ref_count, spatial_levels);
+		}
+		// whether the task is cheaper to build as a whole on one thread than to queue its children
+		inline bool is_local() const {
+			return get_work(m_references.size(), m_depth) <= m_p_builder->m_config.m_tuning.m_local_run_work_ns;
+		}
+		inline uint32_t get_parallel_for_block_size() const {
+			return m_p_builder->m_config.m_tuning.m_parallel_for_block_size;
+		}
+
 		inline AtomicBinaryBVH::Node &access_node(uint32_t node_idx) const {
 			return m_p_builder->m_node_pool[node_idx];
 		}
 		inline Reference &access_reference(uint32_t ref_idx) const { return m_p_builder->m_reference_pool[ref_idx]; }
+		inline decltype(auto) get_aabb(const Reference &ref) const { return m_p_builder->get_aabb(ref); }
+		inline uint32_t get_bin_count() const {
+			return m_p_builder->m_config.GetBinCount((uint32_t)m_references.size());
+		}
 
 		inline void make_leaf() {
-			auto &node = access_node(m_node_idx);
-			node.tri_idx = access_reference(m_references.front()).tri_idx;
-			++m_p_builder->m_leaf_count;
+			m_p_builder->make_leaf(m_thread, m_node_idx, m_references.data(), (uint32_t)m_references.size());
+			get_reference_arena().Release(&m_references);
+			get_stats().AddLeaf(m_depth);
+		}
+
+		inline std::tuple<Task, Task> pass_duplicate_budget(std::tuple<Task, Task> children,
+		                                                    uint32_t duplicate_count) const {
+			auto &[left, right] = children;
+			std::tie(left.m_duplicate_budget, right.m_duplicate_budget) = BVHConfig::ShareDuplicateBudget(
+			    m_duplicate_budget, duplicate_count, left.m_references.size(), right.m_references.size());
+			return children;
 		}
 
+		inline BuildStats &get_stats() const { return m_p_builder->m_thread_stats[m_thread]; }
+		// tasks small enough for LocalRun are traced as a whole
+		inline const char *trace_name(const char *name) const {
+			return is_local() ? nullptr : name;
+		}
 		inline ThreadUnit &get_thread_unit(uint32_t idx = 0) const {
 			return m_p_builder->m_thread_group[m_thread + idx - 1];
 		}
@@ -167,6 +227,7 @@ private:
 		        ret.resize(ref_num);
 		    return ret;
 		} */
+		inline ReferenceArena &get_reference_arena() const { return m_p_builder->m_thread_reference_arenas[m_thread]; }
 		inline uint32_t new_node() const { return m_p_builder->m_thread_node_allocators[m_thread].Alloc(); }
 		inline uint32_t new_reference(uint32_t idx = 0) const {
 			return m_p_builder->m_thread_reference_allocators[m_thread + idx].Alloc();
@@ -174,7 +235,7 @@ private:
 
 	public:
 		inline Task() = default;
-		inline Task(ParallelSBVHBuilder *p_builder, uint32_t node_idx, std::vector<uint32_t> &&references,
+		inline Task(ParallelSBVHBuilder *p_builder, uint32_t node_idx, ReferenceList &&references,
 		            uint32_t depth, uint32_t thread_begin, uint32_t thread_count)
 		    : m_p_builder{p_builder}, m_node_idx{node_idx}, m_references{std::move(references)}, m_depth{depth},
 		      m_thread(thread_begin), m_thread_count{thread_count} {}
@@ -185,11 +246,15 @@ private:
 		Task &operator=(Task &&r) = default;
 
 		inline static bool PairEmpty(const std::tuple<Task, Task> &p) { return std::get<0>(p).Empty(); }
+		inline void SetDuplicateBudget(uint32_t budget) { m_duplicate_budget = budget; }
 		inline bool Empty() const { return !m_node_idx; }
 		std::tuple<Task, Task> Run();
 		void BlockRun();
-		std::future<void> AsyncRun();
+		// runs BlockRun() on the task's thread, the parent ran on parent_thread
+		std::future<void> AsyncRun(uint32_t parent_thread);
 		void LocalRun();
+		// works off the task queue on m_thread until every queued task is done
+		void PoolRun();
 	};
 
 	// Task queue
@@ -199,12 +264,29 @@ private:
 	std::vector<moodycamel::ProducerToken> m_producer_tokens;
 
 	Task make_root_task();
+	ReferenceList make_references();
+
+	// kShapeSBVH, the references of one OBJ shape
+	struct Shape {
+		AABB aabb;
+		uint32_t tri_count{};
+		std::vector<uint32_t> references;
+		bool parallel{}; // more than a thread's share of the references
+	};
+	// SAH tree over the shape bounds (sweeping their centroids) below node_idx, one task per shape, which goes to
+	// p_parallel_tasks or p_batch_tasks
+	void make_shape_tree(Shape *first, Shape *last, uint32_t node_idx, uint32_t depth,
+	                     std::vector<Task> *p_parallel_tasks, std::vector<Task> *p_batch_tasks);
+	// builds every shape as its own root task, parallel shapes one at a time on all threads, the rest queued together
+	void run_shape_tasks();
 
 public:
 	explicit ParallelSBVHBuilder(AtomicBinaryBVH *p_bvh)
-	    : kThreadCount(std::max(1u, std::thread::hardware_concurrency())), m_bvh{*p_bvh},
+	    : kThreadCount(p_bvh->GetConfig().GetThreadCount()), m_bvh{*p_bvh},
 	      m_node_pool{p_bvh->m_node_pool}, m_scene(*p_bvh->GetScenePtr()),
-	      m_config(p_bvh->GetConfig()), m_min_overlap_area{p_bvh->GetScenePtr()->GetAABB().GetHalfArea() * 1e-5f} {}
+	      m_config(p_bvh->GetConfig()), m_min_overlap_area{p_bvh->GetScenePtr()->GetAABB().GetHalfArea() * 1e-5f},
+	      m_p_numa{p_bvh->GetConfig().m_numa ? &NumaTopology::Get() : nullptr}, m_budget{p_bvh->GetConfig()},
+	      m_reference_codec{p_bvh->GetScenePtr()->GetAABB()} {}
 	void Run();
 };
 
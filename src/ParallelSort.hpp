@@ -31,7 +31,8 @@ inline void ParallelSort(Iter first, Iter last, Compare compare, uint32_t thread
 	std::vector<uint32_t> tmp(kMapNum, 0), map(kMapNum, 0), bucket(kMapNum, 0);
 
 	{
-		std::minstd_rand gen{std::random_device{}()};
+		// fixed seed, so the buckets (and the work per thread) are the same on every run
+		std::minstd_rand gen{};
 		std::uniform_int_distribution<uint32_t> dis{0, kSize - 1};
 		std::vector<T> samples(kSampleNum);
 		for (auto &i : samples)
@@ -0,0 +1,98 @@
+#include "Presplit.hpp"
+
+#include "BuildTrace.hpp"
+#include <spdlog/spdlog.h>
+#include <tuple>
+
+// same clipping as the builders' split_reference
+static std::tuple<AABB, AABB> clip_triangle(const Triangle &tri, const AABB &aabb, int dim, float pos) {
+	AABB left, right;
+	for (uint32_t i = 0; i < 3; ++i) {
+		const glm::vec3 &v0 = tri.positions[i], &v1 = tri.positions[(i + 1) % 3];
+		float p0 = v0[dim], p1 = v1[dim];
+		if (p0 <= pos)
+			left.Expand(v0);
+		if (p0 >= pos)
+			right.Expand(v0);
+
+		if ((p0 < pos && pos < p1) || (p1 < pos && pos < p0)) { // Edges
+			glm::vec3 x = glm::mix(v0, v1, glm::clamp((pos - p0) / (p1 - p0), 0.0f, 1.0f));
+			left.Expand(x);
+			right.Expand(x);
+		}
+	}
+
+	left.max[dim] = pos;
+	left.IntersectAABB(aabb);
+
+	right.min[dim] = pos;
+	right.IntersectAABB(aabb);
+
+	return {left, right};
+}
+
+// the plane of the coarsest power-of-two grid over the scene bound inside (min, max), so that the clipped references
+// of neighbouring triangles line up with each other and with later split planes
+static float get_split_pos(const AABB &scene_aabb, const AABB &aabb, int dim) {
+	float base = scene_aabb.min[dim], cell = scene_aabb.GetExtent()[dim];
+	for (uint32_t i = 0; i < 24; ++i, cell *= 0.5f) {
+		float pos = base + (std::floor((aabb.min[dim] - base) / cell) + 1.0f) * cell;
+		if (pos < aabb.max[dim])
+			return pos;
+	}
+	return aabb.GetDimCenter(dim);
+}
+
+std::vector<Presplit::Reference> Presplit::Run(const Scene &scene, float threshold) {
+	BuildTrace::Scope trace{"presplit", (uint32_t)scene.GetTriangles().size()};
+	const auto &triangles = scene.GetTriangles();
+
+	std::vector<Reference> ret;
+	ret.reserve(triangles.size());
+	if (threshold <= 0.0f) {
+		for (uint32_t i = 0; i < triangles.size(); ++i)
+			ret.push_back({triangles[i].GetAABB(), i});
+		return ret;
+	}
+
+	struct Item {
+		AABB aabb;
+		uint32_t depth;
+	};
+	std::vector<Item> stack;
+	uint32_t split_tri_count = 0;
+	for (uint32_t i = 0; i < triangles.size(); ++i) {
+		const Triangle &tri = triangles[i];
+		const float max_half_area =
+		    threshold * 0.5f *
+		    glm::length(glm::cross(tri.positions[1] - tri.positions[0], tri.positions[2] - tri.positions[0]));
+
+		// degenerate triangles are never clipped
+		AABB aabb = tri.GetAABB();
+		if (aabb.GetHalfArea() <= max_half_area || max_half_area <= 0.0f) {
+			ret.push_back({aabb, i});
+			continue;
+		}
+
+		++split_tri_count;
+		stack.push_back({aabb, 0});
+		while (!stack.empty()) {
+			Item item = stack.back();
+			stack.pop_back();
+			if (item.depth == kMaxDepth || item.aabb.GetHalfArea() <= max_half_area) {
+				ret.push_back({item.aabb, i});
+				continue;
+			}
+			glm::vec3 extent = item.aabb.GetExtent();
+			int dim = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+			auto [left, right] = clip_triangle(tri, item.aabb, dim, get_split_pos(scene.GetAABB(), item.aabb, dim));
+			// right first so the references come out from left to right
+			if (right.Valid())
+				stack.push_back({right, item.depth + 1});
+			if (left.Valid())
+				stack.push_back({left, item.depth + 1});
+		}
+	}
+	spdlog::info("Pre-split {} of {} triangles into {} references", split_tri_count, triangles.size(), ret.size());
+	return ret;
+}
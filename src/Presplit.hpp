@@ -0,0 +1,24 @@
+#ifndef ADYPT_PRESPLIT_HPP
+#define ADYPT_PRESPLIT_HPP
+
+#include "Scene.hpp"
+#include <cinttypes>
+#include <vector>
+
+// Early split clipping before the builders. Triangles whose AABB half area exceeds threshold times their own area
+// (long diagonal ones) are clipped against axis-aligned planes into tighter references of the same triangle, so
+// object splits find much of what spatial splits would.
+class Presplit {
+public:
+	struct Reference {
+		AABB aabb;
+		uint32_t tri_idx{};
+	};
+	// a triangle is clipped into at most 2^kMaxDepth references
+	static constexpr uint32_t kMaxDepth = 6;
+
+	// the references of every triangle in triangle order, a threshold <= 0 gives one unclipped reference each
+	static std::vector<Reference> Run(const Scene &scene, float threshold);
+};
+
+#endif
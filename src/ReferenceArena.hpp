@@ -0,0 +1,116 @@
+#ifndef ADYPT_REFERENCEARENA_HPP
+#define ADYPT_REFERENCEARENA_HPP
+
+#include "AtomicAllocator.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cinttypes>
+#include <utility>
+#include <vector>
+
+// Reference indices of a build task, a range handed out by a ReferenceArena. It moves like a std::vector, but never
+// allocates or frees by itself: growing and giving the range back go through the arena.
+class ReferenceList {
+private:
+	uint32_t *m_data{};
+	uint32_t m_size{}, m_capacity{};
+
+	friend class ReferenceArena;
+	inline ReferenceList(uint32_t *data, uint32_t size, uint32_t capacity)
+	    : m_data{data}, m_size{size}, m_capacity{capacity} {}
+
+public:
+	inline ReferenceList() = default;
+	ReferenceList(const ReferenceList &r) = delete;
+	ReferenceList &operator=(const ReferenceList &r) = delete;
+	inline ReferenceList(ReferenceList &&r) noexcept
+	    : m_data{std::exchange(r.m_data, nullptr)}, m_size{std::exchange(r.m_size, 0)},
+	      m_capacity{std::exchange(r.m_capacity, 0)} {}
+	inline ReferenceList &operator=(ReferenceList &&r) noexcept {
+		assert(!m_data); // released or moved from, the range would leak otherwise
+		m_data = std::exchange(r.m_data, nullptr);
+		m_size = std::exchange(r.m_size, 0);
+		m_capacity = std::exchange(r.m_capacity, 0);
+		return *this;
+	}
+
+	inline uint32_t size() const { return m_size; }
+	inline bool empty() const { return !m_size; }
+	inline uint32_t *data() const { return m_data; }
+	inline uint32_t *begin() const { return m_data; }
+	inline uint32_t *end() const { return m_data + m_size; }
+	inline uint32_t &operator[](uint32_t idx) const { return m_data[idx]; }
+	inline uint32_t &front() const { return m_data[0]; }
+	inline uint32_t &back() const { return m_data[m_size - 1]; }
+	// within the capacity, ReferenceArena::Reserve() grows it
+	inline void push_back(uint32_t ref_idx) {
+		assert(m_size < m_capacity);
+		m_data[m_size++] = ref_idx;
+	}
+	inline void resize(uint32_t size) {
+		assert(size <= m_capacity);
+		m_size = size;
+	}
+};
+
+// Per-thread bump allocator for ReferenceLists over chunks of a shared AtomicBlockAllocator. Ranges have power of two
+// capacities, and released ones are kept on a free list per capacity for the next list of that size. The arena of the
+// thread that releases a range takes it, so lists may move between threads with their tasks. The chunks are freed
+// with the AtomicBlockAllocator.
+class ReferenceArena {
+private:
+	static constexpr uint32_t kMinCapacityLog2 = 4;
+
+	LocalBlockAllocator<uint32_t> m_block_allocator;
+	std::array<std::vector<uint32_t *>, 32> m_free_ranges; // indexed by capacity log2
+	uint64_t m_alloc_count{}, m_reuse_count{};
+
+	inline static uint32_t get_capacity_log2(uint32_t size) {
+		uint32_t log2 = kMinCapacityLog2;
+		while ((1u << log2) < size)
+			++log2;
+		return log2;
+	}
+
+public:
+	inline explicit ReferenceArena(AtomicBlockAllocator<uint32_t> &allocator) : m_block_allocator{allocator} {}
+
+	inline ReferenceList Alloc(uint32_t size, uint32_t capacity = 0) {
+		uint32_t log2 = get_capacity_log2(std::max(size, capacity));
+		++m_alloc_count;
+		uint32_t *data;
+		if (auto &free_ranges = m_free_ranges[log2]; !free_ranges.empty()) {
+			data = free_ranges.back();
+			free_ranges.pop_back();
+			++m_reuse_count;
+		} else
+			data = m_block_allocator.Alloc(1u << log2);
+		return {data, size, 1u << log2};
+	}
+	inline ReferenceList Alloc(const uint32_t *first, const uint32_t *last, uint32_t capacity = 0) {
+		ReferenceList list = Alloc(uint32_t(last - first), capacity);
+		std::copy(first, last, list.data());
+		return list;
+	}
+	inline void Release(ReferenceList *p_list) {
+		if (p_list->m_data)
+			m_free_ranges[get_capacity_log2(p_list->m_capacity)].push_back(p_list->m_data);
+		p_list->m_data = nullptr;
+		p_list->m_size = p_list->m_capacity = 0;
+	}
+	// moves the list to a range of at least capacity if it has less
+	inline void Reserve(ReferenceList *p_list, uint32_t capacity) {
+		if (capacity <= p_list->m_capacity)
+			return;
+		ReferenceList list = Alloc(p_list->begin(), p_list->end(), capacity);
+		Release(p_list);
+		*p_list = std::move(list);
+	}
+
+	// lists handed out, and how many of them reused a released range
+	inline uint64_t GetAllocCount() const { return m_alloc_count; }
+	inline uint64_t GetReuseCount() const { return m_reuse_count; }
+};
+
+#endif
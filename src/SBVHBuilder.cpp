@@ -1,4 +1,6 @@
 #include "SBVHBuilder.hpp"
+#include "BuildTrace.hpp"
+#include "Presplit.hpp"
 
 #include <algorithm>
 #include <chrono>
@@ -8,15 +10,10 @@
 #define PARALLEL_SORTER pdqsort_branchless
 #include "ParallelSort.hpp"
 
-template <uint32_t DIM>
-bool SBVHBuilder::reference_cmp(const SBVHBuilder::Reference &l, const SBVHBuilder::Reference &r) {
-	return l.m_aabb.GetDimCenter<DIM>() < r.m_aabb.GetDimCenter<DIM>();
-}
-
 template <uint32_t DIM> void SBVHBuilder::sort_spec(const SBVHBuilder::NodeSpec &t_spec) {
 	if (t_spec.m_ref_num >= 32768)
 		ParallelSort(m_refstack.data() + m_refstack.size() - t_spec.m_ref_num, m_refstack.data() + m_refstack.size(),
-		             reference_cmp<DIM>, std::thread::hardware_concurrency());
+		             reference_cmp<DIM>, m_config.GetThreadCount());
 	else
 		pdqsort(m_refstack.data() + m_refstack.size() - t_spec.m_ref_num, m_refstack.data() + m_refstack.size(),
 		        reference_cmp<DIM>);
@@ -26,7 +23,7 @@ void SBVHBuilder::sort_spec(const SBVHBuilder::NodeSpec &t_spec, uint32_t dim) {
 	if (t_spec.m_ref_num >= 32768)
 		ParallelSort(m_refstack.data() + m_refstack.size() - t_spec.m_ref_num, m_refstack.data() + m_refstack.size(),
 		             dim != 0 ? (dim == 1 ? reference_cmp<1> : reference_cmp<2>) : reference_cmp<0>,
-		             std::thread::hardware_concurrency());
+		             m_config.GetThreadCount());
 	else
 		pdqsort(m_refstack.data() + m_refstack.size() - t_spec.m_ref_num, m_refstack.data() + m_refstack.size(),
 		        dim != 0 ? (dim == 1 ? reference_cmp<1> : reference_cmp<2>) : reference_cmp<0>);
@@ -36,9 +33,18 @@ uint32_t SBVHBuilder::build_leaf(const SBVHBuilder::NodeSpec &t_spec) {
 	uint32_t node = push_node();
 	m_bvh.m_nodes[node].aabb = t_spec.m_aabb;
 	m_bvh.m_nodes[node].left_idx = UINT32_MAX; // mark to -1 for leaf
-	m_bvh.m_nodes[node].tri_idx = m_refstack.back().m_tri_index;
+	// pre-split pieces of one triangle are stored once
+	auto &tri_indices = m_bvh.m_tri_indices;
+	const auto tri_begin = (uint32_t)tri_indices.size();
+	for (uint32_t i = get_ref_index(t_spec); i < m_refstack.size(); ++i) {
+		uint32_t tri_idx = m_refstack[i].tri_idx;
+		if (std::find(tri_indices.begin() + tri_begin, tri_indices.end(), tri_idx) == tri_indices.end())
+			tri_indices.push_back(tri_idx);
+	}
+	m_bvh.m_nodes[node].tri_begin = tri_begin;
+	m_bvh.m_nodes[node].tri_count = tri_indices.size() - tri_begin;
 	++m_bvh.m_leaf_cnt;
-	m_refstack.pop_back();
+	m_refstack.resize(get_ref_index(t_spec));
 	return node;
 }
 
@@ -49,22 +55,22 @@ void SBVHBuilder::_find_object_split_dim(const SBVHBuilder::NodeSpec &t_spec, SB
 
 	// get the aabb from right
 	m_right_aabbs.resize((size_t)t_spec.m_ref_num);
-	m_right_aabbs[t_spec.m_ref_num - 1] = refs[t_spec.m_ref_num - 1].m_aabb;
+	m_right_aabbs[t_spec.m_ref_num - 1] = refs[t_spec.m_ref_num - 1].aabb;
 	for (uint32_t i = t_spec.m_ref_num - 2; i >= 1; --i)
-		m_right_aabbs[i] = AABB(refs[i].m_aabb, m_right_aabbs[i + 1]);
+		m_right_aabbs[i] = AABB(refs[i].aabb, m_right_aabbs[i + 1]);
 
-	AABB left_aabb = refs->m_aabb;
+	AABB left_aabb = refs->aabb;
 	for (uint32_t i = 1; i <= t_spec.m_ref_num - 1; ++i) {
 		float sah = float(i) * left_aabb.GetHalfArea() + float(t_spec.m_ref_num - i) * m_right_aabbs[i].GetHalfArea();
 		if (sah < t_os->sah) {
 			t_os->dim = DIM;
-			t_os->pos = (refs[i - 1].m_aabb.GetDimCenter<DIM>() + refs[i].m_aabb.GetDimCenter<DIM>()) * 0.5f;
+			t_os->pos = (refs[i - 1].aabb.GetDimCenter<DIM>() + refs[i].aabb.GetDimCenter<DIM>()) * 0.5f;
 			t_os->left_aabb = left_aabb;
 			t_os->right_aabb = m_right_aabbs[i];
 			t_os->sah = sah;
 		}
 
-		left_aabb.Expand(refs[i].m_aabb);
+		left_aabb.Expand(refs[i].aabb);
 	}
 }
 
@@ -78,33 +84,33 @@ void SBVHBuilder::find_object_split(const SBVHBuilder::NodeSpec &t_spec, SBVHBui
 
 void SBVHBuilder::split_reference(const SBVHBuilder::Reference &t_ref, uint32_t t_dim, float t_pos,
                                   SBVHBuilder::Reference *t_left, SBVHBuilder::Reference *t_right)
-// if the part is invalid, set m_tri_index to -1
+// if the part is invalid, set tri_idx to -1
 {
-	t_left->m_aabb = t_right->m_aabb = AABB();
-	t_left->m_tri_index = t_right->m_tri_index = t_ref.m_tri_index;
+	t_left->aabb = t_right->aabb = AABB();
+	t_left->tri_idx = t_right->tri_idx = t_ref.tri_idx;
 
-	const Triangle &tri = m_scene.GetTriangles()[t_ref.m_tri_index];
+	const Triangle &tri = m_scene.GetTriangles()[t_ref.tri_idx];
 	for (uint32_t i = 0; i < 3; ++i) {
 		const glm::vec3 &v0 = tri.positions[i], &v1 = tri.positions[(i + 1) % 3];
 		float p0 = v0[(int)t_dim], p1 = v1[(int)t_dim];
 		if (p0 <= t_pos)
-			t_left->m_aabb.Expand(v0);
+			t_left->aabb.Expand(v0);
 		if (p0 >= t_pos)
-			t_right->m_aabb.Expand(v0);
+			t_right->aabb.Expand(v0);
 
 		if ((p0 < t_pos && t_pos < p1) || (p1 < t_pos && t_pos < p0)) // process edge
 		{
 			glm::vec3 x = glm::mix(v0, v1, glm::clamp((t_pos - p0) / (p1 - p0), 0.0f, 1.0f));
-			t_left->m_aabb.Expand(x);
-			t_right->m_aabb.Expand(x);
+			t_left->aabb.Expand(x);
+			t_right->aabb.Expand(x);
 		}
 	}
 
-	t_left->m_aabb.max[(int)t_dim] = t_pos;
-	t_left->m_aabb.IntersectAABB(t_ref.m_aabb);
+	t_left->aabb.max[(int)t_dim] = t_pos;
+	t_left->aabb.IntersectAABB(t_ref.aabb);
 
-	t_right->m_aabb.min[(int)t_dim] = t_pos;
-	t_right->m_aabb.IntersectAABB(t_ref.m_aabb);
+	t_right->aabb.min[(int)t_dim] = t_pos;
+	t_right->aabb.IntersectAABB(t_ref.aabb);
 }
 
 template <uint32_t DIM>
@@ -119,17 +125,17 @@ void SBVHBuilder::_find_spatial_split_dim(const SBVHBuilder::NodeSpec &t_spec, S
 	// put references into bins
 	for (uint32_t i = 0; i < t_spec.m_ref_num; ++i) {
 		uint32_t bin =
-		    glm::clamp(uint32_t((refs[i].m_aabb.min[DIM] - bound_base) * inv_bin_width), 0u, kSpatialBinNum - 1);
+		    glm::clamp(uint32_t((refs[i].aabb.min[DIM] - bound_base) * inv_bin_width), 0u, kSpatialBinNum - 1);
 		uint32_t last_bin =
-		    glm::clamp(uint32_t((refs[i].m_aabb.max[DIM] - bound_base) * inv_bin_width), 0u, kSpatialBinNum - 1);
+		    glm::clamp(uint32_t((refs[i].aabb.max[DIM] - bound_base) * inv_bin_width), 0u, kSpatialBinNum - 1);
 		m_spatial_bins[bin].m_in++;
 		cur_ref = refs[i];
 		for (; bin < last_bin; ++bin) {
 			split_reference(cur_ref, DIM, float(bin + 1) * bin_width + bound_base, &left_ref, &right_ref);
-			m_spatial_bins[bin].m_aabb.Expand(left_ref.m_aabb);
+			m_spatial_bins[bin].m_aabb.Expand(left_ref.aabb);
 			cur_ref = right_ref;
 		}
-		m_spatial_bins[last_bin].m_aabb.Expand(cur_ref.m_aabb);
+		m_spatial_bins[last_bin].m_aabb.Expand(cur_ref.aabb);
 		m_spatial_bins[last_bin].m_out++;
 	}
 
@@ -164,8 +170,8 @@ void SBVHBuilder::find_spatial_split(const SBVHBuilder::NodeSpec &t_spec, SBVHBu
 	_find_spatial_split_dim<2>(t_spec, t_ss);
 }
 
-void SBVHBuilder::perform_spatial_split(const SBVHBuilder::NodeSpec &t_spec, const SBVHBuilder::SpatialSplit &t_ss,
-                                        SBVHBuilder::NodeSpec *t_left, SBVHBuilder::NodeSpec *t_right) {
+uint32_t SBVHBuilder::perform_spatial_split(const SBVHBuilder::NodeSpec &t_spec, const SBVHBuilder::SpatialSplit &t_ss,
+                                            SBVHBuilder::NodeSpec *t_left, SBVHBuilder::NodeSpec *t_right) {
 	t_left->m_aabb = t_right->m_aabb = AABB();
 
 	uint32_t refs = get_ref_index(t_spec);
@@ -176,16 +182,19 @@ void SBVHBuilder::perform_spatial_split(const SBVHBuilder::NodeSpec &t_spec, con
 	uint32_t left_begin = 0, left_end = 0, right_begin = t_spec.m_ref_num, right_end = t_spec.m_ref_num;
 	for (uint32_t i = left_begin; i < right_begin; ++i) {
 		// put to left
-		if (m_refstack[refs + i].m_aabb.max[(int)t_ss.m_dim] <= t_ss.m_pos) {
-			t_left->m_aabb.Expand(m_refstack[refs + i].m_aabb);
+		if (m_refstack[refs + i].aabb.max[(int)t_ss.m_dim] <= t_ss.m_pos) {
+			t_left->m_aabb.Expand(m_refstack[refs + i].aabb);
 			std::swap(m_refstack[refs + i], m_refstack[refs + (left_end++)]);
-		} else if (m_refstack[refs + i].m_aabb.min[(int)t_ss.m_dim] >= t_ss.m_pos) {
-			t_right->m_aabb.Expand(m_refstack[refs + i].m_aabb);
+		} else if (m_refstack[refs + i].aabb.min[(int)t_ss.m_dim] >= t_ss.m_pos) {
+			t_right->m_aabb.Expand(m_refstack[refs + i].aabb);
 			std::swap(m_refstack[refs + (i--)], m_refstack[refs + (--right_begin)]);
 		}
 	}
+	if (right_begin - left_end > t_spec.m_duplicate_budget)
+		return 0;
 
 	Reference left_ref, right_ref;
+	uint32_t unsplit_num = 0;
 
 	AABB lub; // Unsplit to left:     new left-hand bounds.
 	AABB rub; // Unsplit to right:    new right-hand bounds.
@@ -198,10 +207,10 @@ void SBVHBuilder::perform_spatial_split(const SBVHBuilder::NodeSpec &t_spec, con
 		lub = ldb = t_left->m_aabb;
 		rub = rdb = t_right->m_aabb;
 
-		lub.Expand(m_refstack[refs + left_end].m_aabb);
-		rub.Expand(m_refstack[refs + left_end].m_aabb);
-		ldb.Expand(left_ref.m_aabb);
-		rdb.Expand(right_ref.m_aabb);
+		lub.Expand(m_refstack[refs + left_end].aabb);
+		rub.Expand(m_refstack[refs + left_end].aabb);
+		ldb.Expand(left_ref.aabb);
+		rdb.Expand(right_ref.aabb);
 
 		auto lac = float(left_end - left_begin);
 		auto rac = float(right_end - right_begin);
@@ -215,9 +224,11 @@ void SBVHBuilder::perform_spatial_split(const SBVHBuilder::NodeSpec &t_spec, con
 		if (unsplit_left_sah < unsplit_right_sah && unsplit_left_sah < duplicate_sah) { // unsplit left
 			t_left->m_aabb = lub;
 			left_end++;
+			++unsplit_num;
 		} else if (unsplit_right_sah < duplicate_sah) { // unsplit right
 			t_right->m_aabb = rub;
 			std::swap(m_refstack[refs + left_end], m_refstack[refs + (--right_begin)]);
+			++unsplit_num;
 		} else { // duplicate
 			m_refstack.emplace_back();
 			t_left->m_aabb = ldb;
@@ -229,6 +240,7 @@ void SBVHBuilder::perform_spatial_split(const SBVHBuilder::NodeSpec &t_spec, con
 
 	t_left->m_ref_num = left_end - left_begin;
 	t_right->m_ref_num = right_end - right_begin;
+	return unsplit_num;
 }
 
 void SBVHBuilder::perform_object_split(const SBVHBuilder::NodeSpec &t_spec, const SBVHBuilder::ObjectSplit &t_os,
@@ -244,19 +256,19 @@ void SBVHBuilder::perform_object_split(const SBVHBuilder::NodeSpec &t_spec, cons
 	const uint32_t left_begin = 0, right_end = t_spec.m_ref_num;
 	uint32_t left_end = 0, right_begin = t_spec.m_ref_num;
 	for (uint32_t i = left_begin; i < right_begin; ++i) {
-		float c = m_refstack[refs + i].m_aabb.GetDimCenter((int)t_os.dim);
+		float c = m_refstack[refs + i].aabb.GetDimCenter((int)t_os.dim);
 		if (c < t_os.pos) {
-			t_left->m_aabb.Expand(m_refstack[refs + i].m_aabb);
+			t_left->m_aabb.Expand(m_refstack[refs + i].aabb);
 			std::swap(m_refstack[refs + i], m_refstack[refs + (left_end++)]);
 		} else if (c > t_os.pos) {
-			t_right->m_aabb.Expand(m_refstack[refs + i].m_aabb);
+			t_right->m_aabb.Expand(m_refstack[refs + i].aabb);
 			std::swap(m_refstack[refs + (i--)], m_refstack[refs + (--right_begin)]);
 		}
 	}
 
 	while (left_end < right_begin) {
-		AABB lb = AABB{t_left->m_aabb, m_refstack[refs + left_end].m_aabb};
-		AABB rb = AABB{t_right->m_aabb, m_refstack[refs + left_end].m_aabb};
+		AABB lb = AABB{t_left->m_aabb, m_refstack[refs + left_end].aabb};
+		AABB rb = AABB{t_right->m_aabb, m_refstack[refs + left_end].aabb};
 
 		float left_sah = lb.GetHalfArea() * float(1 + left_end - left_begin) +
 		                 t_right->m_aabb.GetHalfArea() * float(right_end - right_begin);
@@ -276,15 +288,21 @@ void SBVHBuilder::perform_object_split(const SBVHBuilder::NodeSpec &t_spec, cons
 }
 
 uint32_t SBVHBuilder::build_node(const NodeSpec &t_spec, uint32_t t_depth) {
-	if (t_spec.m_ref_num == 1)
+	if (t_spec.m_ref_num == 1) {
+		m_bvh.m_build_stats.AddLeaf(t_depth);
 		return build_leaf(t_spec);
+	}
 
 	ObjectSplit object_split;
 	find_object_split(t_spec, &object_split);
+	if (m_config.IsLeafCheaper(t_spec.m_ref_num, t_spec.m_aabb.GetHalfArea(), object_split.sah)) {
+		m_bvh.m_build_stats.AddLeaf(t_depth);
+		return build_leaf(t_spec);
+	}
 
 	SpatialSplit spatial_split{};
 	spatial_split.m_sah = FLT_MAX;
-	if (t_depth <= m_config.m_max_spatial_depth) {
+	if (t_depth <= m_config.m_max_spatial_depth && t_spec.m_duplicate_budget) {
 		AABB overlap = object_split.left_aabb;
 		overlap.IntersectAABB(object_split.right_aabb);
 		if (overlap.GetHalfArea() >= m_min_overlap_area)
@@ -296,11 +314,22 @@ uint32_t SBVHBuilder::build_node(const NodeSpec &t_spec, uint32_t t_depth) {
 
 	NodeSpec left, right;
 	left.m_ref_num = right.m_ref_num = 0;
+	uint32_t duplicate_count = 0;
+	uint32_t unsplit_num = 0;
 	if (spatial_split.m_sah < object_split.sah)
-		perform_spatial_split(t_spec, spatial_split, &left, &right);
+		unsplit_num = perform_spatial_split(t_spec, spatial_split, &left, &right);
 
-	if (left.m_ref_num == 0 || right.m_ref_num == 0)
+	if (left.m_ref_num == 0 || right.m_ref_num == 0) {
 		perform_object_split(t_spec, object_split, &left, &right);
+		m_bvh.m_build_stats.AddSplit(BuildStats::kObjectSplit, t_depth);
+	} else {
+		duplicate_count = left.m_ref_num + right.m_ref_num - t_spec.m_ref_num;
+		m_bvh.m_build_stats.AddSplit(BuildStats::kSpatialSplit, t_depth);
+		m_bvh.m_build_stats.AddDuplicates(t_depth, duplicate_count);
+		m_bvh.m_build_stats.AddUnsplits(t_depth, unsplit_num);
+	}
+	std::tie(left.m_duplicate_budget, right.m_duplicate_budget) = BVHConfig::ShareDuplicateBudget(
+	    t_spec.m_duplicate_budget, duplicate_count, left.m_ref_num, right.m_ref_num);
 
 	build_node(right, t_depth + 1);
 	// use a temp variable to get the return value()
@@ -311,23 +340,31 @@ uint32_t SBVHBuilder::build_node(const NodeSpec &t_spec, uint32_t t_depth) {
 }
 
 void SBVHBuilder::Run() {
+	BuildTrace::Scope trace{"sbvh_build", (uint32_t)m_scene.GetTriangles().size()};
 	m_right_aabbs.reserve(m_scene.GetTriangles().size());
 
+	auto start = std::chrono::steady_clock::now();
 	// init reference stack
-	m_refstack.reserve(m_scene.GetTriangles().size() * 2);
-	m_refstack.resize(m_scene.GetTriangles().size());
-	for (uint32_t i = 0; i < m_scene.GetTriangles().size(); ++i) {
-		m_refstack[i].m_tri_index = i;
-		m_refstack[i].m_aabb = m_scene.GetTriangles()[i].GetAABB();
+	std::vector<Presplit::Reference> presplit_refs = Presplit::Run(m_scene, m_config.m_presplit_threshold);
+	const auto triangle_count = (uint32_t)m_scene.GetTriangles().size();
+	const auto reference_count = (uint32_t)presplit_refs.size();
+	m_refstack.reserve(reference_count * 2);
+	m_refstack.resize(reference_count);
+	for (uint32_t i = 0; i < reference_count; ++i) {
+		m_refstack[i].tri_idx = presplit_refs[i].tri_idx;
+		m_refstack[i].aabb = presplit_refs[i].aabb;
 	}
 
-	m_bvh.m_nodes.reserve(m_scene.GetTriangles().size() * 2);
+	m_bvh.m_nodes.reserve(reference_count * 2);
+	m_bvh.m_tri_indices.reserve(reference_count);
+	m_bvh.m_build_stats.m_triangle_count = triangle_count;
+	m_bvh.m_build_stats.m_presplit_references = reference_count - triangle_count;
 
-	auto start = std::chrono::steady_clock::now();
-	build_node({m_scene.GetAABB(), (uint32_t)m_scene.GetTriangles().size()}, 0);
+	build_node({m_scene.GetAABB(), reference_count, m_config.GetDuplicateBudget(triangle_count, reference_count)}, 0);
 
 	auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
 	spdlog::info("SBVH built with {} nodes in {} ms", m_bvh.m_nodes.size(), duration.count());
 
 	m_bvh.m_nodes.shrink_to_fit();
+	m_bvh.m_tri_indices.shrink_to_fit();
 }
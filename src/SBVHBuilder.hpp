@@ -2,6 +2,7 @@
 #define SBVH_HPP
 
 #include "BVHConfig.hpp"
+#include "BuildReference.hpp"
 #include "FlatBinaryBVH.hpp"
 #include "Scene.hpp"
 #include <memory>
@@ -14,13 +15,11 @@ public:
 private:
 	static constexpr uint32_t kSpatialBinNum = 32;
 
-	struct Reference {
-		AABB m_aabb;
-		uint32_t m_tri_index{};
-	};
+	using Reference = FloatBuildReference;
 	struct NodeSpec {
 		AABB m_aabb;
 		uint32_t m_ref_num{};
+		uint32_t m_duplicate_budget{BVHConfig::kUnlimitedDuplicates}; // references spatial splits may add below
 	};
 	struct ObjectSplit {
 		AABB left_aabb, right_aabb;
@@ -48,7 +47,9 @@ private:
 	float m_min_overlap_area;
 
 	// for std::sort
-	template <uint32_t DIM> inline static bool reference_cmp(const Reference &l, const Reference &r);
+	template <uint32_t DIM> inline static bool reference_cmp(const Reference &l, const Reference &r) {
+		return FloatReferenceCodec::IsCenterLess<DIM>(l, r);
+	}
 	template <uint32_t DIM> inline void sort_spec(const NodeSpec &t_spec);
 	inline void sort_spec(const NodeSpec &t_spec, uint32_t dim);
 	inline uint32_t get_ref_index(const NodeSpec &t_spec) { return (uint32_t)m_refstack.size() - t_spec.m_ref_num; }
@@ -62,8 +63,10 @@ private:
 	                            Reference *t_right);
 	template <uint32_t DIM> inline void _find_spatial_split_dim(const NodeSpec &t_spec, SpatialSplit *t_ss);
 	inline void find_spatial_split(const NodeSpec &t_spec, SpatialSplit *t_ss);
-	inline void perform_spatial_split(const NodeSpec &t_spec, const SpatialSplit &t_ss, NodeSpec *t_left,
-	                                  NodeSpec *t_right);
+	// returns the number of straddling references moved to one side instead of being duplicated, leaves both
+	// children empty if the straddling references exceed the duplication budget
+	inline uint32_t perform_spatial_split(const NodeSpec &t_spec, const SpatialSplit &t_ss, NodeSpec *t_left,
+	                                      NodeSpec *t_right);
 	uint32_t build_node(const NodeSpec &t_spec, uint32_t t_depth);
 	inline uint32_t push_node() {
 		m_bvh.m_nodes.emplace_back();
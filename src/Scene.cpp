@@ -1,9 +1,14 @@
 #include "Scene.hpp"
+#include "BuildTrace.hpp"
 #include "../shader/compress.glsl"
+#include <algorithm>
+#include <future>
 #include <spdlog/spdlog.h>
+#include <thread>
 #include <tiny_obj_loader.h>
 
 std::shared_ptr<Scene> Scene::CreateFromFile(const char *filename) {
+	BuildTrace::Scope trace{"scene_load"};
 	std::shared_ptr<Scene> ret = std::make_shared<Scene>();
 	// get base dir
 	{
@@ -29,10 +34,13 @@ std::shared_ptr<Scene> Scene::CreateFromFile(const char *filename) {
 	bool noMaterials;
 
 	std::string load_warnings, load_errors;
-	if (!tinyobj::LoadObj(&attrib, &shapes, &ret->m_materials, &load_warnings, &load_errors, filename,
-	                      ret->m_base_dir.c_str())) {
-		spdlog::error("Failed to load {}", filename);
-		return nullptr;
+	{
+		BuildTrace::Scope parse_trace{"obj_parse"};
+		if (!tinyobj::LoadObj(&attrib, &shapes, &ret->m_materials, &load_warnings, &load_errors, filename,
+		                      ret->m_base_dir.c_str())) {
+			spdlog::error("Failed to load {}", filename);
+			return nullptr;
+		}
 	}
 
 	if (noMaterials = ret->m_materials.empty()) {
@@ -47,28 +55,83 @@ std::shared_ptr<Scene> Scene::CreateFromFile(const char *filename) {
 		spdlog::warn("{}", load_warnings.c_str());
 	}
 
-	ret->extract_shapes(attrib, shapes, noMaterials);
-	ret->normalize();
+	{
+		BuildTrace::Scope extract_trace{"extract_shapes"};
+		ret->extract_shapes(attrib, shapes, noMaterials);
+	}
+	{
+		BuildTrace::Scope normalize_trace{"normalize", (uint32_t)ret->m_triangles.size()};
+		ret->normalize();
+	}
 
 	spdlog::info("{} triangles loaded from {}", ret->m_triangles.size(), filename);
 
 	return ret;
 }
 
+std::shared_ptr<Scene> Scene::CreateFromTriangles(std::vector<Triangle> &&triangles) {
+	BuildTrace::Scope trace{"scene_pack", (uint32_t)triangles.size()};
+	std::shared_ptr<Scene> ret = std::make_shared<Scene>();
+
+	tinyobj::material_t material;
+	material.diffuse[0] = material.diffuse[1] = material.diffuse[2] = 0.5f;
+	ret->m_materials.push_back(material);
+
+	ret->m_triangles = std::move(triangles);
+	ret->m_trianglesPkd.resize(ret->m_triangles.size());
+	if (!ret->m_triangles.empty())
+		ret->m_shape_begins.push_back(0);
+
+	// packing dominates for large generated scenes, split it into contiguous chunks
+	uint32_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+	size_t chunk_size = (ret->m_triangles.size() + thread_count - 1) / thread_count;
+	std::vector<std::future<AABB>> futures;
+	for (size_t begin = 0; begin < ret->m_triangles.size(); begin += chunk_size) {
+		size_t end = std::min(begin + chunk_size, ret->m_triangles.size());
+		futures.push_back(std::async(std::launch::async, [&ret, begin, end]() {
+			AABB aabb;
+			const glm::vec2 texcoords[3] = {};
+			for (size_t i = begin; i < end; ++i) {
+				const Triangle &tri = ret->m_triangles[i];
+				glm::vec3 normal = glm::normalize(
+				    glm::cross(tri.positions[1] - tri.positions[0], tri.positions[2] - tri.positions[0]));
+				const glm::vec3 normals[3] = {normal, normal, normal};
+				ret->m_trianglesPkd[i] = pack_triangle(tri.positions, normals, texcoords, 0);
+				aabb.Expand(tri.GetAABB());
+			}
+			return aabb;
+		}));
+	}
+	for (auto &f : futures)
+		ret->m_aabb.Expand(f.get());
+	ret->normalize();
+
+	spdlog::info("{} triangles generated", ret->m_triangles.size());
+
+	return ret;
+}
+
+bool Scene::UpdateTriangles(const std::vector<Triangle> &triangles) {
+	if (triangles.size() != m_triangles.size()) {
+		spdlog::error("Expected {} triangles to update, got {}", m_triangles.size(), triangles.size());
+		return false;
+	}
+	m_triangles = triangles;
+	m_aabb = AABB{};
+	for (const Triangle &tri : m_triangles)
+		m_aabb.Expand(tri.GetAABB());
+	return true;
+}
+
 void Scene::extract_shapes(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::shape_t> &shapes, const bool noMaterials) {
 	bool gen_normal_warn = false;
 	size_t i3;
-	glm::vec3 positions[3], normals[3], delta;
+	glm::vec3 positions[3], normals[3];
 	glm::vec2 texcoords[3];
-	float len;
-	
-	float m_p1l, m_p2l, m_p3l;
-	
-	TrianglePkd triPkd;
-	
 	// Loop over shapes
 	for (const auto &shape : shapes) {
 		size_t index_offset = 0, face = 0;
+		auto shape_begin = (uint32_t)m_triangles.size();
 
 		// Loop over faces(polygon)
 		for (const auto &num_face_vertex : shape.mesh.num_face_vertices) {
@@ -155,60 +218,72 @@ void Scene::extract_shapes(const tinyobj::attrib_t &attrib, const std::vector<ti
 					tri.positions[1] = positions[1];
 					tri.positions[2] = positions[2];
 
-					//save packed triangle data
-					triPkd.m_material_id = noMaterials ? 0 : shape.mesh.material_ids[face];
-
-					//calculate compressed version of positions, texture coords, normals
-					len = glm::length(positions[0]);
-					triPkd.m_p1v = compress_unit_vec( positions[0] / len );
-					m_p1l = len;
-
-					delta = positions[1] - positions[0];
-					len = glm::length(delta);
-					triPkd.m_p2v = compress_unit_vec( delta / len );
-					m_p2l = len;
-
-					delta = positions[2] - positions[0];
-					len = glm::length(delta);
-					triPkd.m_p3v = compress_unit_vec( delta / len );
-					m_p3l = len;
-
-					delta = vec3(m_p1l, m_p2l, m_p3l);
-					len = glm::length(delta);
-					triPkd.m_ppp = compress_unit_vec( delta / len );
-					m_p3l = len;
-
-					triPkd.m_n1 = compress_unit_vec( normals[0] );
-					triPkd.m_n2 = compress_unit_vec( normals[1] );
-					triPkd.m_n3 = compress_unit_vec( normals[2] );
-
-					delta = vec3(texcoords[0][0], texcoords[0][1], texcoords[1][0]);
-					len = glm::length(delta);
-					triPkd.m_tcP1 = compress_unit_vec( delta / len );
-					m_p1l = len;
-
-					delta = vec3(texcoords[1][1], texcoords[2][0], texcoords[2][1]);
-					len = glm::length(delta);
-					triPkd.m_tcP2 = compress_unit_vec( delta / len );
-					m_p2l = len;
-
-					delta = vec3(m_p1l, m_p2l, m_p3l);
-					len = glm::length(delta);
-					triPkd.m_px = compress_unit_vec( delta / len );
-					triPkd.m_pxl = len;
-
-					m_trianglesPkd.push_back(triPkd);
+					m_trianglesPkd.push_back(pack_triangle(positions, normals, texcoords,
+					                                       noMaterials ? 0 : shape.mesh.material_ids[face]));
 				}
 				m_aabb.Expand(tri.GetAABB());
 			}
 			index_offset += num_face_vertex;
 			face++;
 		}
+		if (m_triangles.size() > shape_begin)
+			m_shape_begins.push_back(shape_begin);
 	}
 	if (gen_normal_warn)
 		spdlog::warn("Missing triangle normal");
 }
 
+TrianglePkd Scene::pack_triangle(const glm::vec3 positions[3], const glm::vec3 normals[3],
+                                 const glm::vec2 texcoords[3], uint32_t material_id) {
+	TrianglePkd triPkd;
+	glm::vec3 delta;
+	float len, m_p1l, m_p2l, m_p3l;
+
+	//save packed triangle data
+	triPkd.m_material_id = material_id;
+
+	//calculate compressed version of positions, texture coords, normals
+	len = glm::length(positions[0]);
+	triPkd.m_p1v = compress_unit_vec( positions[0] / len );
+	m_p1l = len;
+
+	delta = positions[1] - positions[0];
+	len = glm::length(delta);
+	triPkd.m_p2v = compress_unit_vec( delta / len );
+	m_p2l = len;
+
+	delta = positions[2] - positions[0];
+	len = glm::length(delta);
+	triPkd.m_p3v = compress_unit_vec( delta / len );
+	m_p3l = len;
+
+	delta = vec3(m_p1l, m_p2l, m_p3l);
+	len = glm::length(delta);
+	triPkd.m_ppp = compress_unit_vec( delta / len );
+	m_p3l = len;
+
+	triPkd.m_n1 = compress_unit_vec( normals[0] );
+	triPkd.m_n2 = compress_unit_vec( normals[1] );
+	triPkd.m_n3 = compress_unit_vec( normals[2] );
+
+	delta = vec3(texcoords[0][0], texcoords[0][1], texcoords[1][0]);
+	len = glm::length(delta);
+	triPkd.m_tcP1 = compress_unit_vec( delta / len );
+	m_p1l = len;
+
+	delta = vec3(texcoords[1][1], texcoords[2][0], texcoords[2][1]);
+	len = glm::length(delta);
+	triPkd.m_tcP2 = compress_unit_vec( delta / len );
+	m_p2l = len;
+
+	delta = vec3(m_p1l, m_p2l, m_p3l);
+	len = glm::length(delta);
+	triPkd.m_px = compress_unit_vec( delta / len );
+	triPkd.m_pxl = len;
+
+	return triPkd;
+}
+
 void Scene::normalize() {
 	glm::vec3 extent3 = m_aabb.GetExtent();
 	float extent = glm::max(extent3.x, glm::max(extent3.y, extent3.z)) * 0.5f;
@@ -12,20 +12,30 @@ private:
 	std::vector<Triangle> m_triangles;
 	std::vector<TrianglePkd> m_trianglesPkd;
 	AABB m_aabb{};
+	std::vector<uint32_t> m_shape_begins; // first triangle of every non-empty shape
 	std::vector<tinyobj::material_t> m_materials;
 	std::string m_base_dir;
 
 	void extract_shapes(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::shape_t> &shapes, const bool noMaterials);
 	void normalize();
+	static TrianglePkd pack_triangle(const glm::vec3 positions[3], const glm::vec3 normals[3],
+	                                 const glm::vec2 texcoords[3], uint32_t material_id);
 
 public:
 	static std::shared_ptr<Scene> CreateFromFile(const char *filename);
+	// triangles with flat normals and a single default material, normalized like loaded scenes
+	static std::shared_ptr<Scene> CreateFromTriangles(std::vector<Triangle> &&triangles);
 
 	const std::vector<Triangle> &GetTriangles() const { return m_triangles; }
 	void clearTriangles() { 
 		m_triangles.clear(); 
 		m_triangles.shrink_to_fit();
 	}
+	// New positions of the same triangles in the same (normalized) space, for refitting an animated scene. Returns
+	// false if the count differs. The packed shading triangles keep the positions they were loaded with.
+	bool UpdateTriangles(const std::vector<Triangle> &triangles);
+	// the triangles of an OBJ shape are contiguous, generated scenes are one shape
+	const std::vector<uint32_t> &GetShapeBegins() const { return m_shape_begins; }
 	const std::vector<TrianglePkd> &GetTrianglesPkd() const { return m_trianglesPkd; }
 	const std::vector<tinyobj::material_t> &GetTinyobjMaterials() const { return m_materials; }
 	const std::string &GetBasePath() const { return m_base_dir; };
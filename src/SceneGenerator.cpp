@@ -0,0 +1,232 @@
+#include "SceneGenerator.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <glm/gtc/constants.hpp>
+#include <spdlog/spdlog.h>
+#include <thread>
+
+namespace scene_generator_detail {
+
+// counter based random numbers, so triangles can be generated in any order
+class Random {
+private:
+	uint64_t m_state;
+
+	static uint64_t mix(uint64_t x) {
+		x = (x ^ (x >> 30u)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27u)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31u);
+	}
+
+public:
+	Random(uint64_t seed, uint64_t index) : m_state{mix(seed ^ mix(index + 0x9e3779b97f4a7c15ull))} {}
+	// uniform in [0, 1)
+	float Next() {
+		m_state += 0x9e3779b97f4a7c15ull;
+		return float(mix(m_state) >> 40u) * 0x1p-24f;
+	}
+	float Next(float min, float max) { return min + (max - min) * Next(); }
+	glm::vec3 NextVec3(float min, float max) {
+		float x = Next(min, max), y = Next(min, max);
+		return {x, y, Next(min, max)};
+	}
+	// log-uniform in [min, max)
+	float NextLog(float min, float max) { return min * glm::pow(max / min, Next()); }
+};
+
+// triangle `local` of the unit box [-1, 1]^3 whose faces are split into tess x tess quads (12 * tess^2 triangles)
+static Triangle box_triangle(uint32_t local, uint32_t tess) {
+	uint32_t face = local / (2u * tess * tess), quad = (local >> 1u) % (tess * tess);
+	uint32_t axis = face >> 1u, u_axis = (axis + 1u) % 3u, v_axis = (axis + 2u) % 3u;
+	float sign = face & 1u ? 1.0f : -1.0f, inv_tess = 2.0f / float(tess);
+	float u0 = -1.0f + float(quad % tess) * inv_tess, v0 = -1.0f + float(quad / tess) * inv_tess;
+	auto corner = [&](float u, float v) {
+		glm::vec3 p;
+		p[axis] = sign, p[u_axis] = u, p[v_axis] = v;
+		return p;
+	};
+	Triangle tri;
+	if (local & 1u)
+		tri.positions[0] = corner(u0, v0), tri.positions[1] = corner(u0 + inv_tess, v0 + inv_tess),
+		tri.positions[2] = corner(u0, v0 + inv_tess);
+	else
+		tri.positions[0] = corner(u0, v0), tri.positions[1] = corner(u0 + inv_tess, v0),
+		tri.positions[2] = corner(u0 + inv_tess, v0 + inv_tess);
+	return tri;
+}
+
+// triangle `local` of a (u, v) in [0, 1]^2 surface tessellated into a near square grid of count triangles
+template <class Surface> static Triangle surface_triangle(uint32_t local, uint32_t count, Surface &&surface) {
+	uint32_t quads = (count + 1u) / 2u;
+	auto cols = (uint32_t)glm::ceil(glm::sqrt(float(quads)));
+	uint32_t rows = (quads + cols - 1u) / cols, quad = local >> 1u;
+	float du = 1.0f / float(cols), dv = 1.0f / float(rows);
+	float u0 = float(quad % cols) * du, v0 = float(quad / cols) * dv;
+	Triangle tri;
+	if (local & 1u)
+		tri.positions[0] = surface(u0, v0), tri.positions[1] = surface(u0 + du, v0 + dv),
+		tri.positions[2] = surface(u0, v0 + dv);
+	else
+		tri.positions[0] = surface(u0, v0), tri.positions[1] = surface(u0 + du, v0),
+		tri.positions[2] = surface(u0 + du, v0 + dv);
+	return tri;
+}
+
+static glm::vec3 rotate_y(const glm::vec3 &p, float angle) {
+	float c = glm::cos(angle), s = glm::sin(angle);
+	return {c * p.x + s * p.z, p.y, c * p.z - s * p.x};
+}
+
+static Triangle soup_triangle(uint64_t seed, uint32_t index, uint32_t count) {
+	Random rng{seed, index};
+	float edge = 3.0f / glm::pow(float(count), 1.0f / 3.0f);
+	glm::vec3 center = rng.NextVec3(-1.0f, 1.0f);
+	Triangle tri;
+	for (glm::vec3 &p : tri.positions)
+		p = center + rng.NextVec3(-0.5f, 0.5f) * edge;
+	return tri;
+}
+
+static Triangle skinny_triangle(uint64_t seed, uint32_t index) {
+	Random rng{seed, index};
+	glm::vec3 center = rng.NextVec3(-1.0f, 1.0f);
+	glm::vec3 dir = glm::normalize(rng.NextVec3(-1.0f, 1.0f) + glm::vec3{1e-4f});
+	glm::vec3 perp = glm::normalize(glm::cross(dir, glm::normalize(rng.NextVec3(-1.0f, 1.0f) + glm::vec3{1e-4f})));
+	float length = rng.Next(0.2f, 1.0f);
+	Triangle tri;
+	tri.positions[0] = center - dir * (length * 0.5f);
+	tri.positions[1] = center + dir * (length * 0.5f);
+	tri.positions[2] = center + perp * (length * 1e-3f);
+	return tri;
+}
+
+static Triangle grid_triangle(uint64_t seed, uint32_t index, uint32_t count) {
+	constexpr uint32_t kTess = 4, kInstanceTriangles = 12 * kTess * kTess;
+	uint32_t instance_count = (count + kInstanceTriangles - 1) / kInstanceTriangles;
+	auto dim = (uint32_t)glm::ceil(glm::pow(float(instance_count), 1.0f / 3.0f) - 1e-3f);
+	uint32_t instance = index / kInstanceTriangles;
+	float cell = 2.0f / float(dim);
+	glm::vec3 cell_idx{float(instance % dim), float((instance / dim) % dim), float(instance / (dim * dim))};
+	glm::vec3 center = cell_idx * cell + (cell * 0.5f - 1.0f);
+
+	Random rng{seed, instance};
+	float angle = rng.Next(0.0f, glm::two_pi<float>());
+	Triangle tri = box_triangle(index % kInstanceTriangles, kTess);
+	for (glm::vec3 &p : tri.positions)
+		p = center + rotate_y(p * (cell * 0.35f), angle);
+	return tri;
+}
+
+// a hall along x, 6 walls, 2 rows of columns and boxes scattered over the floor
+static Triangle architecture_triangle(uint64_t seed, uint32_t index, uint32_t count) {
+	constexpr float kHalfLength = 1.0f, kHalfWidth = 0.4f, kHeight = 0.7f, kColumnRadius = 0.04f;
+	constexpr uint32_t kColumnsPerRow = 8, kColumnCount = 2 * kColumnsPerRow;
+
+	uint32_t wall_count = count / 40u, column_count = count / 36u; // 15% walls, 45% columns
+	uint32_t clutter_begin = 6u * wall_count + kColumnCount * column_count;
+
+	if (index < 6u * wall_count) {
+		uint32_t wall = index / wall_count;
+		return surface_triangle(index % wall_count, wall_count, [wall](float u, float v) {
+			float a = (u * 2.0f - 1.0f), b = v;
+			switch (wall) {
+			case 0: // floor
+				return glm::vec3{a * kHalfLength, 0.0f, (b * 2.0f - 1.0f) * kHalfWidth};
+			case 1: // ceiling
+				return glm::vec3{a * kHalfLength, kHeight, (b * 2.0f - 1.0f) * kHalfWidth};
+			case 2:
+				return glm::vec3{a * kHalfLength, b * kHeight, -kHalfWidth};
+			case 3:
+				return glm::vec3{a * kHalfLength, b * kHeight, kHalfWidth};
+			case 4:
+				return glm::vec3{-kHalfLength, b * kHeight, a * kHalfWidth};
+			default:
+				return glm::vec3{kHalfLength, b * kHeight, a * kHalfWidth};
+			}
+		});
+	}
+	if (index < clutter_begin) {
+		uint32_t local = index - 6u * wall_count, column = local / column_count;
+		float x = (float(column % kColumnsPerRow) + 0.5f) / float(kColumnsPerRow) * 2.0f * kHalfLength - kHalfLength;
+		float z = column < kColumnsPerRow ? -0.6f * kHalfWidth : 0.6f * kHalfWidth;
+		return surface_triangle(local % column_count, column_count, [x, z](float u, float v) {
+			float angle = u * glm::two_pi<float>();
+			return glm::vec3{x + glm::cos(angle) * kColumnRadius, v * kHeight, z + glm::sin(angle) * kColumnRadius};
+		});
+	}
+	uint32_t box = (index - clutter_begin) / 12u;
+	Random rng{seed, box};
+	float size = rng.NextLog(0.005f, 0.08f), angle = rng.Next(0.0f, glm::two_pi<float>());
+	glm::vec3 center{rng.Next(-kHalfLength, kHalfLength), size, rng.Next(-kHalfWidth, kHalfWidth)};
+	Triangle tri = box_triangle((index - clutter_begin) % 12u, 1);
+	for (glm::vec3 &p : tri.positions)
+		p = center + rotate_y(p * size, angle);
+	return tri;
+}
+
+static Triangle size_variance_triangle(uint64_t seed, uint32_t index) {
+	Random rng{seed, index};
+	glm::vec3 center = rng.NextVec3(-1.0f, 1.0f);
+	// sizes from 1e-4 to 1, mostly tiny with about 5% above 0.1
+	float size = glm::pow(10.0f, -4.0f + 4.0f * glm::pow(rng.Next(), 6.0f));
+	Triangle tri;
+	for (glm::vec3 &p : tri.positions)
+		p = center + rng.NextVec3(-1.0f, 1.0f) * size;
+	return tri;
+}
+
+} // namespace scene_generator_detail
+
+const char *SceneGenerator::GetKindName(Kind kind) {
+	constexpr const char *kNames[kKindCount] = {"soup", "skinny", "grid", "architecture", "size_variance"};
+	return kNames[kind];
+}
+
+bool SceneGenerator::ParseKind(const char *name, Kind *p_kind) {
+	for (uint32_t k = 0; k < kKindCount; ++k)
+		if (strcmp(name, GetKindName((Kind)k)) == 0) {
+			*p_kind = (Kind)k;
+			return true;
+		}
+	return false;
+}
+
+std::shared_ptr<Scene> SceneGenerator::Generate(Kind kind, uint32_t triangle_count, uint64_t seed) {
+	using namespace scene_generator_detail;
+
+	std::vector<Triangle> triangles(triangle_count);
+	uint32_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+	uint32_t chunk_size = (triangle_count + thread_count - 1) / thread_count;
+	std::vector<std::future<void>> futures;
+	for (uint32_t begin = 0; begin < triangle_count; begin += chunk_size) {
+		uint32_t end = std::min(begin + chunk_size, triangle_count);
+		futures.push_back(std::async(std::launch::async, [&triangles, kind, triangle_count, seed, begin, end]() {
+			for (uint32_t i = begin; i < end; ++i) {
+				switch (kind) {
+				case kSoup:
+					triangles[i] = soup_triangle(seed, i, triangle_count);
+					break;
+				case kSkinny:
+					triangles[i] = skinny_triangle(seed, i);
+					break;
+				case kGrid:
+					triangles[i] = grid_triangle(seed, i, triangle_count);
+					break;
+				case kArchitecture:
+					triangles[i] = architecture_triangle(seed, i, triangle_count);
+					break;
+				default:
+					triangles[i] = size_variance_triangle(seed, i);
+					break;
+				}
+			}
+		}));
+	}
+	for (auto &f : futures)
+		f.wait();
+
+	spdlog::info("Generated {} scene, seed {}", GetKindName(kind), seed);
+	return Scene::CreateFromTriangles(std::move(triangles));
+}
@@ -0,0 +1,28 @@
+#ifndef ADYPT_SCENEGENERATOR_HPP
+#define ADYPT_SCENEGENERATOR_HPP
+
+#include "Scene.hpp"
+#include <cinttypes>
+#include <memory>
+
+// Procedural stress scenes for benchmarks. Every triangle is a pure function of (kind, triangle count, seed, index),
+// so the output is identical for any thread count and scales to hundreds of millions of triangles.
+class SceneGenerator {
+public:
+	enum Kind {
+		kSoup = 0,     // uniform random triangle soup
+		kSkinny,       // long, thin, randomly oriented triangles that spatial splits have to cut
+		kGrid,         // a tessellated box instanced over a dense 3D grid
+		kArchitecture, // Sponza-like hall with walls, columns and clutter of very different densities
+		kSizeVariance, // triangle sizes spread over four orders of magnitude
+		kKindCount
+	};
+
+	static const char *GetKindName(Kind kind);
+	// returns false for an unknown name
+	static bool ParseKind(const char *name, Kind *p_kind);
+
+	static std::shared_ptr<Scene> Generate(Kind kind, uint32_t triangle_count, uint64_t seed = 0);
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "TraversalStackAnalyzer.hpp"
+
+#include "WideBVHTraversal.hpp"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+TraversalStackAnalyzer::Report TraversalStackAnalyzer::Analyze(const WideBVH &bvh) {
+	Report ret;
+	const std::vector<WideBVH::Node> &nodes = bvh.GetNodes();
+	if (nodes.empty())
+		return ret;
+
+	struct Entry {
+		uint32_t node, depth;
+	};
+	std::vector<Entry> dfs_stack;
+	for (uint32_t octinv = 0; octinv < 8; ++octinv) {
+		uint32_t max_depth = 0;
+		dfs_stack.push_back({0, 0});
+		while (!dfs_stack.empty()) {
+			auto [node_idx, depth] = dfs_stack.back();
+			dfs_stack.pop_back();
+			if (ret.depth_histogram.size() <= depth)
+				ret.depth_histogram.resize(depth + 1);
+			++ret.depth_histogram[depth];
+			max_depth = std::max(max_depth, depth);
+
+			// the traversal takes the highest hit bit first, inner children sit at bit 24 + (widx ^ octinv)
+			const WideBVH::Node &node = nodes[node_idx];
+			uint32_t order[8], count = 0;
+			for (uint32_t bit = 8; bit-- > 0;)
+				if (node.m_imask & (1u << (bit ^ octinv)))
+					order[count++] = bit ^ octinv;
+			// every child but the last leaves the rest of the group on the stack
+			for (uint32_t i = 0; i < count; ++i)
+				dfs_stack.push_back({node.m_child_idx_base + order[i], depth + (i + 1 < count ? 1u : 0u)});
+		}
+		ret.max_depth_per_octant[octinv] = max_depth;
+		ret.max_depth = std::max(ret.max_depth, max_depth);
+	}
+	return ret;
+}
+
+uint32_t TraversalStackAnalyzer::Report::GetDepthQuantile(double q) const {
+	uint64_t total = 0;
+	for (uint64_t c : depth_histogram)
+		total += c;
+	uint64_t target = (uint64_t)(q * (double)total), acc = 0;
+	for (uint32_t d = 0; d < depth_histogram.size(); ++d)
+		if ((acc += depth_histogram[d]) >= target)
+			return d;
+	return max_depth;
+}
+
+void TraversalStackAnalyzer::Report::Log() const {
+	std::string histogram;
+	for (uint32_t d = 0; d < depth_histogram.size(); ++d)
+		histogram += fmt::format(" {}:{}", d, depth_histogram[d]);
+	spdlog::info("Traversal stack: max depth {} (per octant {}), 99% of nodes entered within {}; depth histogram{}",
+	             max_depth, fmt::join(max_depth_per_octant, ","), GetDepthQuantile(0.99), histogram);
+	if (max_depth > WideBVHTraversal::kStackSize)
+		spdlog::warn("Traversal stack needs {} entries, more than the shader's {}", max_depth,
+		             WideBVHTraversal::kStackSize);
+}
@@ -0,0 +1,27 @@
+#ifndef ADYPT_TRAVERSALSTACKANALYZER_HPP
+#define ADYPT_TRAVERSALSTACKANALYZER_HPP
+
+#include "WideBVH.hpp"
+#include <array>
+#include <cinttypes>
+#include <vector>
+
+// Offline bound of the traversal stack a WideBVH needs. For every ray octant the tree is walked in the order the
+// traversal visits children, assuming every child is hit; fewer hits only pop earlier, so the maximum is a safe
+// stack size for any ray.
+class TraversalStackAnalyzer {
+public:
+	struct Report {
+		std::array<uint32_t, 8> max_depth_per_octant{};
+		uint32_t max_depth{};
+		// number of (node, octant) pairs entered with the given stack depth
+		std::vector<uint64_t> depth_histogram;
+
+		uint32_t GetDepthQuantile(double q) const;
+		void Log() const;
+	};
+
+	static Report Analyze(const WideBVH &bvh);
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "TraversalStats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <tinyexr.h>
+
+const char *TraversalStats::GetCounterName(Counter counter) {
+	constexpr const char *kNames[kCounterCount] = {"node_visits",     "child_tests",     "triangle_tests",
+	                                               "max_stack_depth", "stack_overflows", "restarts"};
+	return kNames[counter];
+}
+
+uint32_t TraversalStats::get_counter(const RayStats &stats, Counter counter) {
+	switch (counter) {
+	case kNodeVisits:
+		return stats.m_node_visits;
+	case kChildTests:
+		return stats.m_child_tests;
+	case kTriangleTests:
+		return stats.m_triangle_tests;
+	case kMaxStackDepth:
+		return stats.m_max_stack_depth;
+	case kStackOverflows:
+		return stats.m_stack_overflows;
+	case kRestarts:
+		return stats.m_restarts;
+	default:
+		return 0;
+	}
+}
+
+template <uint32_t WIDTH>
+std::shared_ptr<TraversalStats> TraversalStats::TracePrimary(const BasicWideBVHTraversal<WIDTH> &traversal,
+                                                             const glm::vec3 &position, const glm::vec3 &look,
+                                                             const glm::vec3 &side, const glm::vec3 &up,
+                                                             uint32_t width, uint32_t height,
+                                                             uint32_t short_stack_size) {
+	std::shared_ptr<TraversalStats> ret = std::make_shared<TraversalStats>(width, height);
+	ret->Trace(traversal, position, look, side, up, 0, short_stack_size);
+	return ret;
+}
+
+template <uint32_t WIDTH>
+void TraversalStats::Trace(const BasicWideBVHTraversal<WIDTH> &traversal, const glm::vec3 &position,
+                           const glm::vec3 &look, const glm::vec3 &side, const glm::vec3 &up, uint32_t thread_count,
+                           uint32_t short_stack_size) {
+	if (!thread_count)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+	// rows are distributed dynamically since their cost varies a lot
+	std::atomic_uint32_t next_row{0};
+	std::atomic_uint64_t hit_count{0};
+	std::vector<std::future<void>> futures;
+	for (uint32_t t = 0; t < thread_count; ++t) {
+		futures.push_back(std::async(std::launch::async, [&]() {
+			uint64_t local_hit_count = 0;
+			for (uint32_t y; (y = next_row++) < m_height;) {
+				for (uint32_t x = 0; x < m_width; ++x) {
+					glm::vec2 coord =
+					    (glm::vec2{x, y} + 0.5f) * glm::vec2{2.0f / float(m_width), 2.0f / float(m_height)} - 1.0f;
+					typename BasicWideBVHTraversal<WIDTH>::Ray ray{
+					    position, 1e-6f, glm::normalize(look - side * coord.x - up * coord.y)};
+					typename BasicWideBVHTraversal<WIDTH>::Hit hit;
+					RayStats *p_stats = &m_pixels[(size_t)y * m_width + x];
+					*p_stats = {};
+					local_hit_count += short_stack_size
+					                       ? traversal.IntersectShortStack(ray, short_stack_size, &hit, p_stats)
+					                       : traversal.Intersect(ray, &hit, p_stats);
+				}
+			}
+			hit_count += local_hit_count;
+		}));
+	}
+	for (auto &f : futures)
+		f.wait();
+	m_hit_count = hit_count;
+}
+
+template std::shared_ptr<TraversalStats>
+TraversalStats::TracePrimary(const BasicWideBVHTraversal<4> &, const glm::vec3 &, const glm::vec3 &, const glm::vec3 &,
+                             const glm::vec3 &, uint32_t, uint32_t, uint32_t);
+template std::shared_ptr<TraversalStats>
+TraversalStats::TracePrimary(const BasicWideBVHTraversal<8> &, const glm::vec3 &, const glm::vec3 &, const glm::vec3 &,
+                             const glm::vec3 &, uint32_t, uint32_t, uint32_t);
+template void TraversalStats::Trace(const BasicWideBVHTraversal<4> &, const glm::vec3 &, const glm::vec3 &,
+                                    const glm::vec3 &, const glm::vec3 &, uint32_t, uint32_t);
+template void TraversalStats::Trace(const BasicWideBVHTraversal<8> &, const glm::vec3 &, const glm::vec3 &,
+                                    const glm::vec3 &, const glm::vec3 &, uint32_t, uint32_t);
+
+uint64_t TraversalStats::GetTotal(Counter counter) const {
+	uint64_t total = 0;
+	for (const auto &p : m_pixels)
+		total += get_counter(p, counter);
+	return total;
+}
+
+uint32_t TraversalStats::GetMax(Counter counter) const {
+	uint32_t max = 0;
+	for (const auto &p : m_pixels)
+		max = std::max(max, get_counter(p, counter));
+	return max;
+}
+
+TraversalStats::Histogram TraversalStats::GetHistogram(Counter counter, uint32_t bin_count) const {
+	Histogram ret;
+	uint32_t max = GetMax(counter);
+	ret.bin_width = std::max(1u, (max + bin_count) / bin_count);
+	ret.bins.resize(max / ret.bin_width + 1);
+	for (const auto &p : m_pixels)
+		++ret.bins[get_counter(p, counter) / ret.bin_width];
+	return ret;
+}
+
+void TraversalStats::Log() const {
+#ifndef ADYPT_TRAVERSAL_STATS
+	spdlog::warn("Traversal counters are compiled out, configure with ADYPT_TRAVERSAL_STATS=ON");
+#endif
+	spdlog::info("Traversal stats: {}x{} rays, {} hits", m_width, m_height, m_hit_count);
+	for (uint32_t c = 0; c < kCounterCount; ++c) {
+		auto counter = (Counter)c;
+		Histogram histogram = GetHistogram(counter);
+		std::string bins;
+		for (uint32_t i = 0; i < histogram.bins.size(); ++i) {
+			if (!histogram.bins[i])
+				continue;
+			bins += fmt::format(" [{},{}):{}", i * histogram.bin_width, (i + 1) * histogram.bin_width,
+			                    histogram.bins[i]);
+		}
+		spdlog::info("{}: mean {:.2f}, max {}, total {}; histogram{}", GetCounterName(counter), GetMean(counter),
+		             GetMax(counter), GetTotal(counter), bins);
+	}
+}
+
+bool TraversalStats::WriteHeatmap(Counter counter, const char *filename) const {
+	std::vector<float> data(m_pixels.size());
+	for (size_t i = 0; i < m_pixels.size(); ++i)
+		data[i] = (float)get_counter(m_pixels[i], counter);
+	const char *err = nullptr;
+	if (SaveEXR(data.data(), (int)m_width, (int)m_height, 1, 0, filename, &err) != TINYEXR_SUCCESS) {
+		spdlog::error("Failed to write heatmap {}: {}", filename, err ? err : "");
+		if (err)
+			FreeEXRErrorMessage(err);
+		return false;
+	}
+	return true;
+}
+
+bool TraversalStats::WriteHeatmaps(const std::string &prefix) const {
+	bool ret = true;
+	for (uint32_t c = 0; c < kCounterCount; ++c)
+		ret &= WriteHeatmap((Counter)c, (prefix + "_" + GetCounterName((Counter)c) + ".exr").c_str());
+	if (ret)
+		spdlog::info("Traversal heatmaps written to {}_*.exr", prefix);
+	return ret;
+}
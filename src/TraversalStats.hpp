@@ -0,0 +1,75 @@
+#ifndef ADYPT_TRAVERSALSTATS_HPP
+#define ADYPT_TRAVERSALSTATS_HPP
+
+#include "WideBVHTraversal.hpp"
+#include <array>
+#include <cinttypes>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+// per-pixel RayStats of a primary-ray frame, with histograms, aggregates and heatmaps
+class TraversalStats {
+public:
+	enum Counter {
+		kNodeVisits = 0,
+		kChildTests,
+		kTriangleTests,
+		kMaxStackDepth,
+		kStackOverflows,
+		kRestarts,
+		kCounterCount
+	};
+	struct Histogram {
+		uint32_t bin_width{1};
+		std::vector<uint64_t> bins;
+	};
+
+private:
+	uint32_t m_width{}, m_height{};
+	uint64_t m_hit_count{};
+	std::vector<RayStats> m_pixels;
+
+	static uint32_t get_counter(const RayStats &stats, Counter counter);
+
+public:
+	static const char *GetCounterName(Counter counter);
+
+	TraversalStats() = default;
+	// pixels of a width x height frame for Trace()
+	TraversalStats(uint32_t width, uint32_t height)
+	    : m_width{width}, m_height{height}, m_pixels((size_t)width * height) {}
+
+	// trace one ray per pixel the same way shader/ray_tracer.frag does (camera basis as in Camera's uniform data),
+	// a non-zero short_stack_size traces with IntersectShortStack(), instantiated for widths 4 and 8
+	template <uint32_t WIDTH>
+	static std::shared_ptr<TraversalStats> TracePrimary(const BasicWideBVHTraversal<WIDTH> &traversal,
+	                                                    const glm::vec3 &position, const glm::vec3 &look,
+	                                                    const glm::vec3 &side, const glm::vec3 &up, uint32_t width,
+	                                                    uint32_t height, uint32_t short_stack_size = 0);
+	// TracePrimary() into the pixels of this frame, overwriting them, on thread_count threads (0 for every hardware
+	// thread)
+	template <uint32_t WIDTH>
+	void Trace(const BasicWideBVHTraversal<WIDTH> &traversal, const glm::vec3 &position, const glm::vec3 &look,
+	           const glm::vec3 &side, const glm::vec3 &up, uint32_t thread_count = 0, uint32_t short_stack_size = 0);
+
+	uint32_t GetWidth() const { return m_width; }
+	uint32_t GetHeight() const { return m_height; }
+	uint64_t GetRayCount() const { return m_pixels.size(); }
+	uint64_t GetHitCount() const { return m_hit_count; }
+	const std::vector<RayStats> &GetPixels() const { return m_pixels; }
+
+	uint64_t GetTotal(Counter counter) const;
+	uint32_t GetMax(Counter counter) const;
+	double GetMean(Counter counter) const { return m_pixels.empty() ? 0.0 : double(GetTotal(counter)) / m_pixels.size(); }
+	Histogram GetHistogram(Counter counter, uint32_t bin_count = 16) const;
+
+	void Log() const;
+	// single channel EXR of the counter for every pixel
+	bool WriteHeatmap(Counter counter, const char *filename) const;
+	// writes <prefix>_<counter name>.exr for every counter
+	bool WriteHeatmaps(const std::string &prefix) const;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "TwoLevelBVH.hpp"
+
+#include "BVHBuilder.hpp"
+#include "BuildTrace.hpp"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+uint32_t TwoLevelBVH::AddMesh(const std::shared_ptr<Scene> &scene) { return AddMesh(BuildWideBVH(m_config, scene)); }
+
+uint32_t TwoLevelBVH::AddMesh(std::shared_ptr<WideBVH> bvh) {
+	m_meshes.emplace_back(std::move(bvh));
+	return m_meshes.size() - 1;
+}
+
+uint32_t TwoLevelBVH::AddInstance(uint32_t mesh_idx, const glm::mat4 &transform) {
+	Instance instance{};
+	instance.mesh_idx = mesh_idx;
+	set_transform(&instance, transform);
+	m_instances.push_back(instance);
+	return m_instances.size() - 1;
+}
+
+void TwoLevelBVH::SetInstanceTransform(uint32_t instance_idx, const glm::mat4 &transform) {
+	set_transform(&m_instances[instance_idx], transform);
+}
+
+void TwoLevelBVH::set_transform(Instance *p_instance, const glm::mat4 &transform) const {
+	p_instance->transform = transform;
+	p_instance->inv_transform = glm::inverse(transform);
+
+	// the 8 transformed corners of the mesh bound
+	const AABB &aabb = m_meshes[p_instance->mesh_idx].GetBVHPtr()->GetScenePtr()->GetAABB();
+	p_instance->aabb = AABB{};
+	for (uint32_t i = 0; i < 8; ++i) {
+		glm::vec3 corner{(i & 1u) ? aabb.max.x : aabb.min.x, (i & 2u) ? aabb.max.y : aabb.min.y,
+		                 (i & 4u) ? aabb.max.z : aabb.min.z};
+		p_instance->aabb.Expand(glm::vec3{transform * glm::vec4{corner, 1.0f}});
+	}
+}
+
+void TwoLevelBVH::BuildTopLevel() {
+	BuildTrace::Scope trace{"top_level", (uint32_t)m_instances.size()};
+	m_nodes.clear();
+	if (m_instances.empty())
+		return;
+	m_nodes.reserve(m_instances.size() * 2 - 1);
+	m_build_instances.resize(m_instances.size());
+	for (uint32_t i = 0; i < m_instances.size(); ++i)
+		m_build_instances[i] = i;
+
+	m_nodes.emplace_back();
+	build_node(0, 0, m_instances.size());
+
+	m_build_instances.clear();
+	m_build_instances.shrink_to_fit();
+	spdlog::info("Top-level BVH built with {} nodes over {} instances of {} meshes", m_nodes.size(),
+	             m_instances.size(), m_meshes.size());
+}
+
+void TwoLevelBVH::build_node(uint32_t node_idx, uint32_t begin, uint32_t end) {
+	AABB aabb, centroid_aabb;
+	for (uint32_t i = begin; i < end; ++i) {
+		const AABB &instance_aabb = m_instances[m_build_instances[i]].aabb;
+		aabb.Expand(instance_aabb);
+		centroid_aabb.Expand(instance_aabb.GetCenter());
+	}
+	m_nodes[node_idx].aabb = aabb;
+	if (end - begin == 1) {
+		m_nodes[node_idx].instance_idx = m_build_instances[begin];
+		return;
+	}
+
+	// binned SAH over the instance centroids
+	float min_sah = FLT_MAX;
+	int split_dim = -1;
+	uint32_t split_bin = 0;
+	glm::vec3 centroid_extent = centroid_aabb.GetExtent();
+	auto get_bin = [&centroid_aabb, &centroid_extent](const AABB &instance_aabb, int dim) {
+		auto bin = uint32_t((instance_aabb.GetDimCenter(dim) - centroid_aabb.min[dim]) / centroid_extent[dim] *
+		                    float(kBinCount));
+		return std::min(bin, kBinCount - 1);
+	};
+	for (int dim = 0; dim < 3; ++dim) {
+		if (centroid_extent[dim] <= 0.0f)
+			continue;
+		AABB bin_aabbs[kBinCount];
+		uint32_t bin_counts[kBinCount]{};
+		for (uint32_t i = begin; i < end; ++i) {
+			const AABB &instance_aabb = m_instances[m_build_instances[i]].aabb;
+			uint32_t bin = get_bin(instance_aabb, dim);
+			bin_aabbs[bin].Expand(instance_aabb);
+			++bin_counts[bin];
+		}
+		float right_sah[kBinCount];
+		AABB right_aabb;
+		for (uint32_t b = kBinCount - 1, count = 0; b > 0; --b) {
+			right_aabb.Expand(bin_aabbs[b]);
+			count += bin_counts[b];
+			right_sah[b] = count ? right_aabb.GetHalfArea() * float(count) : FLT_MAX;
+		}
+		AABB left_aabb;
+		for (uint32_t b = 1, count = 0; b < kBinCount; ++b) {
+			left_aabb.Expand(bin_aabbs[b - 1]);
+			count += bin_counts[b - 1];
+			if (!count)
+				continue;
+			float sah = left_aabb.GetHalfArea() * float(count) + right_sah[b];
+			if (sah < min_sah) {
+				min_sah = sah;
+				split_dim = dim;
+				split_bin = b;
+			}
+		}
+	}
+
+	uint32_t mid = (begin + end) / 2;
+	if (split_dim != -1)
+		mid = std::partition(m_build_instances.begin() + begin, m_build_instances.begin() + end,
+		                     [this, &get_bin, split_dim, split_bin](uint32_t instance_idx) {
+			                     return get_bin(m_instances[instance_idx].aabb, split_dim) < split_bin;
+		                     }) -
+		      m_build_instances.begin();
+	// only coincident centroids leave no split, then halve the range
+	if (mid == begin || mid == end)
+		mid = (begin + end) / 2;
+
+	auto left_idx = (uint32_t)m_nodes.size();
+	m_nodes[node_idx].left_idx = left_idx;
+	m_nodes.emplace_back();
+	m_nodes.emplace_back();
+	build_node(left_idx, begin, mid);
+	build_node(left_idx + 1, mid, end);
+}
+
+bool TwoLevelBVH::Intersect(const Ray &ray, Hit *p_hit, RayStats *p_stats) const {
+	if (m_nodes.empty())
+		return false;
+
+	constexpr float kOOEps = 5.42101086242752217e-20f; // exp2(-64), as in the wide traversal
+	glm::vec3 idir;
+	for (int i = 0; i < 3; ++i)
+		idir[i] = 1.0f / (std::abs(ray.dir[i]) > kOOEps ? ray.dir[i] : std::copysign(kOOEps, ray.dir[i]));
+	// entry distance of the ray into aabb, FLT_MAX if it misses before hit_t
+	auto intersect_aabb = [&ray, &idir](const AABB &aabb, float hit_t) {
+		glm::vec3 t0 = (aabb.min - ray.origin) * idir, t1 = (aabb.max - ray.origin) * idir;
+		glm::vec3 t_near = glm::min(t0, t1), t_far = glm::max(t0, t1);
+		float t_enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, ray.tmin));
+		float t_exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, hit_t));
+		return t_enter <= t_exit ? t_enter : FLT_MAX;
+	};
+
+	float hit_t = ray.tmax;
+	bool hit = false;
+	std::vector<uint32_t> stack{0};
+	while (!stack.empty()) {
+		const Node &node = m_nodes[stack.back()];
+		stack.pop_back();
+		ADYPT_TRAVERSAL_STAT(++p_stats->m_node_visits);
+		if (intersect_aabb(node.aabb, hit_t) == FLT_MAX)
+			continue;
+
+		if (node.left_idx == UINT32_MAX) {
+			// the mesh traversal measures t along the normalized local direction, which is t_scale times as long as
+			// the world one
+			const Instance &instance = m_instances[node.instance_idx];
+			glm::vec3 local_dir{instance.inv_transform * glm::vec4{ray.dir, 0.0f}};
+			float t_scale = glm::length(local_dir);
+			Ray local_ray{glm::vec3{instance.inv_transform * glm::vec4{ray.origin, 1.0f}}, ray.tmin * t_scale,
+			              local_dir, hit_t * t_scale};
+			WideBVHTraversal::Hit mesh_hit;
+			if (m_meshes[instance.mesh_idx].Intersect(local_ray, &mesh_hit, p_stats)) {
+				mesh_hit.t /= t_scale;
+				hit_t = mesh_hit.t;
+				*p_hit = {node.instance_idx, mesh_hit};
+				hit = true;
+			}
+			continue;
+		}
+
+		// the nearer child is popped first
+		float left_t = intersect_aabb(m_nodes[node.left_idx].aabb, hit_t),
+		      right_t = intersect_aabb(m_nodes[node.left_idx + 1].aabb, hit_t);
+		uint32_t near_idx = node.left_idx, far_idx = node.left_idx + 1;
+		if (right_t < left_t) {
+			std::swap(near_idx, far_idx);
+			std::swap(left_t, right_t);
+		}
+		if (right_t != FLT_MAX)
+			stack.push_back(far_idx);
+		if (left_t != FLT_MAX)
+			stack.push_back(near_idx);
+	}
+	return hit;
+}
@@ -0,0 +1,72 @@
+#ifndef ADYPT_TWOLEVELBVH_HPP
+#define ADYPT_TWOLEVELBVH_HPP
+
+#include "WideBVHTraversal.hpp"
+#include <cinttypes>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+// Two-level acceleration structure for instanced scenes. Every mesh gets a bottom-level WideBVH, built once and shared
+// by all of its instances, and a binary SAH tree over the world bounds of the instances sits on top. Rays are
+// transformed into the space of each instance they reach, so memory scales with the unique geometry and instance edits
+// only rebuild the top level.
+class TwoLevelBVH {
+public:
+	using Ray = WideBVHTraversal::Ray;
+	struct Hit {
+		uint32_t instance_idx{UINT32_MAX};
+		WideBVHTraversal::Hit hit; // triangle of the instance's mesh, t is along the world space ray
+	};
+
+private:
+	// bins per axis of the top-level SAH sweep
+	static constexpr uint32_t kBinCount = 16;
+
+	struct Node {
+		AABB aabb;
+		uint32_t left_idx{UINT32_MAX}; // UINT32_MAX for leaves (right node index = left + 1)
+		uint32_t instance_idx{};
+	};
+	struct Instance {
+		uint32_t mesh_idx;
+		glm::mat4 transform, inv_transform; // object to world and back
+		AABB aabb;                          // world space
+	};
+
+	BVHConfig m_config;
+	std::vector<WideBVHTraversal> m_meshes;
+	std::vector<Instance> m_instances;
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_build_instances; // instance indices, partitioned while building
+
+	void set_transform(Instance *p_instance, const glm::mat4 &transform) const;
+	void build_node(uint32_t node_idx, uint32_t begin, uint32_t end);
+
+public:
+	// bottom levels are built with this config
+	explicit TwoLevelBVH(const BVHConfig &config) : m_config{config} {}
+
+	// returns the mesh index, the scene is built with BuildWideBVH()
+	uint32_t AddMesh(const std::shared_ptr<Scene> &scene);
+	// a bottom level built elsewhere (or loaded from a cache)
+	uint32_t AddMesh(std::shared_ptr<WideBVH> bvh);
+	// returns the instance index, transform maps the mesh's (normalized) space to world space
+	uint32_t AddInstance(uint32_t mesh_idx, const glm::mat4 &transform);
+	void SetInstanceTransform(uint32_t instance_idx, const glm::mat4 &transform);
+
+	// must run after instances were added or moved and before the next Intersect()
+	void BuildTopLevel();
+
+	uint32_t GetMeshCount() const { return m_meshes.size(); }
+	uint32_t GetInstanceCount() const { return m_instances.size(); }
+	uint32_t GetTopLevelNodeCount() const { return m_nodes.size(); }
+	const WideBVHTraversal &GetMesh(uint32_t mesh_idx) const { return m_meshes[mesh_idx]; }
+	uint32_t GetInstanceMesh(uint32_t instance_idx) const { return m_instances[instance_idx].mesh_idx; }
+	const glm::mat4 &GetInstanceTransform(uint32_t instance_idx) const { return m_instances[instance_idx].transform; }
+
+	// top-level nodes count as node visits in p_stats, the bottom levels add their own counters
+	bool Intersect(const Ray &ray, Hit *p_hit, RayStats *p_stats = nullptr) const;
+};
+
+#endif
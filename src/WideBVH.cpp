@@ -0,0 +1,285 @@
+#include "WideBVH.hpp"
+
+#include "BuildTrace.hpp"
+#include "Math.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <spdlog/spdlog.h>
+
+// runs func(begin, end) on contiguous chunks of [0, count), small ranges stay on the calling thread
+template <class Func> static void parallel_for(uint32_t thread_count, uint32_t count, Func &&func) {
+	constexpr uint32_t kMinChunkSize = 1024;
+	thread_count = std::min(thread_count, (count + kMinChunkSize - 1) / kMinChunkSize);
+	if (thread_count <= 1) {
+		func(0u, count);
+		return;
+	}
+	uint32_t chunk_size = (count + thread_count - 1) / thread_count;
+	std::vector<std::future<void>> futures;
+	for (uint32_t begin = chunk_size; begin < count; begin += chunk_size)
+		futures.push_back(std::async(std::launch::async, [&func, begin, end = std::min(begin + chunk_size, count)]() {
+			func(begin, end);
+		}));
+	func(0u, chunk_size);
+	for (auto &f : futures)
+		f.get();
+}
+
+template <uint32_t WIDTH> std::vector<glm::vec4> BasicWideBVH<WIDTH>::GenerateTriMatrices() const {
+	std::vector<glm::vec4> matrices;
+	GenerateTriMatrices(&matrices);
+	return matrices;
+}
+
+template <uint32_t WIDTH> void BasicWideBVH<WIDTH>::GenerateTriMatrices(std::vector<glm::vec4> *p_matrices) const {
+	p_matrices->resize(m_tri_indices.size() * 3u);
+	auto count = (uint32_t)m_tri_indices.size();
+	parallel_for(m_config.GetThreadCount(), count, [this, p_matrices](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			const Triangle &tri = m_scene_ptr->GetTriangles()[m_tri_indices[i]];
+			const glm::vec3 &v0 = tri.positions[0], &v1 = tri.positions[1], &v2 = tri.positions[2];
+			glm::vec4 c0{v0 - v2, 0.0f};
+			glm::vec4 c1{v1 - v2, 0.0f};
+			glm::vec4 c2{glm::cross(v0 - v2, v1 - v2), 0.0f};
+			glm::vec4 c3{v2, 1.0f};
+			glm::mat4 mtx{c0.x, c1.x, c2.x, c3.x, c0.y, c1.y, c2.y, c3.y,
+			              c0.z, c1.z, c2.z, c3.z, c0.w, c1.w, c2.w, c3.w};
+			mtx = glm::inverse(mtx);
+			glm::vec4 *matrix = p_matrices->data() + i * 3u;
+			matrix[0] = {mtx[2][0], mtx[2][1], mtx[2][2], -mtx[2][3]};
+			matrix[1] = {mtx[0][0], mtx[0][1], mtx[0][2], mtx[0][3]};
+			matrix[2] = {mtx[1][0], mtx[1][1], mtx[1][2], mtx[1][3]};
+		}
+	});
+}
+
+template <class Node> static AABB get_child_aabb(const Node &node, uint32_t slot) {
+	glm::vec3 p{node.m_px, node.m_py, node.m_pz};
+	glm::vec3 cell{glm::uintBitsToFloat((uint32_t)node.m_ex << 23u), glm::uintBitsToFloat((uint32_t)node.m_ey << 23u),
+	               glm::uintBitsToFloat((uint32_t)node.m_ez << 23u)};
+	return {p + glm::vec3{node.m_qlox[slot], node.m_qloy[slot], node.m_qloz[slot]} * cell,
+	        p + glm::vec3{node.m_qhix[slot], node.m_qhiy[slot], node.m_qhiz[slot]} * cell};
+}
+static inline bool is_internal_child(uint32_t meta) { return (meta & (meta << 1u)) & 0x10u; }
+
+template <uint32_t WIDTH> double BasicWideBVH<WIDTH>::get_sah(const std::vector<Node> &nodes) const {
+	if (nodes.empty())
+		return 0.0;
+	AABB root_aabb;
+	double sah = 0.0;
+	for (const Node &node : nodes)
+		for (uint32_t slot = 0; slot < WIDTH; ++slot) {
+			uint32_t meta = node.m_meta[slot];
+			if (!meta)
+				continue;
+			AABB aabb = get_child_aabb(node, slot);
+			if (&node == nodes.data())
+				root_aabb.Expand(aabb);
+			sah += double(is_internal_child(meta) ? m_config.GetNodeCost()
+			                                      : m_config.GetTriangleCost(glm::bitCount(meta >> 5u))) *
+			       aabb.GetHalfArea();
+		}
+	double root_area = root_aabb.GetHalfArea();
+	return root_area > 0.0 ? sah / root_area + m_config.GetNodeCost() : 0.0;
+}
+
+template <uint32_t WIDTH> void BasicWideBVH<WIDTH>::init_reference_sah() {
+	std::vector<Node> nodes = m_nodes;
+	refit(&nodes);
+	m_reference_sah = m_sah = get_sah(nodes);
+}
+
+template <uint32_t WIDTH> double BasicWideBVH<WIDTH>::Refit() {
+	if (m_nodes.empty() || m_scene_ptr->GetTriangles().empty()) {
+		spdlog::error("Nothing to refit, the scene holds no triangles");
+		return GetSAHRatio();
+	}
+	BuildTrace::Scope trace{"wide_refit", (uint32_t)m_nodes.size()};
+	refit(&m_nodes);
+	m_sah = get_sah(m_nodes);
+	spdlog::debug("WideBVH refitted, SAH {} ({:.3f} of the built tree)", m_sah, GetSAHRatio());
+	return GetSAHRatio();
+}
+
+template <uint32_t WIDTH> void BasicWideBVH<WIDTH>::refit(std::vector<Node> *p_nodes) const {
+	const auto &triangles = m_scene_ptr->GetTriangles();
+	std::vector<Node> &nodes = *p_nodes;
+	if (nodes.empty() || triangles.empty())
+		return;
+
+	// parents come before their children, so a forward pass gives the depths and a counting sort the levels
+	std::vector<uint32_t> depths(nodes.size()), level_begins;
+	for (uint32_t node_idx = 0; node_idx < nodes.size(); ++node_idx) {
+		const Node &node = nodes[node_idx];
+		if (level_begins.size() < depths[node_idx] + 2)
+			level_begins.resize(depths[node_idx] + 2);
+		++level_begins[depths[node_idx] + 1];
+		for (uint32_t slot = 0; slot < WIDTH; ++slot)
+			if (is_internal_child(node.m_meta[slot]))
+				depths[node.m_child_idx_base + (node.m_meta[slot] & 0x1fu) - 24u] = depths[node_idx] + 1;
+	}
+	for (uint32_t d = 1; d < level_begins.size(); ++d)
+		level_begins[d] += level_begins[d - 1];
+	std::vector<uint32_t> levels(nodes.size());
+	{
+		std::vector<uint32_t> level_ends{level_begins.begin(), level_begins.end() - 1};
+		for (uint32_t node_idx = 0; node_idx < nodes.size(); ++node_idx)
+			levels[level_ends[depths[node_idx]]++] = node_idx;
+	}
+
+	std::vector<AABB> aabbs(nodes.size());
+	auto refit_nodes = [this, &nodes, &triangles, &levels, &aabbs](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			Node &node = nodes[levels[i]];
+			AABB &aabb = aabbs[levels[i]], child_aabbs[WIDTH];
+			for (uint32_t slot = 0; slot < WIDTH; ++slot) {
+				uint32_t meta = node.m_meta[slot];
+				if (!meta)
+					continue;
+				if (is_internal_child(meta))
+					child_aabbs[slot] = aabbs[node.m_child_idx_base + (meta & 0x1fu) - 24u];
+				else
+					for (uint32_t t = 0, tri_count = glm::bitCount(meta >> 5u); t < tri_count; ++t)
+						child_aabbs[slot].Expand(
+						    triangles[m_tri_indices[node.m_tri_idx_base + (meta & 0x1fu) + t]].GetAABB());
+				aabb.Expand(child_aabbs[slot]);
+			}
+			glm::vec3 cell = quantize_grid(&node, aabb);
+			for (uint32_t slot = 0; slot < WIDTH; ++slot)
+				if (node.m_meta[slot])
+					quantize_child(&node, slot, child_aabbs[slot], aabb.min, cell);
+		}
+	};
+	// deepest level first, so the children of a level are all done
+	for (auto d = (uint32_t)level_begins.size() - 1; d--;) {
+		uint32_t begin = level_begins[d], end = level_begins[d + 1];
+		parallel_for(m_config.GetThreadCount(), end - begin,
+		             [begin, &refit_nodes](uint32_t l, uint32_t r) { refit_nodes(begin + l, begin + r); });
+	}
+}
+
+static constexpr char kCacheMagic[8] = {'A', 'D', 'Y', 'P', 'T', 'B', 'V', 'H'};
+static constexpr uint32_t kCacheVersion = 8;
+
+// FNV-1a over the triangle count and at most 4096 evenly strided triangles, cheap enough for huge scenes
+static uint64_t get_scene_fingerprint(const Scene &scene) {
+	constexpr uint32_t kSampleCount = 4096;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	auto feed = [&hash](const void *data, size_t size) {
+		for (size_t i = 0; i < size; ++i)
+			hash = (hash ^ ((const uint8_t *)data)[i]) * 0x100000001b3ull;
+	};
+	auto tri_count = (uint32_t)scene.GetTriangles().size();
+	feed(&tri_count, sizeof(uint32_t));
+	for (uint32_t i = 0, stride = std::max(1u, tri_count / kSampleCount); i < tri_count; i += stride)
+		feed(scene.GetTriangles()[i].positions, sizeof(Triangle::positions));
+	return hash;
+}
+
+template <uint32_t WIDTH> bool BasicWideBVH<WIDTH>::SaveToFile(const char *filename) const {
+	if (!m_full_quality) {
+		spdlog::warn("BVH cache {} not written, the build stopped early", filename);
+		return true;
+	}
+	FILE *file = fopen(filename, "wb");
+	if (!file) {
+		spdlog::error("Failed to open {} for writing", filename);
+		return false;
+	}
+	auto config_bytes = m_config.ToBytes();
+	uint8_t header[24];
+	Uint32ToByte4(kCacheVersion, header);
+	uint64_t fingerprint = get_scene_fingerprint(*m_scene_ptr);
+	Uint32ToByte4(uint32_t(fingerprint), header + 4);
+	Uint32ToByte4(uint32_t(fingerprint >> 32u), header + 8);
+	Uint32ToByte4(m_nodes.size(), header + 12);
+	Uint32ToByte4(m_tri_indices.size(), header + 16);
+	Uint32ToByte4(WIDTH, header + 20);
+
+	bool ok = fwrite(kCacheMagic, sizeof(kCacheMagic), 1, file) == 1 &&
+	          fwrite(config_bytes.data(), config_bytes.size(), 1, file) == 1 &&
+	          fwrite(header, sizeof(header), 1, file) == 1 &&
+	          fwrite(m_nodes.data(), sizeof(Node), m_nodes.size(), file) == m_nodes.size() &&
+	          fwrite(m_tri_indices.data(), sizeof(uint32_t), m_tri_indices.size(), file) == m_tri_indices.size();
+	fclose(file);
+	if (!ok)
+		spdlog::error("Failed to write BVH cache {}", filename);
+	else
+		spdlog::info("BVH cache written to {}", filename);
+	return ok;
+}
+
+// every internal child lies past its node (Refit() relies on that order) and within the nodes, every leaf range within
+// the triangle indices
+template <class Node> static bool is_valid_topology(const std::vector<Node> &nodes, std::size_t tri_index_count) {
+	for (std::size_t node_idx = 0; node_idx < nodes.size(); ++node_idx) {
+		const Node &node = nodes[node_idx];
+		for (uint32_t meta : node.m_meta) {
+			if (!meta)
+				continue;
+			if (is_internal_child(meta)) {
+				uint64_t child_idx = uint64_t(node.m_child_idx_base) + (meta & 0x1fu) - 24u;
+				if (child_idx <= node_idx || child_idx >= nodes.size())
+					return false;
+			} else if (uint64_t(node.m_tri_idx_base) + (meta & 0x1fu) + glm::bitCount(meta >> 5u) > tri_index_count)
+				return false;
+		}
+	}
+	return true;
+}
+
+template <uint32_t WIDTH>
+std::shared_ptr<BasicWideBVH<WIDTH>> BasicWideBVH<WIDTH>::LoadFromFile(const char *filename, const BVHConfig &config,
+                                                                       const std::shared_ptr<Scene> &scene) {
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+		return nullptr;
+
+	std::shared_ptr<BasicWideBVH> ret;
+	auto config_bytes = config.ToBytes();
+	char magic[sizeof(kCacheMagic)];
+	decltype(config_bytes) file_config_bytes;
+	uint8_t header[24];
+	if (fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, kCacheMagic, sizeof(magic)) == 0 &&
+	    fread(file_config_bytes.data(), file_config_bytes.size(), 1, file) == 1 &&
+	    fread(header, sizeof(header), 1, file) == 1) {
+		uint64_t fingerprint = Byte4ToUint32(header + 4) | (uint64_t(Byte4ToUint32(header + 8)) << 32u);
+		if (Byte4ToUint32(header) != kCacheVersion)
+			spdlog::warn("BVH cache {} has another version", filename);
+		else if (Byte4ToUint32(header + 20) != WIDTH)
+			spdlog::warn("BVH cache {} has {}-wide nodes", filename, Byte4ToUint32(header + 20));
+		// the builders give the same tree for any thread count, so the trailing thread count is not compared
+		else if (!std::equal(config_bytes.begin(), config_bytes.end() - 4, file_config_bytes.begin()))
+			spdlog::warn("BVH cache {} was built with another config", filename);
+		else if (fingerprint != get_scene_fingerprint(*scene))
+			spdlog::warn("BVH cache {} was built for another scene", filename);
+		else {
+			ret = std::make_shared<BasicWideBVH>(config, scene);
+			ret->m_nodes.resize(Byte4ToUint32(header + 12));
+			ret->m_tri_indices.resize(Byte4ToUint32(header + 16));
+			if (fread(ret->m_nodes.data(), sizeof(Node), ret->m_nodes.size(), file) != ret->m_nodes.size() ||
+			    fread(ret->m_tri_indices.data(), sizeof(uint32_t), ret->m_tri_indices.size(), file) !=
+			        ret->m_tri_indices.size()) {
+				spdlog::warn("BVH cache {} is truncated", filename);
+				ret = nullptr;
+			} else if (std::any_of(ret->m_tri_indices.begin(), ret->m_tri_indices.end(),
+			                       [&scene](uint32_t t) { return t >= scene->GetTriangles().size(); }) ||
+			           !is_valid_topology(ret->m_nodes, ret->m_tri_indices.size())) {
+				spdlog::warn("BVH cache {} is corrupted", filename);
+				ret = nullptr;
+			}
+		}
+	} else
+		spdlog::warn("{} is not a BVH cache", filename);
+	fclose(file);
+	if (ret) {
+		ret->init_reference_sah();
+		spdlog::info("BVH loaded from cache {} with {} nodes", filename, ret->m_nodes.size());
+	}
+	return ret;
+}
+
+template class BasicWideBVH<4>;
+template class BasicWideBVH<8>;
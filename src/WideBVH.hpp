@@ -3,27 +3,37 @@
 
 #include "BinaryBVHBase.hpp"
 #include <cinttypes>
+#include <cmath>
+#include <glm/glm.hpp>
 #include <memory>
 #include <vector>
 
 #include "WideBVHDecl.inl"
 
-class WideBVH {
+// A BVH of up to WIDTH children per node. WideBVH is the 8-wide layout the shaders traverse, WideBVH4 has 52 byte
+// nodes that fit a cache line, for CPUs with 4-wide SIMD. The child encoding is the same for both: meta holds three
+// triangle bits and an offset for leaves, 001 and 24 plus the internal child index for internal children.
+template <uint32_t WIDTH> class BasicWideBVH {
+	static_assert(WIDTH == 4 || WIDTH == 8, "WideBVH nodes have 4 or 8 children");
+
 public:
-	// a compressed 80 byte bvh node
+	static constexpr uint32_t kWidth = WIDTH;
+
+	// a compressed bvh node, 24 + 7 * WIDTH bytes
 	struct Node {
 		float m_px, m_py, m_pz;
 		uint8_t m_ex, m_ey, m_ez, m_imask;
 		uint32_t m_child_idx_base; // child node base index
 		uint32_t m_tri_idx_base;   // triangle base index
-		uint8_t m_meta[8];
-		uint8_t m_qlox[8];
-		uint8_t m_qloy[8];
-		uint8_t m_qloz[8];
-		uint8_t m_qhix[8];
-		uint8_t m_qhiy[8];
-		uint8_t m_qhiz[8];
+		uint8_t m_meta[WIDTH];
+		uint8_t m_qlox[WIDTH];
+		uint8_t m_qloy[WIDTH];
+		uint8_t m_qloz[WIDTH];
+		uint8_t m_qhix[WIDTH];
+		uint8_t m_qhiy[WIDTH];
+		uint8_t m_qhiz[WIDTH];
 	};
+	static_assert(sizeof(Node) == 24 + 7 * WIDTH);
 
 private:
 	BVHConfig m_config;
@@ -31,15 +41,67 @@ private:
 
 	std::vector<Node> m_nodes;
 	std::vector<uint32_t> m_tri_indices;
+	// SAH of the tree refitted to the triangles it was built for, and after the last Refit(). The collapsed bounds are
+	// clipped by spatial splits and tighter than a refit can get, so they are not the reference.
+	double m_reference_sah{}, m_sah{};
+	// false when a build budget finished the tree with median splits, the cache key has no budget
+	bool m_full_quality{true};
+
+	// sets the origin and exponents of the node's 8 bit grid over aabb, returns the (power of two) cell size
+	static inline glm::vec3 quantize_grid(Node *p_node, const AABB &aabb) {
+		p_node->m_px = aabb.min.x;
+		p_node->m_py = aabb.min.y;
+		p_node->m_pz = aabb.min.z;
+
+		constexpr auto kBase = float(1.0 / double((1 << 8) - 1));
+		glm::vec3 cell = (aabb.max - aabb.min) * kBase;
+
+		p_node->m_ex = cell.x == 0.0f ? 0u : (uint8_t)(127 + (int32_t)std::ceil(std::log2(cell.x)));
+		p_node->m_ey = cell.y == 0.0f ? 0u : (uint8_t)(127 + (int32_t)std::ceil(std::log2(cell.y)));
+		p_node->m_ez = cell.z == 0.0f ? 0u : (uint8_t)(127 + (int32_t)std::ceil(std::log2(cell.z)));
+
+		return {glm::uintBitsToFloat((uint32_t)(p_node->m_ex) << 23u),
+		        glm::uintBitsToFloat((uint32_t)(p_node->m_ey) << 23u),
+		        glm::uintBitsToFloat((uint32_t)(p_node->m_ez) << 23u)};
+	}
+	// the bounds of child slot on that grid, rounded outward
+	static inline void quantize_child(Node *p_node, uint32_t slot, const AABB &aabb, const glm::vec3 &origin,
+	                                  const glm::vec3 &cell) {
+		glm::uvec3 qlow = glm::floor((aabb.min - origin) / cell);
+		glm::uvec3 qhigh = glm::ceil((aabb.max - origin) / cell);
+		// TODO: cast NaN to uint ?
+		qlow = glm::min(qlow, glm::uvec3(UINT8_MAX));
+		qhigh = glm::min(qhigh, glm::uvec3(UINT8_MAX));
+		qlow = glm::max(qlow, glm::uvec3(0));
+		qhigh = glm::max(qhigh, glm::uvec3(0));
+
+		p_node->m_qlox[slot] = (uint8_t)qlow.x;
+		p_node->m_qloy[slot] = (uint8_t)qlow.y;
+		p_node->m_qloz[slot] = (uint8_t)qlow.z;
+		p_node->m_qhix[slot] = (uint8_t)qhigh.x;
+		p_node->m_qhiy[slot] = (uint8_t)qhigh.y;
+		p_node->m_qhiz[slot] = (uint8_t)qhigh.z;
+	}
+	// SAH of the quantized child bounds, normalized by the root area
+	double get_sah(const std::vector<Node> &nodes) const;
+	// recomputes the bounds of nodes (the topology of m_nodes) from the current triangles of the scene
+	void refit(std::vector<Node> *p_nodes) const;
+	// sets both SAHs from a refit of a copy of the nodes, so the ratio starts at 1
+	void init_reference_sah();
 
 public:
-	WideBVH(const BVHConfig &config, std::shared_ptr<Scene> scene) : m_config{config}, m_scene_ptr{std::move(scene)} {}
+	// past this SAH growth over the built tree a rebuild pays off over further refits
+	static constexpr double kRebuildSAHRatio = 1.25;
+
+	BasicWideBVH(const BVHConfig &config, std::shared_ptr<Scene> scene)
+	    : m_config{config}, m_scene_ptr{std::move(scene)} {}
 
 	template <class BVHType>
-	static std::shared_ptr<WideBVH> Build(const std::shared_ptr<BinaryBVHBase<BVHType>> &bin_bvh) {
-		std::shared_ptr<WideBVH> ret = std::make_shared<WideBVH>(bin_bvh->GetConfig(), bin_bvh->GetScenePtr());
-		wide_bvh_detail::WideBVHBuilder<BVHType> builder{ret.get(), *bin_bvh};
+	static std::shared_ptr<BasicWideBVH> Build(const std::shared_ptr<BinaryBVHBase<BVHType>> &bin_bvh) {
+		auto ret = std::make_shared<BasicWideBVH>(bin_bvh->GetConfig(), bin_bvh->GetScenePtr());
+		wide_bvh_detail::WideBVHBuilder<BVHType, WIDTH> builder{ret.get(), *bin_bvh};
 		builder.Run();
+		ret->m_full_quality = bin_bvh->GetBuildStats().GetFullQualityFraction() == 1.0;
 		return ret;
 	}
 	const std::shared_ptr<Scene> &GetScenePtr() const { return m_scene_ptr; }
@@ -49,9 +111,33 @@ public:
 	const std::vector<Node> &GetNodes() const { return m_nodes; }
 	const std::vector<uint32_t> &GetTriIndices() const { return m_tri_indices; }
 
-	template <class BVHType> friend class wide_bvh_detail::WideBVHBuilder;
+	// Woop unit-triangle transforms (3 vec4 per entry of GetTriIndices()), as consumed by the traversal
+	std::vector<glm::vec4> GenerateTriMatrices() const;
+	// the same into *p_matrices, in parallel and without reallocating when it already has the size
+	void GenerateTriMatrices(std::vector<glm::vec4> *p_matrices) const;
+
+	// Refits the tree to the current triangle positions of the scene, which must still hold the triangles it was
+	// built for (see Scene::UpdateTriangles()). The topology is kept, the bounds of every node are recomputed bottom-up
+	// a level at a time in parallel and requantized in place. Returns GetSAHRatio().
+	double Refit();
+	// SAH over the SAH of the built tree refitted to its own triangles, how much refitting has degraded it
+	double GetSAHRatio() const { return m_reference_sah > 0.0 ? m_sah / m_reference_sah : 1.0; }
+	bool IsRebuildDue() const { return GetSAHRatio() > kRebuildSAHRatio; }
+
+	// BVH cache, the header records the config bytes, the width and a fingerprint of the scene the tree was built for.
+	// A tree a build budget cut short is not written (it would be loaded as the full one), false only on write errors.
+	bool SaveToFile(const char *filename) const;
+	// nullptr if the file is missing, corrupted or was built with another config, width or scene
+	static std::shared_ptr<BasicWideBVH> LoadFromFile(const char *filename, const BVHConfig &config,
+	                                                  const std::shared_ptr<Scene> &scene);
+
+	template <class BVHType, uint32_t> friend class wide_bvh_detail::WideBVHBuilder;
 };
 
+// both are instantiated in WideBVH.cpp
+using WideBVH = BasicWideBVH<8>;
+using WideBVH4 = BasicWideBVH<4>;
+
 #include "WideBVHImpl.inl"
 
 #endif
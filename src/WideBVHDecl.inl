@@ -1,17 +1,20 @@
+#include "BuildTrace.hpp"
 #include <algorithm>
 #include <optional>
 #include <spdlog/spdlog.h>
 
-class WideBVH;
+template <uint32_t WIDTH> class BasicWideBVH;
 
 namespace wide_bvh_detail {
 
-template <class BVHType> class WideBVHBuilder {
+// Collapses a binary BVH into WIDTH-wide nodes: a DP over the binary nodes picks, for every count of up to WIDTH
+// slots, whether a subtree becomes a leaf, a node or is distributed over the slots of its parent.
+template <class BVHType, uint32_t WIDTH> class WideBVHBuilder {
 private:
 	using BVHIterator = typename BinaryBVHBase<BVHType>::Iterator;
 	const BinaryBVHBase<BVHType> &m_bin_bvh;
 	const BVHConfig &m_config;
-	WideBVH *m_p_wbvh;
+	BasicWideBVH<WIDTH> *m_p_wbvh;
 
 	struct NodeInfo {
 		enum Type { kInternal = 0, kLeaf, kDistribute };
@@ -20,14 +23,15 @@ private:
 		uint8_t m_distribute_1 : 3;
 	};
 	static_assert(sizeof(NodeInfo) == 1);
+	// indexed by the slot count, 1 to WIDTH - 1
 	struct NodeInfoGroup {
-		std::array<NodeInfo, 7> arr;
+		std::array<NodeInfo, WIDTH - 1> arr;
 		NodeInfo &operator[](uint32_t i) { return arr[i - 1]; }
 	};
-	static_assert(sizeof(NodeInfoGroup) == 7);
+	static_assert(sizeof(NodeInfoGroup) == WIDTH - 1);
 
 	struct NodeSAHGroup {
-		std::array<float, 7> arr;
+		std::array<float, WIDTH - 1> arr;
 		float &operator[](uint32_t i) { return arr[i - 1]; }
 	};
 
@@ -37,15 +41,15 @@ private:
 	//{node_idx, i} are the two dimensions of dp array
 	// out_size describes the number of children
 	// out_idx  stores the children index
-	void fetch_children(BVHIterator node, uint32_t i, uint32_t *out_size, BVHIterator out_nodes[8]);
+	void fetch_children(BVHIterator node, uint32_t i, uint32_t *out_size, BVHIterator out_nodes[WIDTH]);
 	//
 	uint32_t fetch_leaves(BVHIterator node);
 	// hungarian algorithm to solve the min-assignment problem
-	void hungarian(const float mat[8][8], uint32_t n, uint32_t order[8]);
+	void hungarian(const float mat[WIDTH][WIDTH], uint32_t n, uint32_t order[WIDTH]);
 	void create_nodes(BVHIterator node, uint32_t wbvh_node_idx);
 
 public:
-	WideBVHBuilder(WideBVH *p_wbvh, const BinaryBVHBase<BVHType> &bin_bvh);
+	WideBVHBuilder(BasicWideBVH<WIDTH> *p_wbvh, const BinaryBVHBase<BVHType> &bin_bvh);
 	void Run();
 };
 
@@ -1,41 +1,50 @@
 namespace wide_bvh_detail {
 
-template <class BVHType> void WideBVHBuilder<BVHType>::Run() {
+template <class BVHType, uint32_t WIDTH> void WideBVHBuilder<BVHType, WIDTH>::Run() {
+	BuildTrace::Scope trace{"wide_collapse", m_bin_bvh.GetLeafCount()};
 	m_infos.resize(m_bin_bvh.GetNodeRange());
-	calculate_cost(m_bin_bvh.GetRoot());
+	{
+		BuildTrace::Scope cost_trace{"wide_cost", m_bin_bvh.GetNodeRange()};
+		calculate_cost(m_bin_bvh.GetRoot());
+	}
 	spdlog::info("WideBVH cost analyzed");
 
 	m_p_wbvh->m_nodes.emplace_back();
-	m_p_wbvh->m_tri_indices.reserve((size_t)m_bin_bvh.GetLeafCount());
-	create_nodes(m_bin_bvh.GetRoot(), 0);
+	m_p_wbvh->m_tri_indices.reserve(m_bin_bvh.GetScenePtr()->GetTriangles().size());
+	{
+		BuildTrace::Scope create_trace{"wide_create_nodes", m_bin_bvh.GetNodeRange()};
+		create_nodes(m_bin_bvh.GetRoot(), 0);
+	}
 	spdlog::info("WideBVH built with {} nodes", m_p_wbvh->m_nodes.size());
 
 	m_infos.clear();
 	m_infos.shrink_to_fit();
 	m_p_wbvh->m_nodes.shrink_to_fit();
+	m_p_wbvh->init_reference_sah();
 }
 
-template <class BVHType>
-WideBVHBuilder<BVHType>::WideBVHBuilder(WideBVH *p_wbvh, const BinaryBVHBase<BVHType> &bin_bvh)
+template <class BVHType, uint32_t WIDTH>
+WideBVHBuilder<BVHType, WIDTH>::WideBVHBuilder(BasicWideBVH<WIDTH> *p_wbvh, const BinaryBVHBase<BVHType> &bin_bvh)
     : m_p_wbvh(p_wbvh), m_bin_bvh(bin_bvh), m_config(bin_bvh.GetConfig()) {
 	m_p_wbvh->m_nodes.clear();
 	m_p_wbvh->m_tri_indices.clear();
 }
 
-template <class BVHType>
-std::tuple<uint32_t, typename WideBVHBuilder<BVHType>::NodeSAHGroup>
-WideBVHBuilder<BVHType>::calculate_cost(BVHIterator node) {
+template <class BVHType, uint32_t WIDTH>
+std::tuple<uint32_t, typename WideBVHBuilder<BVHType, WIDTH>::NodeSAHGroup>
+WideBVHBuilder<BVHType, WIDTH>::calculate_cost(BVHIterator node) {
 	NodeSAHGroup sah;
 
 	float area = node.GetAABB().GetHalfArea();
 	// is leaf, then initialize
 	auto node_idx = node.GetIndex();
 	if (node.IsLeaf()) {
-		for (uint32_t i = 1; i < 8; ++i) {
-			sah[i] = m_config.GetTriangleCost() * area;
+		uint32_t tri_count = node.GetTriangleCount();
+		for (uint32_t i = 1; i < WIDTH; ++i) {
+			sah[i] = m_config.GetTriangleCost(tri_count) * area;
 			m_infos[node_idx][i].m_type = NodeInfo::kLeaf;
 		}
-		return {1, std::move(sah)};
+		return {tri_count, std::move(sah)};
 	}
 
 	auto [left_tri_count, left_sah] = calculate_cost(node.GetLeft());
@@ -45,17 +54,17 @@ WideBVHBuilder<BVHType>::calculate_cost(BVHIterator node) {
 	auto &info = m_infos[node_idx];
 
 	{ // for i = 1
-		float c_leaf = tri_count <= 3 ? area * m_config.GetTriangleCost(tri_count) : FLT_MAX;
+		float c_leaf = tri_count <= BVHConfig::kMaxLeafTriangles ? area * m_config.GetTriangleCost(tri_count) : FLT_MAX;
 
 		float c_internal = FLT_MAX;
 		{ // calculate c_internal
 			float node_sah = area * m_config.GetNodeCost();
-			for (uint32_t k = 1; k < 8; ++k) {
-				float r = node_sah + left_sah[k] + right_sah[8 - k];
+			for (uint32_t k = 1; k < WIDTH; ++k) {
+				float r = node_sah + left_sah[k] + right_sah[WIDTH - k];
 				if (r < c_internal) {
 					c_internal = r;
 					info[1].m_distribute_0 = k;
-					info[1].m_distribute_1 = 8 - k;
+					info[1].m_distribute_1 = WIDTH - k;
 				}
 			}
 		}
@@ -68,7 +77,7 @@ WideBVHBuilder<BVHType>::calculate_cost(BVHIterator node) {
 		}
 	}
 
-	for (uint32_t i = 2; i < 8; ++i) {
+	for (uint32_t i = 2; i < WIDTH; ++i) {
 		float c_distribute = FLT_MAX;
 		for (uint32_t k = 1; k < i; ++k) {
 			float r = left_sah[k] + right_sah[i - k];
@@ -92,9 +101,9 @@ WideBVHBuilder<BVHType>::calculate_cost(BVHIterator node) {
 	return {tri_count, std::move(sah)};
 }
 
-template <class BVHType>
-void WideBVHBuilder<BVHType>::fetch_children(BVHIterator node, uint32_t i, uint32_t *out_cnt,
-                                             BVHIterator out_nodes[8]) {
+template <class BVHType, uint32_t WIDTH>
+void WideBVHBuilder<BVHType, WIDTH>::fetch_children(BVHIterator node, uint32_t i, uint32_t *out_cnt,
+                                                    BVHIterator out_nodes[WIDTH]) {
 	auto node_idx = node.GetIndex();
 	const BVHIterator ch[2] = {node.GetLeft(), node.GetRight()};
 	uint8_t cdis[2] = {m_infos[node_idx][i].m_distribute_0, m_infos[node_idx][i].m_distribute_1};
@@ -107,35 +116,37 @@ void WideBVHBuilder<BVHType>::fetch_children(BVHIterator node, uint32_t i, uint3
 	}
 }
 
-template <class BVHType> uint32_t WideBVHBuilder<BVHType>::fetch_leaves(BVHIterator node) {
+template <class BVHType, uint32_t WIDTH> uint32_t WideBVHBuilder<BVHType, WIDTH>::fetch_leaves(BVHIterator node) {
 	if (node.IsLeaf()) {
-		m_p_wbvh->m_tri_indices.push_back(node.GetTriangleIdx());
-		return 1;
+		for (uint32_t i = 0; i < node.GetTriangleCount(); ++i)
+			m_p_wbvh->m_tri_indices.push_back(node.GetTriangleIdx(i));
+		return node.GetTriangleCount();
 	}
 	return fetch_leaves(node.GetLeft()) + fetch_leaves(node.GetRight());
 }
 
-template <class BVHType> void WideBVHBuilder<BVHType>::hungarian(const float mat[8][8], uint32_t n, uint32_t order[8]) {
+template <class BVHType, uint32_t WIDTH>
+void WideBVHBuilder<BVHType, WIDTH>::hungarian(const float mat[WIDTH][WIDTH], uint32_t n, uint32_t order[WIDTH]) {
 #define INF 1e12f
-	static uint32_t p[9], way[9];
-	static float u[9], v[9], minv[9];
-	static bool used[9];
+	static uint32_t p[WIDTH + 1], way[WIDTH + 1];
+	static float u[WIDTH + 1], v[WIDTH + 1], minv[WIDTH + 1];
+	static bool used[WIDTH + 1];
 
 	std::fill(u, u + n + 1, 0.0f);
-	std::fill(v, v + 9, 0.0f);
-	std::fill(way, way + 9, 0);
-	std::fill(p, p + 9, 0);
+	std::fill(v, v + WIDTH + 1, 0.0f);
+	std::fill(way, way + WIDTH + 1, 0);
+	std::fill(p, p + WIDTH + 1, 0);
 
 	for (uint32_t i = 1; i <= n; ++i) {
 		p[0] = i;
 		uint32_t j0 = 0;
-		std::fill(minv, minv + 9, INF);
-		std::fill(used, used + 9, false);
+		std::fill(minv, minv + WIDTH + 1, INF);
+		std::fill(used, used + WIDTH + 1, false);
 		do {
 			used[j0] = true;
 			uint32_t i0 = p[j0], j1{};
 			float delta = INF;
-			for (uint32_t j = 1; j <= 8; ++j)
+			for (uint32_t j = 1; j <= WIDTH; ++j)
 				if (!used[j]) {
 					float cur = mat[i0 - 1][j - 1] - u[i0] - v[j];
 					if (cur < minv[j])
@@ -143,7 +154,7 @@ template <class BVHType> void WideBVHBuilder<BVHType>::hungarian(const float mat
 					if (minv[j] < delta)
 						delta = minv[j], j1 = j;
 				}
-			for (uint32_t j = 0; j <= 8; ++j)
+			for (uint32_t j = 0; j <= WIDTH; ++j)
 				if (used[j])
 					u[p[j]] += delta, v[j] -= delta;
 				else
@@ -156,48 +167,38 @@ template <class BVHType> void WideBVHBuilder<BVHType>::hungarian(const float mat
 			j0 = j1;
 		} while (j0);
 	}
-	for (uint32_t i = 1; i <= 8; ++i) {
+	for (uint32_t i = 1; i <= WIDTH; ++i) {
 		if (p[i])
 			order[p[i] - 1] = i - 1;
 	}
 #undef INF
 }
 
-template <class BVHType> void WideBVHBuilder<BVHType>::create_nodes(BVHIterator node, uint32_t wbvh_node_idx) {
+template <class BVHType, uint32_t WIDTH>
+void WideBVHBuilder<BVHType, WIDTH>::create_nodes(BVHIterator node, uint32_t wbvh_node_idx) {
 #define CUR (m_p_wbvh->m_nodes[wbvh_node_idx])
 
-	BVHIterator ch_arr[8];
+	BVHIterator ch_arr[WIDTH];
 	uint32_t ch_cnt = 0;
-	fetch_children(node, 1, &ch_cnt, ch_arr);
+	// only the root may be a leaf here, it becomes the single child of the root node
+	if (node.IsLeaf())
+		ch_arr[ch_cnt++] = node;
+	else
+		fetch_children(node, 1, &ch_cnt, ch_arr);
 
 	const AABB &cur_box = node.GetAABB();
-	glm::vec3 cell; // cell size
-	{
-		// fetch lo position
-		CUR.m_px = cur_box.min.x;
-		CUR.m_py = cur_box.min.y;
-		CUR.m_pz = cur_box.min.z;
-
-		constexpr auto kBase = float(1.0 / double((1 << 8) - 1));
-		cell = (cur_box.max - cur_box.min) * kBase;
-
-		CUR.m_ex = cell.x == 0.0f ? 0u : (uint8_t)(127 + (int32_t)std::ceil(std::log2(cell.x)));
-		CUR.m_ey = cell.y == 0.0f ? 0u : (uint8_t)(127 + (int32_t)std::ceil(std::log2(cell.y)));
-		CUR.m_ez = cell.z == 0.0f ? 0u : (uint8_t)(127 + (int32_t)std::ceil(std::log2(cell.z)));
-
-		cell.x = glm::uintBitsToFloat((uint32_t)(CUR.m_ex) << 23u);
-		cell.y = glm::uintBitsToFloat((uint32_t)(CUR.m_ey) << 23u);
-		cell.z = glm::uintBitsToFloat((uint32_t)(CUR.m_ez) << 23u);
-	}
+	glm::vec3 cell = BasicWideBVH<WIDTH>::quantize_grid(&CUR, cur_box);
 
 	// ordering the children with hungarian assignment algorithm
-	uint32_t ch_slot_arr[8];
+	uint32_t ch_slot_arr[WIDTH];
 
+	// slot j faces the diagonal of octant j, at width 4 those with positive z, so the order follows the x and y signs
+	// of the ray only
 	{
-		static float ch_cost_mat[8][8];
+		static float ch_cost_mat[WIDTH][WIDTH];
 		glm::vec3 dist;
 		for (uint32_t i = 0; i < ch_cnt; ++i)
-			for (uint32_t j = 0; j < 8; ++j) {
+			for (uint32_t j = 0; j < WIDTH; ++j) {
 				dist = ch_arr[i].GetAABB().GetCenter() - node.GetAABB().GetCenter();
 				ch_cost_mat[i][j] = ((j & 1u) ? -dist.x : dist.x) + ((j & 2u) ? -dist.y : dist.y) +
 				                    ((j & 4u) ? -dist.z : dist.z); // project to diagonal ray
@@ -205,7 +206,7 @@ template <class BVHType> void WideBVHBuilder<BVHType>::create_nodes(BVHIterator
 		hungarian(ch_cost_mat, ch_cnt, ch_slot_arr);
 	}
 
-	std::optional<BVHIterator> ch_ranked_arr[8]{};
+	std::optional<BVHIterator> ch_ranked_arr[WIDTH]{};
 	for (uint32_t i = 0; i < ch_cnt; ++i)
 		ch_ranked_arr[ch_slot_arr[i]] = ch_arr[i];
 
@@ -214,24 +215,11 @@ template <class BVHType> void WideBVHBuilder<BVHType>::create_nodes(BVHIterator
 	CUR.m_child_idx_base = (uint32_t)m_p_wbvh->m_nodes.size();
 	CUR.m_tri_idx_base = (uint32_t)m_p_wbvh->m_tri_indices.size();
 
-	for (uint32_t i = 0; i < 8; ++i) {
+	for (uint32_t i = 0; i < WIDTH; ++i) {
 		if (ch_ranked_arr[i].has_value()) {
 			const auto &cur = ch_ranked_arr[i].value();
 
-			glm::uvec3 qlow = glm::floor((cur.GetAABB().min - cur_box.min) / cell);
-			glm::uvec3 qhigh = glm::ceil((cur.GetAABB().max - cur_box.min) / cell);
-			// TODO: cast NaN to uint ?
-			qlow = glm::min(qlow, glm::uvec3(UINT8_MAX));
-			qhigh = glm::min(qhigh, glm::uvec3(UINT8_MAX));
-			qlow = glm::max(qlow, glm::uvec3(0));
-			qhigh = glm::max(qhigh, glm::uvec3(0));
-
-			CUR.m_qlox[i] = (uint8_t)qlow.x;
-			CUR.m_qloy[i] = (uint8_t)qlow.y;
-			CUR.m_qloz[i] = (uint8_t)qlow.z;
-			CUR.m_qhix[i] = (uint8_t)qhigh.x;
-			CUR.m_qhiy[i] = (uint8_t)qhigh.y;
-			CUR.m_qhiz[i] = (uint8_t)qhigh.z;
+			BasicWideBVH<WIDTH>::quantize_child(&CUR, i, cur.GetAABB(), cur_box.min, cell);
 
 			if (m_infos[cur.GetIndex()][1].m_type == NodeInfo::kLeaf) {
 				uint32_t tidx = m_p_wbvh->m_tri_indices.size() - CUR.m_tri_idx_base;
@@ -0,0 +1,270 @@
+#include "WideBVHTraversal.hpp"
+
+#include <cmath>
+
+template <uint32_t WIDTH>
+BasicWideBVHTraversal<WIDTH>::BasicWideBVHTraversal(std::shared_ptr<BVHType> bvh_ptr)
+    : BasicWideBVHTraversal{bvh_ptr, bvh_ptr->GenerateTriMatrices()} {}
+
+template <uint32_t WIDTH>
+BasicWideBVHTraversal<WIDTH>::BasicWideBVHTraversal(std::shared_ptr<BVHType> bvh_ptr,
+                                                    std::vector<glm::vec4> tri_matrices)
+    : m_bvh_ptr{std::move(bvh_ptr)}, m_tri_matrices{std::move(tri_matrices)} {
+	const auto &nodes = m_bvh_ptr->GetNodes();
+	m_parents.resize(nodes.size(), UINT32_MAX);
+	for (uint32_t i = 0; i < nodes.size(); ++i)
+		for (uint8_t meta : nodes[i].m_meta)
+			if ((meta & (meta << 1u)) & 0x10u) // inner child
+				m_parents[nodes[i].m_child_idx_base + (meta & 0x1fu) - 24u] = i;
+}
+
+template <uint32_t WIDTH> double BasicWideBVHTraversal<WIDTH>::Refit() {
+	double sah_ratio = m_bvh_ptr->Refit();
+	m_bvh_ptr->GenerateTriMatrices(&m_tri_matrices);
+	return sah_ratio;
+}
+
+template <uint32_t WIDTH>
+typename BasicWideBVHTraversal<WIDTH>::TraversalRay BasicWideBVHTraversal<WIDTH>::make_traversal_ray(const Ray &ray) {
+	constexpr float kOOEps = 5.42101086242752217e-20f; // exp2(-64)
+
+	TraversalRay ret;
+	ret.dir = ray.dir;
+	for (uint32_t i = 0; i < 3; ++i)
+		ret.dir[i] = std::abs(ret.dir[i]) > kOOEps ? ret.dir[i] : (ret.dir[i] >= 0 ? kOOEps : -kOOEps);
+	ret.dir = glm::normalize(ret.dir);
+	ret.idir = 1.0f / ret.dir;
+	ret.octinv = 7u - ((ret.dir.x < 0 ? 1u : 0u) | (ret.dir.y < 0 ? 2u : 0u) | (ret.dir.z < 0 ? 4u : 0u));
+	ret.origin = ray.origin;
+	ret.tmin = ray.tmin;
+	return ret;
+}
+
+template <uint32_t WIDTH>
+inline uint32_t BasicWideBVHTraversal<WIDTH>::intersect_children(const TraversalRay &ray,
+                                                                 const typename BVHType::Node &node, float hit_t,
+                                                                 RayStats *p_stats) const {
+	const glm::vec3 &idir = ray.idir;
+	const glm::vec3 adjusted_idir = {glm::uintBitsToFloat((uint32_t)node.m_ex << 23u) * idir.x,
+	                                 glm::uintBitsToFloat((uint32_t)node.m_ey << 23u) * idir.y,
+	                                 glm::uintBitsToFloat((uint32_t)node.m_ez << 23u) * idir.z};
+	const glm::vec3 adjusted_origin = (glm::vec3{node.m_px, node.m_py, node.m_pz} - ray.origin) * idir;
+
+	uint32_t hitmask = 0u;
+	for (uint32_t i = 0; i < WIDTH; ++i) {
+		uint32_t meta = node.m_meta[i];
+		if (!meta)
+			continue;
+		ADYPT_TRAVERSAL_STAT(++p_stats->m_child_tests);
+		bool is_inner = (meta & (meta << 1u)) & 0x10u;
+		uint32_t bit_index = (meta ^ (is_inner ? ray.octinv : 0u)) & 0x1fu;
+		uint32_t child_bits = (meta >> 5u) & 0x07u;
+
+		float lox = idir.x < 0 ? node.m_qhix[i] : node.m_qlox[i];
+		float hix = idir.x < 0 ? node.m_qlox[i] : node.m_qhix[i];
+		float loy = idir.y < 0 ? node.m_qhiy[i] : node.m_qloy[i];
+		float hiy = idir.y < 0 ? node.m_qloy[i] : node.m_qhiy[i];
+		float loz = idir.z < 0 ? node.m_qhiz[i] : node.m_qloz[i];
+		float hiz = idir.z < 0 ? node.m_qloz[i] : node.m_qhiz[i];
+
+		float ctmin =
+		    std::max(std::max(lox * adjusted_idir.x + adjusted_origin.x, loy * adjusted_idir.y + adjusted_origin.y),
+		             std::max(loz * adjusted_idir.z + adjusted_origin.z, ray.tmin));
+		float ctmax =
+		    std::min(std::min(hix * adjusted_idir.x + adjusted_origin.x, hiy * adjusted_idir.y + adjusted_origin.y),
+		             std::min(hiz * adjusted_idir.z + adjusted_origin.z, hit_t));
+		if (ctmin <= ctmax)
+			hitmask |= child_bits << bit_index;
+	}
+	return hitmask;
+}
+
+template <uint32_t WIDTH>
+inline void BasicWideBVHTraversal<WIDTH>::intersect_triangles(const TraversalRay &ray, glm::uvec2 tri_group,
+                                                              float *p_hit_t, uint32_t *p_hit_idx, glm::vec2 *p_hit_uv,
+                                                              RayStats *p_stats) const {
+	while (tri_group.y != 0) {
+		uint32_t tri_idx = glm::findLSB(tri_group.y);
+		tri_group.y &= ~(1u << tri_idx);
+		tri_idx += tri_group.x;
+		ADYPT_TRAVERSAL_STAT(++p_stats->m_triangle_tests);
+
+		const glm::vec4 *woop = m_tri_matrices.data() + tri_idx * 3u;
+		float t = (woop[0].w - glm::dot(ray.origin, glm::vec3(woop[0]))) / glm::dot(ray.dir, glm::vec3(woop[0]));
+		if (t > ray.tmin && t < *p_hit_t) {
+			glm::vec3 position = ray.origin + t * ray.dir;
+			float u = woop[1].w + glm::dot(position, glm::vec3(woop[1]));
+			if (u >= 0.0f && u <= 1.0f) {
+				float v = woop[2].w + glm::dot(position, glm::vec3(woop[2]));
+				if (v >= 0.0f && u + v <= 1.0f) {
+					*p_hit_t = t;
+					*p_hit_uv = {u, v};
+					*p_hit_idx = tri_idx;
+				}
+			}
+		}
+	}
+}
+
+template <uint32_t WIDTH>
+bool BasicWideBVHTraversal<WIDTH>::Intersect(const Ray &in_ray, Hit *p_hit, RayStats *p_stats) const {
+	const TraversalRay ray = make_traversal_ray(in_ray);
+	const auto &nodes = m_bvh_ptr->GetNodes();
+
+	float hit_t = in_ray.tmax;
+	uint32_t hit_idx = UINT32_MAX;
+	glm::vec2 hit_uv{};
+
+	// the shader stack is fixed-size, spill to a vector rather than writing out of bounds
+	glm::uvec2 stack[kStackSize];
+	std::vector<glm::uvec2> spill_stack;
+	uint32_t stack_ptr = 0;
+
+	glm::uvec2 tri_group{}, node_group{0u, 0x80000000u};
+
+	while (true) {
+		if (node_group.y > 0x00ffffffu) {
+			uint32_t imask = node_group.y;
+			uint32_t child_bit_index = glm::findMSB(node_group.y);
+			uint32_t child_node_base_index = node_group.x;
+
+			node_group.y &= ~(1u << child_bit_index);
+
+			if (node_group.y > 0x00ffffffu) {
+				if (stack_ptr < kStackSize)
+					stack[stack_ptr] = node_group;
+				else {
+					spill_stack.push_back(node_group);
+					ADYPT_TRAVERSAL_STAT(++p_stats->m_stack_overflows);
+				}
+				++stack_ptr;
+				ADYPT_TRAVERSAL_STAT(p_stats->m_max_stack_depth = std::max(p_stats->m_max_stack_depth, stack_ptr));
+			}
+
+			uint32_t slot_index = (child_bit_index - 24u) ^ ray.octinv;
+			uint32_t relative_index = glm::bitCount(imask & ~(0xffffffffu << slot_index));
+			const auto &node = nodes[child_node_base_index + relative_index];
+			ADYPT_TRAVERSAL_STAT(++p_stats->m_node_visits);
+
+			uint32_t hitmask = intersect_children(ray, node, hit_t, p_stats);
+			node_group = {node.m_child_idx_base, (hitmask & 0xff000000u) | node.m_imask};
+			tri_group = {node.m_tri_idx_base, hitmask & 0x00ffffffu};
+		} else {
+			tri_group = node_group;
+			node_group = glm::uvec2{0u};
+		}
+
+		intersect_triangles(ray, tri_group, &hit_t, &hit_idx, &hit_uv, p_stats);
+
+		if (node_group.y <= 0x00ffffffu) {
+			if (stack_ptr == 0u)
+				break;
+			--stack_ptr;
+			if (stack_ptr < kStackSize)
+				node_group = stack[stack_ptr];
+			else {
+				node_group = spill_stack.back();
+				spill_stack.pop_back();
+			}
+		}
+	}
+
+	if (hit_idx == UINT32_MAX)
+		return false;
+	p_hit->tri_idx = m_bvh_ptr->GetTriIndices()[hit_idx];
+	p_hit->t = hit_t;
+	p_hit->uv = hit_uv;
+	return true;
+}
+
+template <uint32_t WIDTH>
+bool BasicWideBVHTraversal<WIDTH>::IntersectShortStack(const Ray &in_ray, uint32_t stack_size, Hit *p_hit,
+                                                       RayStats *p_stats) const {
+	const TraversalRay ray = make_traversal_ray(in_ray);
+	const auto &nodes = m_bvh_ptr->GetNodes();
+	stack_size = std::clamp(stack_size, 1u, kStackSize);
+
+	float hit_t = in_ray.tmax;
+	uint32_t hit_idx = UINT32_MAX;
+	glm::vec2 hit_uv{};
+
+	// ring buffer, pushing to a full stack overwrites the oldest entry
+	glm::uvec2 stack[kStackSize];
+	uint32_t stack_begin = 0, stack_count = 0;
+	bool dropped = false;
+
+	glm::uvec2 tri_group{}, node_group{0u, 0x80000000u};
+	uint32_t last_node = 0;
+
+	while (true) {
+		if (node_group.y > 0x00ffffffu) {
+			uint32_t imask = node_group.y;
+			uint32_t child_bit_index = glm::findMSB(node_group.y);
+			uint32_t child_node_base_index = node_group.x;
+
+			node_group.y &= ~(1u << child_bit_index);
+
+			if (node_group.y > 0x00ffffffu) {
+				if (stack_count == stack_size) {
+					stack_begin = (stack_begin + 1u) % stack_size;
+					--stack_count;
+					dropped = true;
+					ADYPT_TRAVERSAL_STAT(++p_stats->m_stack_overflows);
+				}
+				stack[(stack_begin + stack_count++) % stack_size] = node_group;
+				ADYPT_TRAVERSAL_STAT(p_stats->m_max_stack_depth = std::max(p_stats->m_max_stack_depth, stack_count));
+			}
+
+			uint32_t slot_index = (child_bit_index - 24u) ^ ray.octinv;
+			last_node = child_node_base_index + glm::bitCount(imask & ~(0xffffffffu << slot_index));
+			const auto &node = nodes[last_node];
+			ADYPT_TRAVERSAL_STAT(++p_stats->m_node_visits);
+
+			uint32_t hitmask = intersect_children(ray, node, hit_t, p_stats);
+			node_group = {node.m_child_idx_base, (hitmask & 0xff000000u) | node.m_imask};
+			tri_group = {node.m_tri_idx_base, hitmask & 0x00ffffffu};
+		} else {
+			tri_group = node_group;
+			node_group = glm::uvec2{0u};
+		}
+
+		intersect_triangles(ray, tri_group, &hit_t, &hit_idx, &hit_uv, p_stats);
+
+		if (node_group.y <= 0x00ffffffu) {
+			if (stack_count) {
+				node_group = stack[(stack_begin + --stack_count) % stack_size];
+				continue;
+			}
+			if (!dropped)
+				break;
+
+			// Everything below last_node is done and every group still held by the stack was popped, so the only
+			// unvisited subtrees are the later siblings along the path to the root, which are re-intersected here.
+			// Children are visited in descending hit bit order, the later siblings are the lower bits.
+			ADYPT_TRAVERSAL_STAT(++p_stats->m_restarts);
+			for (uint32_t cur = last_node; m_parents[cur] != UINT32_MAX; cur = m_parents[cur]) {
+				const auto &parent = nodes[m_parents[cur]];
+				uint32_t bit_index = 24u + ((cur - parent.m_child_idx_base) ^ ray.octinv);
+				ADYPT_TRAVERSAL_STAT(++p_stats->m_node_visits);
+				uint32_t later_bits =
+				    intersect_children(ray, parent, hit_t, p_stats) & 0xff000000u & ((1u << bit_index) - 1u);
+				if (later_bits) {
+					node_group = {parent.m_child_idx_base, later_bits | parent.m_imask};
+					break;
+				}
+			}
+			if (node_group.y <= 0x00ffffffu)
+				break;
+		}
+	}
+
+	if (hit_idx == UINT32_MAX)
+		return false;
+	p_hit->tri_idx = m_bvh_ptr->GetTriIndices()[hit_idx];
+	p_hit->t = hit_t;
+	p_hit->uv = hit_uv;
+	return true;
+}
+
+template class BasicWideBVHTraversal<4>;
+template class BasicWideBVHTraversal<8>;
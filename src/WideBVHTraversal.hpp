@@ -0,0 +1,87 @@
+#ifndef ADYPT_WIDEBVHTRAVERSAL_HPP
+#define ADYPT_WIDEBVHTRAVERSAL_HPP
+
+#include "WideBVH.hpp"
+#include <cinttypes>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+// per-ray counters, the hooks filling them only exist with ADYPT_TRAVERSAL_STATS
+#ifdef ADYPT_TRAVERSAL_STATS
+#define ADYPT_TRAVERSAL_STAT(STMT) \
+	do { \
+		if (p_stats) { \
+			STMT; \
+		} \
+	} while (false)
+#else
+#define ADYPT_TRAVERSAL_STAT(STMT) \
+	do { \
+		(void)p_stats; \
+	} while (false)
+#endif
+
+struct RayStats {
+	uint32_t m_node_visits{}, m_child_tests{}, m_triangle_tests{};
+	uint32_t m_max_stack_depth{}, m_stack_overflows{};
+	uint32_t m_restarts{}; // parent-pointer backtracks of the short-stack variant
+};
+
+// CPU reference of BVHIntersection() in shader/accelerated_scene.glsl, over the nodes of a BasicWideBVH<WIDTH>
+template <uint32_t WIDTH> class BasicWideBVHTraversal {
+public:
+	using BVHType = BasicWideBVH<WIDTH>;
+
+	static constexpr uint32_t kStackSize = 23 * 10; // kTraversalStackSize of the shader
+
+	struct Ray {
+		glm::vec3 origin;
+		float tmin;
+		glm::vec3 dir;
+		float tmax{1e9f};
+	};
+	struct Hit {
+		uint32_t tri_idx{UINT32_MAX}; // scene triangle index
+		float t{};
+		glm::vec2 uv{};
+	};
+
+private:
+	std::shared_ptr<BVHType> m_bvh_ptr;
+	std::vector<glm::vec4> m_tri_matrices;
+	std::vector<uint32_t> m_parents; // parent node of every wide node, the short-stack fallback walks it
+
+	struct TraversalRay {
+		glm::vec3 origin, dir, idir;
+		uint32_t octinv;
+		float tmin;
+	};
+	static TraversalRay make_traversal_ray(const Ray &ray);
+	inline uint32_t intersect_children(const TraversalRay &ray, const typename BVHType::Node &node, float hit_t,
+	                                   RayStats *p_stats) const;
+	inline void intersect_triangles(const TraversalRay &ray, glm::uvec2 tri_group, float *p_hit_t,
+	                                uint32_t *p_hit_idx, glm::vec2 *p_hit_uv, RayStats *p_stats) const;
+
+public:
+	explicit BasicWideBVHTraversal(std::shared_ptr<BVHType> bvh_ptr);
+	// with the matrices of bvh_ptr->GenerateTriMatrices() generated before
+	BasicWideBVHTraversal(std::shared_ptr<BVHType> bvh_ptr, std::vector<glm::vec4> tri_matrices);
+
+	const std::shared_ptr<BVHType> &GetBVHPtr() const { return m_bvh_ptr; }
+
+	// WideBVH::Refit() and the triangle matrices updated in place, returns its SAH ratio
+	double Refit();
+
+	// p_stats is ignored unless built with ADYPT_TRAVERSAL_STATS
+	bool Intersect(const Ray &ray, Hit *p_hit, RayStats *p_stats = nullptr) const;
+	// same result with a stack of stack_size (<= kStackSize) entries, the oldest entries are dropped when it is full
+	// and the subtrees they held are recovered by backtracking through parent pointers once it runs empty
+	bool IntersectShortStack(const Ray &ray, uint32_t stack_size, Hit *p_hit, RayStats *p_stats = nullptr) const;
+};
+
+// both are instantiated in WideBVHTraversal.cpp
+using WideBVHTraversal = BasicWideBVHTraversal<8>;
+using WideBVH4Traversal = BasicWideBVHTraversal<4>;
+
+#endif
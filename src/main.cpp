@@ -1,8 +1,120 @@
 #include "Application.hpp"
+#include "BVHBuilder.hpp"
+#include "BVHMetrics.hpp"
+#include "BuildTrace.hpp"
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <spdlog/spdlog.h>
 
 constexpr const char *kHelpStr = "AdamYuan's Path Tracer (Driven by Vulkan)\n"
-                                 "\t-obj [WAVEFRONT OBJ FILENAME]";
+                                 "\t-obj [WAVEFRONT OBJ FILENAME]\n"
+                                 "\t-cache [BVH CACHE FILENAME] (loaded if valid, written otherwise)\n"
+                                 "\t-builder [sbvh|parallel|pss|shape] (default parallel)\n"
+                                 "\t-threads [THREAD COUNT] (default all hardware threads)\n"
+                                 "\t-numa (pin builder threads and their memory to NUMA nodes)\n"
+                                 "\t-spatial-depth [MAX SPATIAL SPLIT DEPTH]\n"
+                                 "\t-triangle-sah [TRIANGLE COST]\n"
+                                 "\t-node-sah [NODE COST]\n"
+                                 "\t-duplication-budget [MAX REFERENCES PER TRIANGLE] (e.g. 1.3, default unlimited)\n"
+                                 "\t-presplit [AABB TO TRIANGLE AREA RATIO] (e.g. 8, default off)\n"
+                                 "\t-optimize [TIME BUDGET MS] [TARGET SAH REDUCTION] (e.g. 200 0.1)\n"
+                                 "\t-optimizer [rotation|treelet] (default rotation)\n"
+                                 "\t-budget [TIME BUDGET MS] (parallel builders finish with median splits past it)\n"
+                                 "\t-bins [MIN] [MAX] (per node split bins, default 8 256, 32 32 fixes the count)\n"
+                                 "\t-tuning [TUNING FILENAME] (task granularity, calibrated and written if missing)\n"
+                                 "\t-trace [CHROME TRACE JSON FILENAME] (scene loading and BVH build)\n"
+                                 "Batch mode (no window, build and exit):\n"
+                                 "\t-batch\n"
+                                 "\t-stats [STATS JSON FILENAME]";
+
+struct BatchResult {
+	std::shared_ptr<WideBVH> m_wide_bvh;
+	std::string m_binary_metrics;
+	BuildStats m_build_stats;
+	double m_build_ms{}, m_collapse_ms{};
+};
+
+// The first Ctrl+C during a batch build of a builder with a build budget finishes the tree with median splits, a
+// second one (or one during the collapse and metrics) kills the process as usual
+static std::atomic_bool s_cancel_build{false};
+static_assert(std::atomic_bool::is_always_lock_free);
+
+static BatchResult batch_build(BVHConfig config, const std::shared_ptr<Scene> &scene) {
+	using SignalHandler = void (*)(int);
+	SignalHandler prev_handler = SIG_DFL;
+	bool cancelable = config.HasBuildBudget();
+	if (cancelable) {
+		config.m_p_cancel = &s_cancel_build;
+		prev_handler = std::signal(SIGINT, [](int) {
+			s_cancel_build.store(true, std::memory_order_relaxed);
+			std::signal(SIGINT, SIG_DFL);
+		});
+	}
+	BatchResult ret;
+	auto begin = std::chrono::steady_clock::now();
+	BuildBinaryBVH(config, scene, [&](const auto &binary_bvh) {
+		auto built = std::chrono::steady_clock::now();
+		if (cancelable)
+			std::signal(SIGINT, prev_handler);
+		ret.m_wide_bvh = WideBVH::Build(binary_bvh);
+		auto collapsed = std::chrono::steady_clock::now();
+		ret.m_build_ms = std::chrono::duration<double, std::milli>(built - begin).count();
+		ret.m_collapse_ms = std::chrono::duration<double, std::milli>(collapsed - built).count();
+		ret.m_binary_metrics = BVHMetrics::Compute(*binary_bvh, config, BVHMetrics::kReportEPOSamples).ToJSON();
+		ret.m_build_stats = binary_bvh->GetBuildStats();
+	});
+	return ret;
+}
+
+static int run_batch(const char *filename, const char *cache_filename, const char *stats_filename,
+                     const BVHConfig &config) {
+	auto begin = std::chrono::steady_clock::now();
+	std::shared_ptr<Scene> scene = Scene::CreateFromFile(filename);
+	if (!scene)
+		return EXIT_FAILURE;
+	double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+	BatchResult result = batch_build(config, scene);
+	spdlog::info("BVH built in {:.1f} ms, collapsed in {:.1f} ms", result.m_build_ms, result.m_collapse_ms);
+	result.m_build_stats.Log();
+
+	if (cache_filename && !result.m_wide_bvh->SaveToFile(cache_filename))
+		return EXIT_FAILURE;
+
+	if (stats_filename) {
+		std::string json = fmt::format(
+		    R"({{"scene":"{}","triangles":{},"builder":"{}","threads":{},"numa":{},"max_spatial_depth":{},)"
+		    R"("triangle_sah":{},"node_sah":{},"duplication_budget":{},"presplit_threshold":{},"optimize_ms":{},)"
+		    R"("optimize_target":{},"optimizer":"{}","min_bins":{},"max_bins":{},"build_budget_ms":{},)"
+		    R"("load_ms":{},"build_ms":{},)"
+		    R"("collapse_ms":{},"build_stats":{},"binary":{},"wide":{}}})"
+		    "\n",
+		    filename, scene->GetTriangles().size(), BVHConfig::GetBuilderName(config.m_builder),
+		    config.GetThreadCount(), config.m_numa, config.m_max_spatial_depth, config.m_triangle_sah,
+		    config.m_node_sah, config.m_duplication_budget, config.m_presplit_threshold, config.m_optimize_ms,
+		    config.m_optimize_target,
+		    BVHConfig::GetOptimizerName(config.m_optimizer), config.m_min_bins, config.m_max_bins, config.m_build_ms,
+		    load_ms,
+		    result.m_build_ms, result.m_collapse_ms,
+		    result.m_build_stats.ToJSON(), result.m_binary_metrics,
+		    BVHMetrics::Compute(*result.m_wide_bvh, config, BVHMetrics::kReportEPOSamples).ToJSON());
+		FILE *file = fopen(stats_filename, "w");
+		if (!file) {
+			spdlog::error("Failed to open {}", stats_filename);
+			return EXIT_FAILURE;
+		}
+		fputs(json.c_str(), file);
+		fclose(file);
+		spdlog::info("Stats written to {}", stats_filename);
+	}
+	return EXIT_SUCCESS;
+}
+
+static bool write_trace(const char *filename) {
+	BuildTrace::Disable();
+	return BuildTrace::WriteJSON(filename);
+}
 
 int main(int argc, char **argv) {
 	spdlog::set_pattern("[%H:%M:%S.%e] [%^%l%$] [thread %t] %v");
@@ -10,9 +122,55 @@ int main(int argc, char **argv) {
 	--argc;
 	++argv;
 	char **filename = nullptr;
+	const char *cache_filename = nullptr, *stats_filename = nullptr, *trace_filename = nullptr,
+	           *tuning_filename = nullptr;
+	bool batch = false;
+	BVHConfig bvh_config = {};
 	for (int i = 0; i < argc; ++i) {
 		if (i + 1 < argc && strcmp(argv[i], "-obj") == 0)
 			filename = argv + i + 1, ++i;
+		else if (i + 1 < argc && strcmp(argv[i], "-cache") == 0)
+			cache_filename = argv[++i];
+		else if (strcmp(argv[i], "-batch") == 0)
+			batch = true;
+		else if (i + 1 < argc && strcmp(argv[i], "-builder") == 0) {
+			if (!BVHConfig::ParseBuilder(argv[++i], &bvh_config.m_builder)) {
+				spdlog::error("Unknown builder {}", argv[i]);
+				return EXIT_FAILURE;
+			}
+		} else if (i + 1 < argc && strcmp(argv[i], "-threads") == 0)
+			bvh_config.m_thread_count = std::stoul(argv[++i]);
+		else if (strcmp(argv[i], "-numa") == 0)
+			bvh_config.m_numa = true;
+		else if (i + 1 < argc && strcmp(argv[i], "-spatial-depth") == 0)
+			bvh_config.m_max_spatial_depth = std::stoul(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-triangle-sah") == 0)
+			bvh_config.m_triangle_sah = std::stof(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-node-sah") == 0)
+			bvh_config.m_node_sah = std::stof(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-duplication-budget") == 0)
+			bvh_config.m_duplication_budget = std::stof(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-presplit") == 0)
+			bvh_config.m_presplit_threshold = std::stof(argv[++i]);
+		else if (i + 2 < argc && strcmp(argv[i], "-optimize") == 0) {
+			bvh_config.m_optimize_ms = std::stoul(argv[++i]);
+			bvh_config.m_optimize_target = std::stof(argv[++i]);
+		} else if (i + 1 < argc && strcmp(argv[i], "-optimizer") == 0) {
+			if (!BVHConfig::ParseOptimizer(argv[++i], &bvh_config.m_optimizer)) {
+				spdlog::error("Unknown optimizer {}", argv[i]);
+				return EXIT_FAILURE;
+			}
+		} else if (i + 1 < argc && strcmp(argv[i], "-budget") == 0)
+			bvh_config.m_build_ms = std::stoul(argv[++i]);
+		else if (i + 2 < argc && strcmp(argv[i], "-bins") == 0) {
+			bvh_config.m_min_bins = std::stoul(argv[++i]);
+			bvh_config.m_max_bins = std::stoul(argv[++i]);
+		} else if (i + 1 < argc && strcmp(argv[i], "-tuning") == 0)
+			tuning_filename = argv[++i];
+		else if (i + 1 < argc && strcmp(argv[i], "-stats") == 0)
+			stats_filename = argv[++i];
+		else if (i + 1 < argc && strcmp(argv[i], "-trace") == 0)
+			trace_filename = argv[++i];
 		else {
 			puts(kHelpStr);
 			return EXIT_FAILURE;
@@ -24,9 +182,24 @@ int main(int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 
+	// calibrating traces a build of its own, so before tracing starts
+	if (tuning_filename)
+		bvh_config.m_tuning = BuildTuning::LoadOrCalibrate(tuning_filename, bvh_config);
+	if (trace_filename)
+		BuildTrace::Enable();
+
+	if (batch) {
+		int ret = run_batch(*filename, cache_filename, stats_filename, bvh_config);
+		if (trace_filename && !write_trace(trace_filename))
+			ret = EXIT_FAILURE;
+		return ret;
+	}
+
 	{
 		Application app{};
-		app.Load(*filename);
+		app.Load(*filename, bvh_config, cache_filename);
+		if (trace_filename)
+			write_trace(trace_filename);
 		app.Run();
 	}
 